@@ -0,0 +1,892 @@
+#include <c4/fs/fs.hpp>
+#include <c4/std/std.hpp>
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/* Benchmarks for the file contents and copy APIs.
+ *
+ * The file sizes are swept from 0 bytes to C4FS_BM_MAX_SIZE (default:
+ * 4GiB). The fixture files are created in C4FS_BM_DIR (default: the
+ * current directory). Both are read from the environment, eg:
+ *
+ *   C4FS_BM_MAX_SIZE=67108864 C4FS_BM_DIR=/mnt/nvme ./c4fs-bm-fs
+ *
+ * Reported counters:
+ *   - GB/s: throughput, in 10^9 bytes per second
+ *   - syscalls/call: number of syscalls issued per call. Counted with
+ *     the raw_syscalls:sys_enter tracepoint; this is only available
+ *     on linux, and requires permission to open perf events (see
+ *     /proc/sys/kernel/perf_event_paranoid). When not available,
+ *     the counter is reported as -1.
+ *
+ * The cold-cache variants evict the file from the page cache
+ * before each call with posix_fadvise(POSIX_FADV_DONTNEED).
+ */
+
+namespace c4 {
+namespace fs {
+namespace bm {
+
+C4_SUPPRESS_WARNING_GCC_CLANG_WITH_PUSH("-Wold-style-cast")
+
+
+//-----------------------------------------------------------------------------
+
+uint64_t env_u64(const char *name, uint64_t default_value)
+{
+    const char *val = getenv(name);
+    if(!val || !val[0])
+        return default_value;
+    return static_cast<uint64_t>(strtoull(val, nullptr, 10));
+}
+
+std::string const& bm_dir()
+{
+    static const std::string dir = [](){
+        const char *val = getenv("C4FS_BM_DIR");
+        return std::string((val && val[0]) ? val : ".");
+    }();
+    return dir;
+}
+
+std::vector<size_t> const& bm_sizes()
+{
+    static const std::vector<size_t> sizes = [](){
+        const uint64_t max_size = env_u64("C4FS_BM_MAX_SIZE", UINT64_C(4) << 30);
+        const uint64_t all[] = {
+            0,
+            UINT64_C(1) << 6,  // 64B
+            UINT64_C(1) << 10, // 1KiB
+            UINT64_C(1) << 12, // 4KiB
+            UINT64_C(1) << 16, // 64KiB
+            UINT64_C(1) << 20, // 1MiB
+            UINT64_C(1) << 24, // 16MiB
+            UINT64_C(1) << 28, // 256MiB
+            UINT64_C(1) << 30, // 1GiB
+            UINT64_C(1) << 32, // 4GiB
+        };
+        std::vector<size_t> s;
+        for(uint64_t sz : all)
+            if(sz <= max_size && sz <= SIZE_MAX)
+                s.push_back(static_cast<size_t>(sz));
+        return s;
+    }();
+    return sizes;
+}
+
+
+//-----------------------------------------------------------------------------
+
+/** counts the syscalls issued by this thread (and by threads
+ * it spawns) by using the raw_syscalls:sys_enter tracepoint */
+struct SyscallCounter
+{
+    int m_fd;
+    uint64_t m_overhead;
+
+    SyscallCounter() : m_fd(-1), m_overhead(0)
+    {
+        #if defined(__linux__)
+        const char *id_files[] = {
+            "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+            "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+        };
+        long long id = -1;
+        for(const char *id_file : id_files)
+        {
+            ::FILE *f = fopen(id_file, "r");
+            if(!f)
+                continue;
+            if(fscanf(f, "%lld", &id) != 1)
+                id = -1;
+            fclose(f);
+            if(id >= 0)
+                break;
+        }
+        if(id < 0)
+            return;
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = static_cast<uint64_t>(id);
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.sample_period = 1;
+        m_fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        #endif
+    }
+    ~SyscallCounter()
+    {
+        #if defined(__linux__)
+        if(m_fd >= 0)
+            close(m_fd);
+        #endif
+    }
+
+    bool valid() const { return m_fd >= 0; }
+
+    void start()
+    {
+        #if defined(__linux__)
+        if(m_fd < 0)
+            return;
+        m_overhead = 0;
+        ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        #endif
+    }
+    void pause()
+    {
+        #if defined(__linux__)
+        if(m_fd < 0)
+            return;
+        ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+        ++m_overhead; // the disabling ioctl is counted
+        #endif
+    }
+    void resume()
+    {
+        #if defined(__linux__)
+        if(m_fd >= 0)
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        #endif
+    }
+    /** @return the number of syscalls since start(), excluding the
+     * counter's own ioctls */
+    uint64_t stop()
+    {
+        #if defined(__linux__)
+        if(m_fd < 0)
+            return 0;
+        pause();
+        uint64_t count = 0;
+        if(read(m_fd, &count, sizeof(count)) != static_cast<::ssize_t>(sizeof(count)))
+            return 0;
+        return count > m_overhead ? count - m_overhead : 0;
+        #else
+        return 0;
+        #endif
+    }
+};
+
+SyscallCounter& syscall_counter()
+{
+    static SyscallCounter counter;
+    return counter;
+}
+
+/** pause the timing and the syscall counter. The counter is paused
+ * first and resumed last, because PauseTiming() and ResumeTiming()
+ * read the thread's cpu time, which is a syscall. */
+struct ScopedPause
+{
+    benchmark::State &m_st;
+    ScopedPause(benchmark::State &st) : m_st(st)
+    {
+        syscall_counter().pause();
+        m_st.PauseTiming();
+    }
+    ~ScopedPause()
+    {
+        m_st.ResumeTiming();
+        syscall_counter().resume();
+    }
+};
+
+void report(benchmark::State &st, size_t bytes_per_call, uint64_t num_syscalls)
+{
+    SyscallCounter const& counter = syscall_counter();
+    const double num_bytes = static_cast<double>(bytes_per_call) * static_cast<double>(st.iterations());
+    st.SetBytesProcessed(static_cast<int64_t>(num_bytes));
+    st.counters["GB/s"] = benchmark::Counter(num_bytes * 1.e-9, benchmark::Counter::kIsRate);
+    st.counters["syscalls/call"] = counter.valid() ?
+        benchmark::Counter(static_cast<double>(num_syscalls), benchmark::Counter::kAvgIterations)
+        :
+        benchmark::Counter(-1.);
+}
+
+/** run the benchmark loop, reporting throughput and syscall counts */
+template<class Fn>
+void run(benchmark::State &st, size_t bytes_per_call, Fn &&fn)
+{
+    syscall_counter().start();
+    for(auto _ : st)
+        fn();
+    report(st, bytes_per_call, syscall_counter().stop());
+}
+
+/** run the benchmark loop, calling an untimed setup function before
+ * each call */
+template<class Setup, class Fn>
+void run(benchmark::State &st, size_t bytes_per_call, Setup &&setup, Fn &&fn)
+{
+    syscall_counter().start();
+    for(auto _ : st)
+    {
+        {
+            ScopedPause pause(st);
+            setup();
+        }
+        fn();
+    }
+    report(st, bytes_per_call, syscall_counter().stop());
+}
+
+
+//-----------------------------------------------------------------------------
+
+std::string fixture_name(const char *what, size_t sz)
+{
+    std::string name = bm_dir();
+    name += "/c4fs_bm_";
+    name += what;
+    name += '_';
+    name += std::to_string(sz);
+    name += ".dat";
+    return name;
+}
+
+std::deque<std::string>& fixture_files()
+{
+    static std::deque<std::string> files; // deque: keep the names' addresses stable
+    return files;
+}
+
+/** get a durable file with the given size, creating it on first use */
+const char* fixture_file(size_t sz)
+{
+    std::string name = fixture_name("src", sz);
+    for(std::string const& f : fixture_files())
+        if(f == name)
+            return f.c_str();
+    #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int fd = ::open(name.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    C4_CHECK_MSG(fd >= 0, "could not open %s", name.c_str());
+    std::vector<char> chunk(size_t(1) << 20);
+    for(size_t i = 0; i < chunk.size(); ++i)
+        chunk[i] = static_cast<char>('a' + (i % 26));
+    size_t remaining = sz;
+    while(remaining)
+    {
+        size_t n = remaining < chunk.size() ? remaining : chunk.size();
+        ::ssize_t w = ::write(fd, chunk.data(), n);
+        C4_CHECK(w > 0);
+        remaining -= static_cast<size_t>(w);
+    }
+    C4_CHECK(::fsync(fd) == 0); // otherwise the pages cannot be evicted
+    ::close(fd);
+    #else
+    std::string contents(sz, 'a');
+    file_put_contents(name.c_str(), contents);
+    #endif
+    fixture_files().emplace_back(std::move(name));
+    return fixture_files().back().c_str();
+}
+
+std::deque<std::string>& fixture_dirs()
+{
+    static std::deque<std::string> dirs;
+    return dirs;
+}
+
+/** get a flat directory with the given number of files, each with
+ * @p entry_size bytes, creating it on first use */
+const char* fixture_dir(size_t num_entries, size_t entry_size=0)
+{
+    std::string name = fixture_name("dir", num_entries);
+    if(entry_size)
+        name += "_" + std::to_string(entry_size);
+    for(std::string const& d : fixture_dirs())
+        if(d == name)
+            return d.c_str();
+    C4_CHECK(mkdir(name.c_str()) == 0);
+    std::string entry;
+    std::string contents(entry_size, 'e');
+    for(size_t i = 0; i < num_entries; ++i)
+    {
+        entry = name;
+        entry += "/blob_";
+        entry += std::to_string(i);
+        file_put_contents(entry.c_str(), contents);
+    }
+    fixture_dirs().emplace_back(std::move(name));
+    return fixture_dirs().back().c_str();
+}
+
+void remove_fixture_files()
+{
+    for(std::string const& f : fixture_files())
+        rmfile(f.c_str());
+    fixture_files().clear();
+    for(std::string const& d : fixture_dirs())
+        rmtree(d.c_str());
+    fixture_dirs().clear();
+}
+
+/** drop the file's pages from the page cache */
+void evict(const char *filename)
+{
+    #if defined(C4_POSIX) && !defined(C4_MACOS) && !defined(C4_IOS)
+    int fd = ::open(filename, O_RDONLY);
+    C4_CHECK(fd >= 0);
+    ::fdatasync(fd);
+    C4_CHECK(::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+    ::close(fd);
+    #else
+    C4_UNUSED(filename);
+    #endif
+}
+
+
+//-----------------------------------------------------------------------------
+
+void bm_file_get_contents(benchmark::State &st, size_t sz, bool cold, int hints=ACCESS_NORMAL)
+{
+    const char *src = fixture_file(sz);
+    auto fn = [&]{
+        std::string s = file_get_contents<std::string>(src, default_read_access, hints);
+        benchmark::DoNotOptimize(s.data());
+    };
+    if(cold)
+        run(st, sz, [&]{ evict(src); }, fn);
+    else
+        run(st, sz, fn);
+}
+
+void bm_file_get_contents_direct(benchmark::State &st, size_t sz, bool cold)
+{
+    const char *src = fixture_file(sz);
+    auto fn = [&]{
+        std::string s;
+        file_get_contents_direct(src, &s);
+        benchmark::DoNotOptimize(s.data());
+    };
+    if(cold)
+        run(st, sz, [&]{ evict(src); }, fn);
+    else
+        run(st, sz, fn);
+}
+
+void bm_mapped_file(benchmark::State &st, size_t sz, bool cold)
+{
+    const char *src = fixture_file(sz);
+    auto fn = [&]{
+        MappedFile mf(src, ACCESS_SEQUENTIAL);
+        size_t sum = 0;
+        for(size_t i = 0; i < mf.size(); i += 4096) // touch every page
+            sum += static_cast<size_t>(mf.data()[i]);
+        benchmark::DoNotOptimize(sum);
+    };
+    if(cold)
+        run(st, sz, [&]{ evict(src); }, fn);
+    else
+        run(st, sz, fn);
+}
+
+void bm_file_put_contents(benchmark::State &st, size_t sz)
+{
+    std::string contents(sz, 'c');
+    std::string dst = fixture_name("put", sz);
+    run(st, sz, [&]{
+        file_put_contents(dst.c_str(), contents);
+    });
+    rmfile(dst.c_str());
+}
+
+void bm_file_put_contents_direct(benchmark::State &st, size_t sz)
+{
+    std::string contents(sz, 'c');
+    std::string dst = fixture_name("put_direct", sz);
+    run(st, sz, [&]{
+        file_put_contents_direct(dst.c_str(), contents);
+    });
+    rmfile(dst.c_str());
+}
+
+/** write a header and two payloads of @p sz/2 bytes
+ * @p gather: when false, concatenate them before writing */
+void bm_file_put_contents_slices(benchmark::State &st, size_t sz, bool gather)
+{
+    std::string header(64, 'h');
+    std::string payload0(sz / 2, '0');
+    std::string payload1(sz - sz / 2, '1');
+    std::string dst = fixture_name("put_slices", sz);
+    run(st, header.size() + sz, [&]{
+        if(gather)
+        {
+            csubstr slices[] = {to_csubstr(header), to_csubstr(payload0), to_csubstr(payload1)};
+            file_put_contents(dst.c_str(), slices, 3);
+        }
+        else
+        {
+            std::string joined;
+            joined.reserve(header.size() + sz);
+            joined += header;
+            joined += payload0;
+            joined += payload1;
+            file_put_contents(dst.c_str(), joined);
+        }
+    });
+    rmfile(dst.c_str());
+}
+
+void bm_file_put_contents_atomic(benchmark::State &st, size_t sz, Durability_e durability)
+{
+    std::string contents(sz, 'c');
+    std::string dst = fixture_name("put_atomic", sz);
+    run(st, sz, [&]{
+        file_put_contents_atomic(dst.c_str(), contents, durability);
+    });
+    rmfile(dst.c_str());
+}
+
+/** write many small files, committed together */
+void bm_atomic_write_batch(benchmark::State &st, size_t num_files, size_t file_size, Durability_e durability)
+{
+    std::string contents(file_size, 'b');
+    std::vector<std::string> names(num_files);
+    for(size_t i = 0; i < num_files; ++i)
+        names[i] = fixture_name("batch", i);
+    run(st, num_files * file_size, [&]{
+        AtomicWriteBatch batch(durability);
+        for(std::string const& name : names)
+            batch.put(name.c_str(), contents);
+        batch.commit();
+    });
+    for(std::string const& name : names)
+        rmfile(name.c_str());
+    st.counters["files/s"] = benchmark::Counter(static_cast<double>(num_files), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void bm_file_size(benchmark::State &st, size_t sz)
+{
+    const char *src = fixture_file(sz);
+    run(st, 0, [&]{
+        size_t s = file_size(src);
+        benchmark::DoNotOptimize(s);
+    });
+}
+
+void bm_copy_file(benchmark::State &st, size_t sz, bool cold, int hints=ACCESS_NORMAL)
+{
+    copy_options opts;
+    opts.hints = hints;
+    const char *src = fixture_file(sz);
+    std::string dst = fixture_name("copy", sz);
+    rmfile(dst.c_str());
+    run(st, sz,
+        [&]{
+            rmfile(dst.c_str());
+            if(cold)
+                evict(src);
+        },
+        [&]{
+            copy_file(src, dst.c_str(), opts);
+        });
+    rmfile(dst.c_str());
+}
+
+void bm_scoped_tmp_file(benchmark::State &st, size_t sz)
+{
+    std::string contents(sz, 't');
+    run(st, sz, [&]{
+        ScopedTmpFile f(contents);
+        benchmark::DoNotOptimize(f.file());
+    });
+}
+
+/** @p how: 0 to scan the format with the thread's generator, 1 to
+ * use a precompiled pattern, 2 to draw each byte from a
+ * std::random_device */
+void bm_tmpnam(benchmark::State &st, int how)
+{
+    char buf[sizeof(default_tmppat)];
+    const TmpPattern pat;
+    std::random_device rd;
+    run(st, 0, [&]{
+        switch(how)
+        {
+        case 0: tmpnam(buf, sizeof(buf)); break;
+        case 1: tmpnam(pat, buf, sizeof(buf)); break;
+        default: tmpnam(rd, buf, sizeof(buf)); break;
+        }
+        benchmark::DoNotOptimize(buf);
+    });
+}
+
+int count_entry(VisitedFile const& vf)
+{
+    ++*static_cast<size_t*>(vf.user_data);
+    return 0;
+}
+
+/** @p dirbuf_size: the getdents64 buffer; 0 to use the default */
+void bm_walk_entries(benchmark::State &st, size_t num_entries, size_t dirbuf_size)
+{
+    const char *dir = fixture_dir(num_entries);
+    std::vector<char> namebuf_(4096);
+    std::vector<char> dirbuf_(dirbuf_size);
+    run(st, 0, [&]{
+        maybe_buf<char> namebuf(namebuf_.data(), namebuf_.size());
+        size_t count = 0;
+        if(dirbuf_size)
+        {
+            maybe_buf<char> dirbuf(dirbuf_.data(), dirbuf_.size());
+            walk_entries(dir, count_entry, &namebuf, &count, &dirbuf);
+        }
+        else
+        {
+            walk_entries(dir, count_entry, &namebuf, &count);
+        }
+        C4_CHECK(count == num_entries);
+    });
+    st.counters["entries/s"] = benchmark::Counter(static_cast<double>(num_entries), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+/** sort a listing of a flat directory with many entries. The names
+ * are shuffled in the arena, as they are in a real listing.
+ * @p opts: null to use std::sort with strcmp */
+void bm_entry_list_sort(benchmark::State &st, size_t num_entries, sort_options const* opts)
+{
+    std::vector<std::string> strings(num_entries);
+    std::mt19937 rng(num_entries);
+    for(size_t i = 0; i < num_entries; ++i)
+        strings[i] = "/mnt/blobstore/blob_" + std::to_string(rng());
+    std::vector<char*> shuffled;
+    for(std::string &s : strings)
+        shuffled.push_back(&s[0]);
+    std::vector<char*> names(num_entries);
+    run(st, 0,
+        [&]{
+            names = shuffled;
+        },
+        [&]{
+            if(opts)
+            {
+                EntryList el;
+                el.names = maybe_buf<char*>(names.data(), names.size());
+                el.names.required_size = names.size();
+                el.sort(*opts);
+            }
+            else
+            {
+                std::sort(names.begin(), names.end(), [](const char *a, const char *b){
+                    return strcmp(a, b) < 0;
+                });
+            }
+            benchmark::DoNotOptimize(names.data());
+        });
+    st.counters["entries/s"] = benchmark::Counter(static_cast<double>(num_entries), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void count_async_bytes(AsyncResult const& r)
+{
+    C4_CHECK(r.ok());
+    *static_cast<size_t*>(r.user_data) += static_cast<size_t>(r.result);
+}
+
+/** make a tree of @p num_dirs directories with @p files_per_dir
+ * empty files each */
+void make_rmtree_fixture(const char *root, size_t num_dirs, size_t files_per_dir)
+{
+    C4_CHECK(mkdir(root) == 0);
+    std::string name;
+    for(size_t i = 0; i < num_dirs; ++i)
+    {
+        std::string dir = std::string(root) + "/d" + std::to_string(i);
+        C4_CHECK(mkdir(dir.c_str()) == 0);
+        for(size_t j = 0; j < files_per_dir; ++j)
+        {
+            name = dir + "/f" + std::to_string(j);
+            file_put_contents(name.c_str(), "", 0);
+        }
+    }
+}
+
+/** remove a tree of directories of empty files
+ * @p num_threads: 0 to use rmtree(), otherwise the number of threads of rmtree_parallel() */
+void bm_rmtree(benchmark::State &st, size_t num_dirs, size_t files_per_dir, size_t num_threads)
+{
+    std::string root = fixture_name("rmtree", num_dirs * files_per_dir);
+    rmtree(root.c_str());
+    rmtree_options opts;
+    opts.num_threads = num_threads;
+    run(st, 0,
+        [&]{ make_rmtree_fixture(root.c_str(), num_dirs, files_per_dir); },
+        [&]{
+            int ret = num_threads ? rmtree_parallel(root.c_str(), opts) : rmtree(root.c_str());
+            C4_CHECK(ret == 0);
+        });
+    const double num_entries = static_cast<double>(num_dirs * (files_per_dir + 1) + 1);
+    st.counters["entries/s"] = benchmark::Counter(num_entries, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+/** move a tree of directories of empty files to the trash; the
+ * reclamation is waited for outside of the timing */
+void bm_trash_can(benchmark::State &st, size_t num_dirs, size_t files_per_dir)
+{
+    std::string root = fixture_name("trash", num_dirs * files_per_dir);
+    rmtree(root.c_str());
+    TrashCan trash;
+    run(st, 0,
+        [&]{
+            trash.wait();
+            make_rmtree_fixture(root.c_str(), num_dirs, files_per_dir);
+        },
+        [&]{
+            C4_CHECK(trash.remove(root.c_str()) == 0);
+        });
+    trash.wait();
+    rmdir((bm_dir() + "/" + default_trash_dirname).c_str());
+}
+
+/** copy a tree of directories of empty files; the copy is removed
+ * outside of the timing */
+void bm_copy_tree(benchmark::State &st, size_t num_dirs, size_t files_per_dir, copy_tree_options const& opts)
+{
+    std::string src = fixture_name("copy_tree_src", num_dirs * files_per_dir);
+    std::string dst = fixture_name("copy_tree_dst", num_dirs * files_per_dir);
+    rmtree(src.c_str());
+    rmtree(dst.c_str());
+    make_rmtree_fixture(src.c_str(), num_dirs, files_per_dir);
+    run(st, 0,
+        [&]{
+            if(dir_exists(dst.c_str()))
+                C4_CHECK(rmtree_parallel(dst.c_str()) == 0);
+        },
+        [&]{
+            C4_CHECK(copy_tree(src.c_str(), dst.c_str(), opts) == 0);
+        });
+    rmtree(dst.c_str());
+    rmtree(src.c_str());
+    const double num_entries = static_cast<double>(num_dirs * (files_per_dir + 1) + 1);
+    st.counters["entries/s"] = benchmark::Counter(num_entries, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+/** create num_dirs directories of dirs_per_dir empty directories
+ * below a root whose parent exists; the tree is removed outside of
+ * the timing
+ * @p many: whether to use mkdirs_many(), or mkdirs() on each path */
+void bm_mkdirs(benchmark::State &st, size_t num_dirs, size_t dirs_per_dir, bool many)
+{
+    std::string root = fixture_name("mkdirs", num_dirs * dirs_per_dir);
+    rmtree(root.c_str());
+    std::vector<std::string> names;
+    for(size_t i = 0; i < num_dirs; ++i)
+        for(size_t j = 0; j < dirs_per_dir; ++j)
+            names.push_back(root + "/d" + std::to_string(i) + "/e" + std::to_string(j));
+    std::vector<const char*> paths;
+    for(std::string const& name : names)
+        paths.push_back(name.c_str());
+    std::string buf;
+    run(st, 0,
+        [&]{
+            if(dir_exists(root.c_str()))
+                C4_CHECK(rmtree_parallel(root.c_str()) == 0);
+        },
+        [&]{
+            if(many)
+            {
+                C4_CHECK(mkdirs_many(paths.data(), paths.size()) == 0);
+            }
+            else
+            {
+                for(std::string const& name : names)
+                {
+                    buf = name;
+                    mkdirs(&buf[0]);
+                }
+            }
+        });
+    rmtree(root.c_str());
+    const double num_entries = static_cast<double>(num_dirs * (dirs_per_dir + 1) + 1);
+    st.counters["dirs/s"] = benchmark::Counter(num_entries, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+/** read many small files into a single arena */
+void bm_read_many(benchmark::State &st, size_t num_files, size_t file_size, size_t num_threads)
+{
+    const char *dir = fixture_dir(num_files, file_size);
+    std::vector<std::string> names(num_files);
+    std::vector<const char*> paths(num_files);
+    for(size_t i = 0; i < num_files; ++i)
+    {
+        names[i] = std::string(dir) + "/blob_" + std::to_string(i);
+        paths[i] = names[i].c_str();
+    }
+    std::string arena;
+    std::vector<csubstr> spans(num_files);
+    run(st, num_files * file_size, [&]{
+        size_t total = read_many(paths.data(), num_files, &arena, spans.data(), num_threads);
+        C4_CHECK(total == num_files * file_size);
+    });
+    st.counters["files/s"] = benchmark::Counter(static_cast<double>(num_files), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+/** read many small files.
+ * @p opts: null to read them one by one with file_get_contents() */
+void bm_file_get_contents_many(benchmark::State &st, size_t num_files, size_t file_size, async_options const* opts)
+{
+    const char *dir = fixture_dir(num_files, file_size);
+    std::vector<std::string> names(num_files);
+    for(size_t i = 0; i < num_files; ++i)
+        names[i] = std::string(dir) + "/blob_" + std::to_string(i);
+    std::vector<std::string> contents(num_files);
+    std::unique_ptr<AsyncEngine> engine(opts ? new AsyncEngine(*opts) : nullptr);
+    run(st, num_files * file_size, [&]{
+        size_t total = 0;
+        if(engine)
+        {
+            for(size_t i = 0; i < num_files; ++i)
+                file_get_contents_async(engine.get(), names[i].c_str(), &contents[i], count_async_bytes, &total);
+            engine->drain();
+        }
+        else
+        {
+            for(size_t i = 0; i < num_files; ++i)
+                total += file_get_contents(names[i].c_str(), &contents[i]);
+        }
+        C4_CHECK(total == num_files * file_size);
+    });
+    st.counters["files/s"] = benchmark::Counter(static_cast<double>(num_files), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+
+//-----------------------------------------------------------------------------
+
+void register_benchmarks()
+{
+    using namespace benchmark;
+    for(size_t sz : bm_sizes())
+    {
+        std::string szs = std::to_string(sz);
+        RegisterBenchmark(("file_get_contents/warm/" + szs).c_str(), [sz](State &st){ bm_file_get_contents(st, sz, false); });
+        RegisterBenchmark(("file_get_contents/cold/" + szs).c_str(), [sz](State &st){ bm_file_get_contents(st, sz, true); });
+        RegisterBenchmark(("file_get_contents/cold_sequential/" + szs).c_str(), [sz](State &st){ bm_file_get_contents(st, sz, true, ACCESS_SEQUENTIAL); });
+        RegisterBenchmark(("file_get_contents/cold_drop_behind/" + szs).c_str(), [sz](State &st){ bm_file_get_contents(st, sz, true, ACCESS_SEQUENTIAL|ACCESS_DROP_BEHIND); });
+        RegisterBenchmark(("file_get_contents_direct/warm/" + szs).c_str(), [sz](State &st){ bm_file_get_contents_direct(st, sz, false); });
+        RegisterBenchmark(("file_get_contents_direct/cold/" + szs).c_str(), [sz](State &st){ bm_file_get_contents_direct(st, sz, true); });
+        RegisterBenchmark(("MappedFile/warm/" + szs).c_str(), [sz](State &st){ bm_mapped_file(st, sz, false); });
+        RegisterBenchmark(("MappedFile/cold/" + szs).c_str(), [sz](State &st){ bm_mapped_file(st, sz, true); });
+        RegisterBenchmark(("file_put_contents/" + szs).c_str(), [sz](State &st){ bm_file_put_contents(st, sz); });
+        RegisterBenchmark(("file_put_contents_direct/" + szs).c_str(), [sz](State &st){ bm_file_put_contents_direct(st, sz); });
+        RegisterBenchmark(("file_put_contents_slices/joined/" + szs).c_str(), [sz](State &st){ bm_file_put_contents_slices(st, sz, false); });
+        RegisterBenchmark(("file_put_contents_slices/gather/" + szs).c_str(), [sz](State &st){ bm_file_put_contents_slices(st, sz, true); });
+        RegisterBenchmark(("file_put_contents_atomic/none/" + szs).c_str(), [sz](State &st){ bm_file_put_contents_atomic(st, sz, DURABILITY_NONE); });
+        RegisterBenchmark(("file_put_contents_atomic/file/" + szs).c_str(), [sz](State &st){ bm_file_put_contents_atomic(st, sz, DURABILITY_FILE); });
+        RegisterBenchmark(("file_size/" + szs).c_str(), [sz](State &st){ bm_file_size(st, sz); });
+        RegisterBenchmark(("copy_file/warm/" + szs).c_str(), [sz](State &st){ bm_copy_file(st, sz, false); });
+        RegisterBenchmark(("copy_file/cold/" + szs).c_str(), [sz](State &st){ bm_copy_file(st, sz, true); });
+        RegisterBenchmark(("copy_file/cold_drop_behind/" + szs).c_str(), [sz](State &st){ bm_copy_file(st, sz, true, ACCESS_SEQUENTIAL|ACCESS_DROP_BEHIND); });
+        RegisterBenchmark(("ScopedTmpFile/" + szs).c_str(), [sz](State &st){ bm_scoped_tmp_file(st, sz); });
+    }
+    RegisterBenchmark("tmpnam/format", [](State &st){ bm_tmpnam(st, 0); });
+    RegisterBenchmark("tmpnam/pattern", [](State &st){ bm_tmpnam(st, 1); });
+    RegisterBenchmark("tmpnam/random_device", [](State &st){ bm_tmpnam(st, 2); });
+    for(size_t num_entries : {size_t(1) << 10, size_t(1) << 17})
+    {
+        std::string ns = std::to_string(num_entries);
+        RegisterBenchmark(("walk_entries/default_buffer/" + ns).c_str(), [num_entries](State &st){ bm_walk_entries(st, num_entries, 0); });
+        RegisterBenchmark(("walk_entries/1MiB_buffer/" + ns).c_str(), [num_entries](State &st){ bm_walk_entries(st, num_entries, size_t(1) << 20); });
+    }
+    for(size_t num_entries : {size_t(1) << 10, size_t(1) << 20})
+    {
+        std::string ns = std::to_string(num_entries);
+        RegisterBenchmark(("EntryList_sort/strcmp/" + ns).c_str(), [num_entries](State &st){ bm_entry_list_sort(st, num_entries, nullptr); });
+        RegisterBenchmark(("EntryList_sort/prefix/" + ns).c_str(), [num_entries](State &st){
+            sort_options opts;
+            opts.num_threads = 1;
+            bm_entry_list_sort(st, num_entries, &opts);
+        });
+        RegisterBenchmark(("EntryList_sort/prefix_parallel/" + ns).c_str(), [num_entries](State &st){
+            sort_options opts;
+            bm_entry_list_sort(st, num_entries, &opts);
+        });
+        RegisterBenchmark(("EntryList_sort/natural/" + ns).c_str(), [num_entries](State &st){
+            sort_options opts;
+            opts.natural = true;
+            opts.num_threads = 1;
+            bm_entry_list_sort(st, num_entries, &opts);
+        });
+    }
+    for(size_t num_dirs : {size_t(16), size_t(256)})
+    {
+        std::string ns = std::to_string(num_dirs) + "x256";
+        RegisterBenchmark(("rmtree/nftw/" + ns).c_str(), [num_dirs](State &st){ bm_rmtree(st, num_dirs, 256, 0); });
+        RegisterBenchmark(("rmtree/parallel_1_thread/" + ns).c_str(), [num_dirs](State &st){ bm_rmtree(st, num_dirs, 256, 1); });
+        RegisterBenchmark(("rmtree/parallel_8_threads/" + ns).c_str(), [num_dirs](State &st){ bm_rmtree(st, num_dirs, 256, 8); });
+        RegisterBenchmark(("rmtree/TrashCan/" + ns).c_str(), [num_dirs](State &st){ bm_trash_can(st, num_dirs, 256); });
+        RegisterBenchmark(("copy_tree/1_thread/" + ns).c_str(), [num_dirs](State &st){
+            copy_tree_options opts;
+            opts.num_threads = 1;
+            bm_copy_tree(st, num_dirs, 256, opts);
+        });
+        RegisterBenchmark(("copy_tree/8_threads/" + ns).c_str(), [num_dirs](State &st){
+            copy_tree_options opts;
+            opts.num_threads = 8;
+            bm_copy_tree(st, num_dirs, 256, opts);
+        });
+        RegisterBenchmark(("copy_tree/hardlink/" + ns).c_str(), [num_dirs](State &st){
+            copy_tree_options opts;
+            opts.hardlink = true;
+            opts.num_threads = 8;
+            bm_copy_tree(st, num_dirs, 256, opts);
+        });
+        RegisterBenchmark(("mkdirs/one_by_one/" + ns).c_str(), [num_dirs](State &st){ bm_mkdirs(st, num_dirs, 256, false); });
+        RegisterBenchmark(("mkdirs/many/" + ns).c_str(), [num_dirs](State &st){ bm_mkdirs(st, num_dirs, 256, true); });
+    }
+    for(size_t num_files : {size_t(1) << 8, size_t(1) << 12})
+    {
+        std::string ns = std::to_string(num_files) + "/4096";
+        RegisterBenchmark(("file_get_contents_many/sync/" + ns).c_str(), [num_files](State &st){ bm_file_get_contents_many(st, num_files, 4096, nullptr); });
+        RegisterBenchmark(("file_get_contents_many/io_uring/" + ns).c_str(), [num_files](State &st){
+            async_options opts;
+            bm_file_get_contents_many(st, num_files, 4096, &opts);
+        });
+        RegisterBenchmark(("file_get_contents_many/threads/" + ns).c_str(), [num_files](State &st){
+            async_options opts;
+            opts.use_io_uring = false;
+            bm_file_get_contents_many(st, num_files, 4096, &opts);
+        });
+        RegisterBenchmark(("AtomicWriteBatch/none/" + ns).c_str(), [num_files](State &st){ bm_atomic_write_batch(st, num_files, 4096, DURABILITY_NONE); });
+        RegisterBenchmark(("AtomicWriteBatch/file/" + ns).c_str(), [num_files](State &st){ bm_atomic_write_batch(st, num_files, 4096, DURABILITY_FILE); });
+        RegisterBenchmark(("AtomicWriteBatch/group/" + ns).c_str(), [num_files](State &st){ bm_atomic_write_batch(st, num_files, 4096, DURABILITY_GROUP); });
+        RegisterBenchmark(("read_many/1_thread/" + ns).c_str(), [num_files](State &st){ bm_read_many(st, num_files, 4096, 1); });
+        RegisterBenchmark(("read_many/hw_threads/" + ns).c_str(), [num_files](State &st){ bm_read_many(st, num_files, 4096, 0); });
+    }
+}
+
+C4_SUPPRESS_WARNING_GCC_CLANG_POP
+
+} // namespace bm
+} // namespace fs
+} // namespace c4
+
+
+int main(int argc, char **argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    c4::fs::bm::register_benchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    c4::fs::bm::remove_fixture_files();
+    return 0;
+}
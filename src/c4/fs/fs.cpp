@@ -4,6 +4,8 @@
 #include <c4/substr.hpp>
 #include <c4/charconv.hpp>
 
+#include <stdlib.h>
+
 #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
 #include <unistd.h>
 #include <fcntl.h>
@@ -11,6 +13,24 @@
 #include <sys/stat.h>
 #include <ftw.h>
 #include <dirent.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
+#endif
+#if defined(C4_LINUX)
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
 #endif
 
 #include "c4/c4_push.hpp"
@@ -22,8 +42,24 @@
 #   include <direct.h>
 #   include <fileapi.h>
 #   include <handleapi.h>
-#   include <c4/memory_resource.hpp>
+#   include <memoryapi.h>
+#   include <io.h>
 #endif
+#include <c4/memory_resource.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 
 #ifdef C4FS_DBG
@@ -103,13 +139,13 @@ int _exec_stat(const char *pathname, struct stat *s)
 #endif
 }
 
-PathType_e _path_type(struct stat *C4_RESTRICT s)
+PathType_e _mode_type(unsigned mode)
 {
 #if defined(C4_POSIX) || defined(C4_WIN) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
 #   if defined(C4_WIN)
-#      define _c4is(what) (s->st_mode & _S_IF##what)
+#      define _c4is(what) (mode & _S_IF##what)
 #   else
-#      define _c4is(what) (S_IS##what(s->st_mode))
+#      define _c4is(what) (S_IS##what(mode))
 #   endif
     // https://www.gnu.org/software/libc/manual/html_node/Testing-File-Type.html
     if(_c4is(REG))
@@ -133,10 +169,20 @@ PathType_e _path_type(struct stat *C4_RESTRICT s)
 #endif
 }
 
+PathType_e _path_type(struct stat *C4_RESTRICT s)
+{
+    return _mode_type(static_cast<unsigned>(s->st_mode));
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+/** the mode of the directories created by mkdir() and mkdirs() */
+constexpr const mode_t _mkdir_mode = 0755;
+#endif
+
 int _exec_mkdir(const char *dirname)
 {
 #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-    return ::mkdir(dirname, 0755);
+    return ::mkdir(dirname, _mkdir_mode);
 #elif defined(C4_WIN) || defined(C4_XBOX) || defined(__MINGW32__)
     return ::_mkdir(dirname);
 #else
@@ -145,6 +191,149 @@ int _exec_mkdir(const char *dirname)
 #endif
 }
 
+
+
+//-----------------------------------------------------------------------------
+
+size_t _num_threads(size_t requested)
+{
+    if(requested)
+        return requested;
+    size_t hw = static_cast<size_t>(std::thread::hardware_concurrency());
+    return hw ? hw : 1u;
+}
+
+/** a pool of threads, each with its own task queue. Workers pop
+ * tasks from the back of their own queue, and steal from the front
+ * of the other queues when their own is empty. Tasks can push more
+ * tasks. */
+class _WorkPool
+{
+public:
+
+    using task_type = std::function<void(size_t worker_id)>;
+
+    explicit _WorkPool(size_t num_threads)
+        : m_queues(new _Queue[_num_threads(num_threads)])
+        , m_num_queues(_num_threads(num_threads))
+        , m_queued(0)
+        , m_pending(0)
+        , m_num_idle(0)
+        , m_stop(false)
+        , m_mtx()
+        , m_cv()
+    {
+    }
+
+    size_t num_workers() const { return m_num_queues; }
+
+    /** push a task to the queue of the given worker. Can be called
+     * from within tasks. */
+    void push(size_t worker_id, task_type &&task)
+    {
+        C4_ASSERT(worker_id < m_num_queues);
+        m_pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(m_queues[worker_id].mtx);
+            m_queues[worker_id].tasks.push_back(std::move(task));
+        }
+        m_queued.fetch_add(1);
+        if(m_num_idle.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_cv.notify_one();
+        }
+    }
+
+    /** discard the tasks which did not start yet */
+    void stop() { m_stop.store(true); }
+    bool stopped() const { return m_stop.load(std::memory_order_relaxed); }
+
+    /** run the tasks until none is left. The calling thread is used
+     * as worker 0. */
+    void run()
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(m_num_queues - 1);
+        for(size_t i = 1; i < m_num_queues; ++i)
+            threads.emplace_back(&_WorkPool::_work, this, i);
+        _work(0);
+        for(std::thread &t : threads)
+            t.join();
+    }
+
+private:
+
+    bool _pop(size_t id, task_type *task)
+    {
+        {
+            _Queue &q = m_queues[id];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if(!q.tasks.empty())
+            {
+                *task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                m_queued.fetch_sub(1);
+                return true;
+            }
+        }
+        for(size_t i = 1; i < m_num_queues; ++i)
+        {
+            _Queue &q = m_queues[(id + i) % m_num_queues];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if(!q.tasks.empty())
+            {
+                *task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                m_queued.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void _work(size_t id)
+    {
+        task_type task;
+        while(true)
+        {
+            if(_pop(id, &task))
+            {
+                if(!stopped())
+                    task(id);
+                task = nullptr;
+                if(m_pending.fetch_sub(1) == 1)
+                {
+                    std::lock_guard<std::mutex> lock(m_mtx);
+                    m_cv.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_num_idle.fetch_add(1);
+            m_cv.wait(lock, [this]{ return m_queued.load() > 0 || m_pending.load() == 0; });
+            m_num_idle.fetch_sub(1);
+            if(m_pending.load() == 0)
+                return;
+        }
+    }
+
+    struct _Queue
+    {
+        std::mutex mtx;
+        std::deque<task_type> tasks;
+    };
+
+    std::unique_ptr<_Queue[]> m_queues;
+    size_t m_num_queues;
+    std::atomic<size_t> m_queued;   //!< tasks waiting in the queues
+    std::atomic<size_t> m_pending;  //!< tasks pushed and not yet finished
+    std::atomic<size_t> m_num_idle; //!< workers waiting for tasks
+    std::atomic<bool> m_stop;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+};
+
 } // namespace /*anon*/
 
 
@@ -187,295 +376,4376 @@ bool to_unix_sep(char *pathname, size_t sz)
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 
-bool path_exists(const char *pathname)
+struct StatCache::_Shard
 {
-#if defined(C4_POSIX) || defined(C4_WIN) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
-    struct stat s;
-    return _exec_stat(pathname, &s) == 0;
-#else
-    C4_NOT_IMPLEMENTED();
-    return false;
-#endif
+    struct _Entry
+    {
+        struct stat st;
+        int err;         //!< the errno from stat, or 0
+        uint64_t expiry; //!< in steady clock nanoseconds. 0 if the entry does not expire.
+    };
+    mutable std::mutex mtx;
+    std::unordered_map<std::string, _Entry> entries;
+    /** bumped by every invalidation of the shard, so that a stat which
+     * raced with an invalidation does not store its (stale) result */
+    uint64_t generation = 0;
+};
+
+namespace /*anon*/ {
+uint64_t _steady_ns()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
 }
+} // namespace anon
 
+StatCache::StatCache(uint64_t ttl_ns, size_t num_shards)
+    : m_shards(new _Shard[num_shards ? num_shards : 1u])
+    , m_num_shards(num_shards ? num_shards : 1u)
+    , m_ttl_ns(ttl_ns)
+{
+}
 
-bool file_exists(const char *pathname)
+StatCache::~StatCache()
 {
-#if defined(C4_POSIX) || defined(C4_WIN) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
-    struct stat s;
-    auto ret = _exec_stat(pathname, &s);
-    if(ret != 0)
-        return false;
-    auto type = _path_type(&s);
-    return type == REGFILE || type == SYMLINK;
-#else
-    C4_NOT_IMPLEMENTED();
-    return false;
-#endif
+    delete[] m_shards;
 }
 
+StatCache::_Shard& StatCache::_shard(csubstr pathname) const
+{
+    // FNV-1a, so that the shard does not correlate
+    // with the bucket in the shard's map
+    uint64_t h = UINT64_C(14695981039346656037);
+    for(char c : pathname)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= UINT64_C(1099511628211);
+    }
+    return m_shards[static_cast<size_t>(h % m_num_shards)];
+}
 
-bool dir_exists(const char *pathname)
+int StatCache::stat(const char *pathname, struct stat *s)
 {
-#if defined(C4_POSIX) || defined(C4_WIN) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
-    struct stat s;
-    auto ret = _exec_stat(pathname, &s);
+    csubstr path = to_csubstr(pathname);
+    _Shard &shard = _shard(path);
+    thread_local std::string key; // reuse the allocation
+    key.assign(path.str, path.len);
+    const uint64_t now = m_ttl_ns ? _steady_ns() : 0;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.entries.find(key);
+        if(it != shard.entries.end())
+        {
+            if(it->second.expiry == 0 || now < it->second.expiry)
+            {
+                if(it->second.err)
+                {
+                    errno = it->second.err;
+                    return -1;
+                }
+                *s = it->second.st;
+                return 0;
+            }
+            shard.entries.erase(it); // expired
+        }
+        generation = shard.generation;
+    }
+    // stat outside of the lock
+    _Shard::_Entry entry;
+    int ret = _exec_stat(pathname, &entry.st);
+    entry.err = ret == 0 ? 0 : errno;
+    entry.expiry = m_ttl_ns ? now + m_ttl_ns : 0;
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if(shard.generation == generation)
+            shard.entries[key] = entry;
+    }
     if(ret != 0)
-        return false;
-    auto type = _path_type(&s);
-    return type == DIR;
-#else
-    C4_NOT_IMPLEMENTED();
-    return false;
-#endif
+    {
+        errno = entry.err;
+        return -1;
+    }
+    *s = entry.st;
+    return 0;
 }
 
-
-
-
-PathType_e path_type(const char *pathname)
+void StatCache::invalidate(const char *pathname)
 {
-    struct stat s;
-    C4_CHECK(_exec_stat(pathname, &s) == 0);
-    return _path_type(&s);
+    csubstr path = to_csubstr(pathname);
+    _Shard &shard = _shard(path);
+    std::string key(path.str, path.len);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.entries.erase(key);
+    ++shard.generation;
 }
 
-
-path_times times(const char *pathname)
+void StatCache::invalidate_tree(const char *pathname)
 {
-    path_times t;
-#if defined(C4_POSIX) || defined(C4_WIN) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
-    struct stat s;
-    _exec_stat(pathname, &s);
-    using ttype = decltype(t.creation);
-    t.creation = static_cast<ttype>(s.st_ctime);
-    t.modification = static_cast<ttype>(s.st_mtime);
-    t.access = static_cast<ttype>(s.st_atime);
-#else
-    C4_NOT_IMPLEMENTED();
-#endif
-    return t;
+    csubstr path = to_csubstr(pathname);
+    while(path.len > 1 && path[path.len - 1] == '/')
+        path = path.first(path.len - 1);
+    const bool is_root = path.len == 1 && path[0] == '/';
+    for(size_t i = 0; i < m_num_shards; ++i)
+    {
+        _Shard &shard = m_shards[i];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        ++shard.generation;
+        for(auto it = shard.entries.begin(); it != shard.entries.end(); )
+        {
+            csubstr key(it->first.data(), it->first.size());
+            bool below = key.begins_with(path) &&
+                (key.len == path.len || key[path.len] == '/' || is_root);
+            if(below)
+                it = shard.entries.erase(it);
+            else
+                ++it;
+        }
+    }
 }
 
-uint64_t ctime(const char *pathname)
+void StatCache::clear()
 {
-#if defined(C4_POSIX) || defined(C4_WIN) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
-    struct stat s;
-    _exec_stat(pathname, &s);
-    return static_cast<uint64_t>(s.st_ctime);
-#else
-    C4_NOT_IMPLEMENTED();
-#endif
+    for(size_t i = 0; i < m_num_shards; ++i)
+    {
+        std::lock_guard<std::mutex> lock(m_shards[i].mtx);
+        m_shards[i].entries.clear();
+        ++m_shards[i].generation;
+    }
 }
 
-uint64_t mtime(const char *pathname)
+size_t StatCache::size() const
 {
-#if defined(C4_POSIX) || defined(C4_WIN) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
-    struct stat s;
-    _exec_stat(pathname, &s);
-    return static_cast<uint64_t>(s.st_mtime);
+    size_t sz = 0;
+    for(size_t i = 0; i < m_num_shards; ++i)
+    {
+        std::lock_guard<std::mutex> lock(m_shards[i].mtx);
+        sz += m_shards[i].entries.size();
+    }
+    return sz;
+}
+
+
+//-----------------------------------------------------------------------------
+
+#if defined(C4_LINUX) && defined(STATX_BASIC_STATS)
+#define C4FS_STATX
+#endif
+
+namespace /*anon*/ {
+
+constexpr const uint64_t _ns_per_sec = UINT64_C(1000000000);
+
+#if defined(C4_POSIX) && !defined(C4_MACOS) && !defined(C4_IOS)
+#   define _c4fs_stat_ns(s, which) (static_cast<uint64_t>((s).st_##which##tim.tv_sec) * _ns_per_sec + static_cast<uint64_t>((s).st_##which##tim.tv_nsec))
+#elif defined(C4_MACOS) || defined(C4_IOS)
+#   define _c4fs_stat_ns(s, which) (static_cast<uint64_t>((s).st_##which##timespec.tv_sec) * _ns_per_sec + static_cast<uint64_t>((s).st_##which##timespec.tv_nsec))
 #else
-    C4_NOT_IMPLEMENTED();
+#   define _c4fs_stat_ns(s, which) (static_cast<uint64_t>((s).st_##which##time) * _ns_per_sec)
 #endif
-}
 
-uint64_t atime(const char *pathname)
+void _path_info_from_stat(struct stat *C4_RESTRICT s, path_info *C4_RESTRICT pi)
 {
-#if defined(C4_POSIX) || defined(C4_WIN) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
-    struct stat s;
-    _exec_stat(pathname, &s);
-    return static_cast<uint64_t>(s.st_atime);
-#else
-    C4_NOT_IMPLEMENTED();
+    pi->mask = INFO_TYPE|INFO_SIZE|INFO_INODE|INFO_MTIME|INFO_ATIME|INFO_CTIME;
+    pi->type = _path_type(s);
+    pi->size = static_cast<uint64_t>(s->st_size);
+    pi->inode = static_cast<uint64_t>(s->st_ino);
+    pi->mtime_ns = _c4fs_stat_ns(*s, m);
+    pi->atime_ns = _c4fs_stat_ns(*s, a);
+    pi->ctime_ns = _c4fs_stat_ns(*s, c);
+#if defined(C4_MACOS) || defined(C4_IOS)
+    pi->btime_ns = _c4fs_stat_ns(*s, birth);
+    pi->mask |= INFO_BTIME;
 #endif
 }
 
+#undef _c4fs_stat_ns
 
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-
-int rmdir(const char *dirname)
+#ifdef C4FS_STATX
+unsigned _statx_mask(int mask)
 {
-#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
-    return ::rmdir(dirname);
-#elif defined(C4_WIN) || defined(C4_XBOX)
-    return ::_rmdir(dirname);
-#else
-    C4_NOT_IMPLEMENTED();
-#endif
+    unsigned m = 0;
+    if(mask & INFO_TYPE)  m |= STATX_TYPE;
+    if(mask & INFO_SIZE)  m |= STATX_SIZE;
+    if(mask & INFO_INODE) m |= STATX_INO;
+    if(mask & INFO_MTIME) m |= STATX_MTIME;
+    if(mask & INFO_ATIME) m |= STATX_ATIME;
+    if(mask & INFO_CTIME) m |= STATX_CTIME;
+    if(mask & INFO_BTIME) m |= STATX_BTIME;
+    return m;
 }
 
-int mkdir(const char *dirname)
+uint64_t _statx_ns(struct statx_timestamp const& ts)
 {
-    return _exec_mkdir(dirname);
+    return static_cast<uint64_t>(ts.tv_sec) * _ns_per_sec + static_cast<uint64_t>(ts.tv_nsec);
 }
 
-void mkdirs(char *pathname)
+void _path_info_from_statx(struct statx const& stx, path_info *C4_RESTRICT pi)
 {
-    size_t sz = strlen(pathname);
-    // add 1 to len because we know that the buffer has a null terminator
-    c4::substr buf = {pathname, 1 + sz};
-    c4::substr dir;
-    size_t start_pos = 0;
-    while(buf.next_split('/', &start_pos, &dir))
+    pi->mask = 0;
+    if(stx.stx_mask & STATX_TYPE)  { pi->mask |= INFO_TYPE;  pi->type = _mode_type(stx.stx_mode); }
+    if(stx.stx_mask & STATX_SIZE)  { pi->mask |= INFO_SIZE;  pi->size = stx.stx_size; }
+    if(stx.stx_mask & STATX_INO)   { pi->mask |= INFO_INODE; pi->inode = stx.stx_ino; }
+    if(stx.stx_mask & STATX_MTIME) { pi->mask |= INFO_MTIME; pi->mtime_ns = _statx_ns(stx.stx_mtime); }
+    if(stx.stx_mask & STATX_ATIME) { pi->mask |= INFO_ATIME; pi->atime_ns = _statx_ns(stx.stx_atime); }
+    if(stx.stx_mask & STATX_CTIME) { pi->mask |= INFO_CTIME; pi->ctime_ns = _statx_ns(stx.stx_ctime); }
+    if(stx.stx_mask & STATX_BTIME) { pi->mask |= INFO_BTIME; pi->btime_ns = _statx_ns(stx.stx_btime); }
+    // the path exists, even if the filesystem provided none of the fields
+    if(!pi->mask)
     {
-        if(dir.empty())
-            continue;
-        if(start_pos < sz)
-        {
-            char ctmp = buf.str[start_pos];
-            buf.str[start_pos] = '\0';
-            _exec_mkdir(buf.str);
-            buf.str[start_pos] = ctmp;
-        }
-        else
-        {
-            _exec_mkdir(buf.str);
-        }
+        pi->mask = INFO_TYPE;
+        pi->type = _mode_type(stx.stx_mode);
     }
-    C4_CHECK_MSG(dir_exists(pathname), "dir=%s", pathname);
 }
 
+/** set when statx() is not available in the running kernel (or is
+ * filtered out, eg by a seccomp profile) */
+std::atomic<bool> _statx_unavailable(false);
+#endif
 
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
+} // namespace anon
 
-int rmfile(const char *filename)
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+/** stat the path relative to the directory fd */
+void _info_at(int dfd, const char *name, int mask, path_info *pi)
 {
-#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS) || defined(C4_WIN)
-    return ::unlink(filename);
+#ifdef C4FS_STATX
+    if(!_statx_unavailable.load(std::memory_order_relaxed))
+    {
+        struct statx stx;
+        if(::statx(dfd, name, 0, _statx_mask(mask), &stx) == 0)
+        {
+            _path_info_from_statx(stx, pi);
+            return;
+        }
+        if(errno != ENOSYS && errno != EPERM)
+            return;
+        _statx_unavailable.store(true, std::memory_order_relaxed);
+    }
 #else
-    C4_NOT_IMPLEMENTED();
-    return 1;
+    C4_UNUSED(mask);
 #endif
+    struct stat s;
+    if(::fstatat(dfd, name, &s, 0) == 0)
+        _path_info_from_stat(&s, pi);
 }
-
-#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-int _unlink_cb(const char *fpath, const struct stat *, int , struct FTW *)
-{
-    return ::remove(fpath);
-}
-#elif defined(C4_WIN) || defined(__MINGW32__)
-int _rmtree_visitor(VisitedPath const& p)
-{
-    if((p.find_file_data && p.find_file_data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || is_dir(p.name))
-        return rmdir(p.name);
-    else
-        return rmfile(p.name);
-}
+} // namespace anon
 #endif
 
-int rmtree(const char *path)
+path_info info(const char *pathname, int mask)
 {
+    path_info pi = {};
+    pi.type = INVALID;
 #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-    return nftw(path, _unlink_cb, 64, FTW_DEPTH | FTW_PHYS);
+    _info_at(AT_FDCWD, pathname, mask, &pi);
 #elif defined(C4_WIN) || defined(__MINGW32__)
-    if(!dir_exists(path))
-        return ENOENT;
-    return walk_tree(path, _rmtree_visitor);
+    C4_UNUSED(mask);
+    struct stat s;
+    if(_exec_stat(pathname, &s) == 0)
+        _path_info_from_stat(&s, &pi);
 #else
     C4_NOT_IMPLEMENTED();
-    return 1;
 #endif
+    return pi;
 }
 
+path_info info(const char *pathname, StatCache *cache, int mask)
+{
+    if(!cache)
+        return info(pathname, mask);
+    path_info pi = {};
+    pi.type = INVALID;
+    struct stat s;
+    if(cache->stat(pathname, &s) == 0)
+        _path_info_from_stat(&s, &pi);
+    return pi;
+}
 
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
 
-void copy_file(const char *file, const char *dst)
-{
 #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-    // https://stackoverflow.com/questions/2180079/how-can-i-copy-a-file-on-unix-using-c
-    int fd_from = open(file, O_RDONLY);
-    C4_CHECK(fd_from >= 0);
+namespace /*anon*/ {
+
+/** a path in a stat_many() batch */
+struct _StatItem
+{
+    size_t idx;      //!< the position of the path in the batch
+    size_t dir_len;  //!< the length of the parent dir in the path; 0 to stat the full path
+    size_t name_pos; //!< the position of the name in the path
+};
 
-    int fd_to = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0666);
-    if (fd_to < 0)
-        goto out_error;
+/** the largest number of paths stat-ed by a task. Larger
+ * directories are split among several tasks. */
+constexpr const size_t _stat_many_group_size = 256u;
 
-    ssize_t nread;
+_StatItem _stat_item(const char *path, size_t idx)
+{
+    csubstr p = to_csubstr(path);
+    size_t slash = p.last_of('/');
+    if(slash == csubstr::npos || slash + 1 == p.len) // no parent, or a trailing slash
+        return _StatItem{idx, 0u, 0u};
+    return _StatItem{idx, slash ? slash : 1u, slash + 1u};
+}
+
+void _stat_group(const char *const* paths, _StatItem const* items, size_t num, path_info *results, int mask)
+{
+    const size_t dir_len = items[0].dir_len;
+    int dfd = AT_FDCWD;
+    if(dir_len)
     {
-        C4_SUPPRESS_WARNING_GCC_PUSH
-        #if defined(__GNUC__) && __GNUC__ > 8
-        C4_SUPPRESS_WARNING_GCC("-Wanalyzer-fd-use-without-check") // it's checked above!
+        std::string dir(paths[items[0].idx], dir_len);
+        int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        #ifdef O_PATH
+        flags |= O_PATH; // needs only search permission
         #endif
-        char buf[4096];
-        while (nread = read(fd_from, buf, sizeof buf), nread > 0)
-        C4_SUPPRESS_WARNING_GCC_POP
-        {
-            char *out_ptr = buf;
-            ssize_t nwritten;
-
-            do {
-                nwritten = write(fd_to, out_ptr, static_cast<size_t>(nread));
-                if (nwritten >= 0)
-                {
-                    nread -= nwritten;
-                    out_ptr += nwritten;
-                }
-                else if (errno != EINTR)
-                {
-                    goto out_error;
-                }
-            } while (nread > 0);
-        }
+        do {
+            dfd = ::open(dir.c_str(), flags);
+        } while(dfd < 0 && errno == EINTR);
     }
-
-    if (nread == 0)
+    for(size_t i = 0; i < num; ++i)
     {
-        if (close(fd_to) < 0)
-        {
-            fd_to = -1;
-            goto out_error;
-        }
-        close(fd_from);
-        return; /* Success! */
+        _StatItem const& item = items[i];
+        path_info *pi = &results[item.idx];
+        *pi = path_info{};
+        pi->type = INVALID;
+        if(dir_len && dfd < 0) // let the full path report the failure
+            _info_at(AT_FDCWD, paths[item.idx], mask, pi);
+        else
+            _info_at(dfd, paths[item.idx] + item.name_pos, mask, pi);
     }
+    if(dfd >= 0)
+        ::close(dfd);
+}
 
-  out_error:
-    close(fd_from);
-    if (fd_to >= 0)
-        close(fd_to);
-    C4_ERROR("i/o error");
-    return;
-#elif defined(C4_WIN) || defined(__MINGW32__)
-    C4_CHECK(CopyFile(file, dst, /*failifexists*/true));
-#else
-    C4_NOT_IMPLEMENTED();
+} // namespace anon
 #endif
-}
 
-void move_file(const char *file, const char *dst)
+void stat_many(const char *const* paths, size_t num, path_info *results, int mask, size_t num_threads)
 {
-    C4_CHECK(!file_exists(dst));
 #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-    C4_CHECK(rename(file, dst) != -1);
-#elif defined(C4_WIN) || defined(__MINGW32__)
-    C4_CHECK(rename(file, dst) == 0);
-#else
+    std::vector<_StatItem> items(num);
+    for(size_t i = 0; i < num; ++i)
+        items[i] = _stat_item(paths[i], i);
+    // group the paths by their parent directory
+    std::sort(items.begin(), items.end(), [paths](_StatItem const& lhs, _StatItem const& rhs){
+        if(lhs.dir_len != rhs.dir_len)
+            return lhs.dir_len < rhs.dir_len;
+        int cmp = memcmp(paths[lhs.idx], paths[rhs.idx], lhs.dir_len);
+        return cmp != 0 ? cmp < 0 : lhs.idx < rhs.idx;
+    });
+    auto same_dir = [paths](_StatItem const& lhs, _StatItem const& rhs){
+        return lhs.dir_len == rhs.dir_len && memcmp(paths[lhs.idx], paths[rhs.idx], lhs.dir_len) == 0;
+    };
+    std::vector<std::pair<size_t, size_t>> groups;
+    for(size_t first = 0; first < num; )
+    {
+        size_t last = first + 1;
+        while(last < num && last - first < _stat_many_group_size && same_dir(items[first], items[last]))
+            ++last;
+        groups.emplace_back(first, last);
+        first = last;
+    }
+    num_threads = _num_threads(num_threads);
+    _WorkPool pool(groups.size() < num_threads ? (groups.size() ? groups.size() : 1u) : num_threads);
+    _StatItem const* it = items.data();
+    for(auto const& g : groups)
+    {
+        size_t first = g.first, last = g.second;
+        pool.push(0, [paths, it, first, last, results, mask](size_t){
+            _stat_group(paths, it + first, last - first, results, mask);
+        });
+    }
+    pool.run();
+#else
+    C4_UNUSED(num_threads);
+    for(size_t i = 0; i < num; ++i)
+        results[i] = info(paths[i], mask);
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+
+bool path_exists(const char *pathname)
+{
+    return info(pathname, INFO_TYPE).exists();
+}
+
+bool path_exists(const char *pathname, StatCache *cache)
+{
+    return info(pathname, cache, INFO_TYPE).exists();
+}
+
+
+bool file_exists(const char *pathname)
+{
+    return file_exists(pathname, nullptr);
+}
+
+bool file_exists(const char *pathname, StatCache *cache)
+{
+    path_info pi = info(pathname, cache, INFO_TYPE);
+    return pi.exists() && (pi.type == REGFILE || pi.type == SYMLINK);
+}
+
+
+bool dir_exists(const char *pathname)
+{
+    return dir_exists(pathname, nullptr);
+}
+
+bool dir_exists(const char *pathname, StatCache *cache)
+{
+    path_info pi = info(pathname, cache, INFO_TYPE);
+    return pi.exists() && pi.type == DIR;
+}
+
+
+PathType_e path_type(const char *pathname)
+{
+    return path_type(pathname, nullptr);
+}
+
+PathType_e path_type(const char *pathname, StatCache *cache)
+{
+    path_info pi = info(pathname, cache, INFO_TYPE);
+    C4_CHECK(pi.exists());
+    return pi.type;
+}
+
+
+path_times times(const char *pathname)
+{
+    return times(pathname, nullptr);
+}
+
+path_times times(const char *pathname, StatCache *cache)
+{
+    path_info pi = info(pathname, cache, INFO_CTIME|INFO_MTIME|INFO_ATIME);
+    path_times t;
+    t.creation = pi.ctime_ns / _ns_per_sec;
+    t.modification = pi.mtime_ns / _ns_per_sec;
+    t.access = pi.atime_ns / _ns_per_sec;
+    return t;
+}
+
+uint64_t ctime(const char *pathname)
+{
+    return ctime(pathname, nullptr);
+}
+
+uint64_t ctime(const char *pathname, StatCache *cache)
+{
+    return info(pathname, cache, INFO_CTIME).ctime_ns / _ns_per_sec;
+}
+
+uint64_t mtime(const char *pathname)
+{
+    return mtime(pathname, nullptr);
+}
+
+uint64_t mtime(const char *pathname, StatCache *cache)
+{
+    return info(pathname, cache, INFO_MTIME).mtime_ns / _ns_per_sec;
+}
+
+uint64_t atime(const char *pathname)
+{
+    return atime(pathname, nullptr);
+}
+
+uint64_t atime(const char *pathname, StatCache *cache)
+{
+    return info(pathname, cache, INFO_ATIME).atime_ns / _ns_per_sec;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+int rmdir(const char *dirname)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS) || defined(__MINGW32__)
+    return ::rmdir(dirname);
+#elif defined(C4_WIN) || defined(C4_XBOX)
+    return ::_rmdir(dirname);
+#else
+    C4_NOT_IMPLEMENTED();
+#endif
+}
+
+int mkdir(const char *dirname)
+{
+    return _exec_mkdir(dirname);
+}
+
+namespace /*anon*/ {
+
+/** mkdir a prefix of the path, by temporarily terminating it at @p len */
+int _mkdir_prefix(char *pathname, size_t len)
+{
+    char c = pathname[len];
+    pathname[len] = '\0';
+    int ret = _exec_mkdir(pathname);
+    pathname[len] = c;
+    return ret;
+}
+
+/** create a directory and its missing parents. The prefixes are
+ * tried from the deepest backwards until one is created or found to
+ * exist, and only the components below it are then created. So when
+ * only the last component is missing, this costs a single mkdir.
+ * @return 0 if the directory exists at the end, or -1 with errno set
+ * by the failure */
+int _mkdirs(char *pathname, size_t *num_created)
+{
+    size_t end = strlen(pathname);
+    while(end > 1 && pathname[end - 1] == '/')
+        --end;
+    size_t pos = end;
+    int ret = _mkdir_prefix(pathname, pos);
+    while(ret != 0 && errno == ENOENT)
+    {
+        size_t prev = pos;
+        while(prev > 0 && pathname[prev - 1] != '/')
+            --prev;
+        while(prev > 0 && pathname[prev - 1] == '/')
+            --prev;
+        if(prev == 0)
+            return -1;
+        pos = prev;
+        ret = _mkdir_prefix(pathname, pos);
+    }
+    if(ret != 0 && errno != EEXIST)
+        return -1;
+    *num_created += (ret == 0);
+    while(pos < end)
+    {
+        while(pos < end && pathname[pos] == '/')
+            ++pos;
+        while(pos < end && pathname[pos] != '/')
+            ++pos;
+        ret = _mkdir_prefix(pathname, pos);
+        if(ret == 0)
+            ++*num_created;
+        else if(errno != EEXIST)
+            return -1;
+    }
+    // when the last mkdir failed with EEXIST, the path may be a file
+    if(ret != 0 && !dir_exists(pathname))
+    {
+        errno = ENOTDIR;
+        return -1;
+    }
+    return 0;
+}
+
+} // namespace anon
+
+void mkdirs(char *pathname)
+{
+    size_t num_created = 0;
+    C4_CHECK_MSG(_mkdirs(pathname, &num_created) == 0, "dir=%s", pathname);
+}
+
+
+namespace /*anon*/ {
+
+/** normalize a mkdirs_many() path: drop the empty and "."
+ * components, and the trailing slashes. Returns an empty string for
+ * the current directory. */
+void _mkdirs_norm(const char *path, std::string *norm)
+{
+    csubstr p = to_csubstr(path);
+    norm->clear();
+    if(p.begins_with('/'))
+        norm->append(1, '/');
+    csubstr comp;
+    size_t pos = 0;
+    while(p.next_split('/', &pos, &comp))
+    {
+        if(comp.empty() || comp == ".")
+            continue;
+        if(!norm->empty() && norm->back() != '/')
+            norm->append(1, '/');
+        norm->append(comp.str, comp.len);
+    }
+    if(*norm == "/")
+        norm->clear(); // the root always exists
+}
+
+/** order the paths component by component, so that the descendants
+ * of a directory follow it immediately */
+bool _mkdirs_before(std::string const& lhs, std::string const& rhs)
+{
+    const size_t n = lhs.size() < rhs.size() ? lhs.size() : rhs.size();
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(lhs[i] != rhs[i])
+        {
+            unsigned l = lhs[i] == '/' ? 0u : 1u + static_cast<unsigned char>(lhs[i]);
+            unsigned r = rhs[i] == '/' ? 0u : 1u + static_cast<unsigned char>(rhs[i]);
+            return l < r;
+        }
+    }
+    return lhs.size() < rhs.size();
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+
+/** an open ancestor of the paths being created by mkdirs_many() */
+struct _MkdirsLevel
+{
+    size_t len; //!< the length of the ancestor's path
+    int fd;
+};
+
+int _mkdirs_open_at(int dfd, const char *name)
+{
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    #ifdef O_PATH
+    flags |= O_PATH; // needs only search permission
+    #endif
+    int fd;
+    do {
+        fd = ::openat(dfd, name, flags);
+    } while(fd < 0 && errno == EINTR);
+    return fd;
+}
+
+/** like _mkdir_prefix(), relative to a directory fd */
+int _mkdirat_prefix(int dfd, char *path, size_t pos, size_t len)
+{
+    char c = path[len];
+    path[len] = '\0';
+    int ret = ::mkdirat(dfd, path + pos, _mkdir_mode);
+    path[len] = c;
+    return ret;
+}
+
+int _open_prefix(int dfd, char *path, size_t pos, size_t len)
+{
+    char c = path[len];
+    path[len] = '\0';
+    int fd = _mkdirs_open_at(dfd, path + pos);
+    path[len] = c;
+    return fd;
+}
+
+/** create the directory @p path (which must be normalized), with the
+ * fds of its ancestors which are on the stack
+ * @param open_leaf whether the directory will be needed as the
+ * parent of the next path */
+int _mkdirs_at(std::string *path_, std::vector<_MkdirsLevel> *stack, bool open_leaf, size_t *num_created)
+{
+    char *path = &(*path_)[0];
+    const size_t end = path_->size();
+    size_t leaf = end;
+    while(leaf > 0 && path[leaf - 1] != '/')
+        --leaf;
+    if(leaf == 1u && path[0] == '/')
+        leaf = 0u; // a child of the root is named with its slash
+    size_t pos = stack->empty() ? 0u : stack->back().len + 1u;
+    int dfd = stack->empty() ? AT_FDCWD : stack->back().fd;
+    // probe the parent first: it usually exists, and then it is
+    // opened with a single call
+    if(leaf > pos + 1u)
+    {
+        int fd = _open_prefix(dfd, path, pos, leaf - 1u);
+        if(fd >= 0)
+        {
+            stack->push_back(_MkdirsLevel{leaf - 1u, fd});
+            dfd = fd;
+            pos = leaf;
+        }
+        else if(errno != ENOENT)
+        {
+            return -1;
+        }
+    }
+    // otherwise create the missing ancestors one by one
+    while(pos < leaf)
+    {
+        size_t next = pos + 1u; // the first char may be the root's slash
+        while(path[next] != '/')
+            ++next;
+        if(_mkdirat_prefix(dfd, path, pos, next) == 0)
+            ++*num_created;
+        else if(errno != EEXIST)
+            return -1;
+        int fd = _open_prefix(dfd, path, pos, next);
+        if(fd < 0)
+            return -1;
+        stack->push_back(_MkdirsLevel{next, fd});
+        dfd = fd;
+        pos = next + 1u;
+    }
+    int ret = _mkdirat_prefix(dfd, path, pos, end);
+    if(ret == 0)
+        ++*num_created;
+    else if(errno != EEXIST)
+        return -1;
+    // an existing path is opened to check that it is a directory
+    if(ret != 0 || open_leaf)
+    {
+        int fd = _open_prefix(dfd, path, pos, end);
+        if(fd < 0)
+            return -1;
+        stack->push_back(_MkdirsLevel{end, fd});
+    }
+    return 0;
+}
+
+#endif // POSIX
+
+} // namespace anon
+
+int mkdirs_many(const char *const* paths, size_t num, mkdirs_stats *stats)
+{
+    std::vector<std::string> dirs(num);
+    for(size_t i = 0; i < num; ++i)
+        _mkdirs_norm(paths[i], &dirs[i]);
+    std::sort(dirs.begin(), dirs.end(), _mkdirs_before);
+    dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+    mkdirs_stats st = {};
+    int first_errno = 0;
+    auto fail = [&]{
+        if(!first_errno)
+            first_errno = errno;
+        ++st.errors;
+    };
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    std::vector<_MkdirsLevel> stack;
+    const std::string *prev = nullptr;
+    for(size_t i = 0; i < dirs.size(); ++i)
+    {
+        std::string &dir = dirs[i];
+        if(dir.empty())
+            continue;
+        // drop the levels which are not ancestors of this path. All of
+        // them are ancestors of the previous path.
+        while(!stack.empty())
+        {
+            size_t len = stack.back().len;
+            if(len < dir.size() && dir[len] == '/' && memcmp(prev->data(), dir.data(), len) == 0)
+                break;
+            ::close(stack.back().fd);
+            stack.pop_back();
+        }
+        bool open_leaf = i + 1 < dirs.size()
+            && dirs[i + 1].size() > dir.size()
+            && dirs[i + 1][dir.size()] == '/'
+            && memcmp(dirs[i + 1].data(), dir.data(), dir.size()) == 0;
+        if(_mkdirs_at(&dir, &stack, open_leaf, &st.created) != 0)
+            fail();
+        prev = &dir;
+    }
+    for(_MkdirsLevel const& level : stack)
+        ::close(level.fd);
+#else
+    for(std::string &dir : dirs)
+        if(!dir.empty() && _mkdirs(&dir[0], &st.created) != 0)
+            fail();
+#endif
+    if(stats)
+        *stats = st;
+    if(first_errno)
+    {
+        errno = first_errno;
+        return -1;
+    }
+    return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+int rmfile(const char *filename)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS) || defined(C4_WIN)
+    return ::unlink(filename);
+#else
+    C4_NOT_IMPLEMENTED();
+    return 1;
+#endif
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+int _unlink_cb(const char *fpath, const struct stat *, int , struct FTW *)
+{
+    return ::remove(fpath);
+}
+#elif defined(C4_WIN) || defined(__MINGW32__)
+int _rmtree_visitor(VisitedPath const& p)
+{
+    if((p.find_file_data && p.find_file_data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || is_dir(p.name))
+        return rmdir(p.name);
+    else
+        return rmfile(p.name);
+}
+#endif
+
+int rmtree(const char *path)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    return nftw(path, _unlink_cb, 64, FTW_DEPTH | FTW_PHYS);
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    if(!dir_exists(path))
+        return ENOENT;
+    return walk_tree(path, _rmtree_visitor);
+#else
+    C4_NOT_IMPLEMENTED();
+    return 1;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+/** give the AccessHint_e hints about the whole file to the kernel */
+void _advise_fd(int fd, int hints)
+{
+#if defined(C4_LINUX)
+    if(hints & ACCESS_SEQUENTIAL)
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if(hints & ACCESS_RANDOM)
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    if(hints & ACCESS_WILLNEED)
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    if(hints & ACCESS_NOREUSE)
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+#else
+    C4_UNUSED(fd);
+    C4_UNUSED(hints);
+#endif
+}
+
+/** the granularity of ACCESS_DROP_BEHIND */
+constexpr const size_t _drop_behind_window = size_t(8) << 20;
+#if defined(C4_LINUX)
+constexpr const bool _can_drop_behind = true;
+#else
+constexpr const bool _can_drop_behind = false; // no sync_file_range()
+#endif
+
+/** drops the pages of a file from the page cache as they are
+ * processed (ACCESS_DROP_BEHIND), a window at a time. Dirty pages
+ * cannot be dropped, so when writing, the writeback of each window is
+ * started as soon as it is complete, and waited for (and the window
+ * dropped) once the next one is complete. */
+struct _DropBehind
+{
+    int    fd;
+    bool   enabled;
+    bool   writing;
+    size_t pos;     ///< the offset of the next byte to be processed
+    size_t started; ///< writing: the writeback was started up to this offset
+    size_t dropped; ///< the pages before this offset were dropped
+
+    _DropBehind(int fd_, int hints, bool writing_, size_t offset=0)
+        : fd(fd_)
+        , enabled(_can_drop_behind && (hints & ACCESS_DROP_BEHIND) != 0)
+        , writing(writing_)
+        , pos(offset)
+        , started(offset)
+        , dropped(offset)
+    {
+    }
+
+    /** the size of the next chunk to transfer, so that the window
+     * can be dropped in time */
+    size_t chunk(size_t sz) const
+    {
+        return enabled && sz > _drop_behind_window ? _drop_behind_window : sz;
+    }
+
+    /** @p n more bytes were processed */
+    void advance(size_t n)
+    {
+        pos += n;
+        if(enabled && pos - started >= _drop_behind_window)
+            _drop(false);
+    }
+
+    /** drop everything which was processed */
+    void finish()
+    {
+        if(enabled)
+            _drop(true);
+    }
+
+    void _drop(bool all)
+    {
+    #if defined(C4_LINUX)
+        if(writing)
+        {
+            // wait for the writeback started at the previous window
+            // (or for everything, when finishing)
+            const size_t end = all ? pos : started;
+            if(end > dropped)
+            {
+                ::sync_file_range(fd, static_cast<off_t>(dropped), static_cast<off_t>(end - dropped),
+                                  SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER);
+                ::posix_fadvise(fd, static_cast<off_t>(dropped), static_cast<off_t>(end - dropped), POSIX_FADV_DONTNEED);
+                dropped = end;
+            }
+            if(!all)
+                ::sync_file_range(fd, static_cast<off_t>(started), static_cast<off_t>(pos - started), SYNC_FILE_RANGE_WRITE);
+        }
+        else if(pos > dropped)
+        {
+            ::posix_fadvise(fd, static_cast<off_t>(dropped), static_cast<off_t>(pos - dropped), POSIX_FADV_DONTNEED);
+            dropped = pos;
+        }
+        started = pos;
+    #else
+        C4_UNUSED(all);
+    #endif
+    }
+};
+
+/** write all the bytes, retrying on short writes and EINTR */
+bool _write_all(int fd, const char *buf, size_t sz)
+{
+    while(sz > 0)
+    {
+        ::ssize_t nwritten = ::write(fd, buf, sz);
+        if(nwritten >= 0)
+        {
+            sz -= static_cast<size_t>(nwritten);
+            buf += nwritten;
+        }
+        else if(errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** copy through a userspace buffer, from the current offsets until
+ * the end of the source */
+bool _copy_userspace(int fd_from, int fd_to, size_t size_hint, size_t bufsz, size_t *copied, _DropBehind *db_from, _DropBehind *db_to)
+{
+    // no need for a buffer larger than the file
+    if(size_hint > *copied && size_hint - *copied < bufsz)
+        bufsz = size_hint - *copied;
+    char stackbuf[4096];
+    char *buf = stackbuf;
+    if(bufsz <= sizeof(stackbuf))
+        bufsz = sizeof(stackbuf);
+    else
+        buf = (char*) c4::aalloc(bufsz, alignof(std::max_align_t));
+    bool ok = true;
+    while(true)
+    {
+        ::ssize_t nread = ::read(fd_from, buf, bufsz);
+        if(nread == 0)
+            break;
+        if(nread < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            ok = false;
+            break;
+        }
+        if(!_write_all(fd_to, buf, static_cast<size_t>(nread)))
+        {
+            ok = false;
+            break;
+        }
+        *copied += static_cast<size_t>(nread);
+        db_from->advance(static_cast<size_t>(nread));
+        db_to->advance(static_cast<size_t>(nread));
+    }
+    if(buf != stackbuf)
+        c4::afree(buf);
+    return ok;
+}
+
+#if defined(C4_LINUX)
+using _kernel_copy_fn = ::ssize_t (*)(int fd_from, int fd_to, size_t len);
+
+::ssize_t _copy_file_range_chunk(int fd_from, int fd_to, size_t len)
+{
+#ifdef __NR_copy_file_range
+    return static_cast<::ssize_t>(::syscall(__NR_copy_file_range, fd_from, nullptr, fd_to, nullptr, len, 0u));
+#else
+    C4_UNUSED(fd_from);
+    C4_UNUSED(fd_to);
+    C4_UNUSED(len);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+::ssize_t _sendfile_chunk(int fd_from, int fd_to, size_t len)
+{
+    return ::sendfile(fd_to, fd_from, nullptr, len);
+}
+
+/** copy in the kernel, from the current offsets.
+ * @return true if the copy is finished, false if it should be
+ * continued with another strategy */
+bool _copy_in_kernel(_kernel_copy_fn fn, int fd_from, int fd_to, size_t size, size_t *copied, _DropBehind *db_from, _DropBehind *db_to)
+{
+    constexpr const size_t max_chunk = size_t(1) << 30;
+    while(*copied < size)
+    {
+        size_t len = db_from->chunk(size - *copied);
+        ::ssize_t n = fn(fd_from, fd_to, len < max_chunk ? len : max_chunk);
+        if(n > 0)
+        {
+            *copied += static_cast<size_t>(n);
+            db_from->advance(static_cast<size_t>(n));
+            db_to->advance(static_cast<size_t>(n));
+        }
+        else if(n == 0) // the file was truncated meanwhile
+            return true;
+        else if(errno != EINTR) // eg ENOSYS, EXDEV, EINVAL, EOPNOTSUPP
+            return false;
+    }
+    return true;
+}
+#endif // C4_LINUX
+
+bool _copy_fd(int fd_from, int fd_to, size_t size, copy_options const& opts, copy_result *result)
+{
+    _DropBehind db_from(fd_from, opts.hints, /*writing*/false);
+    _DropBehind db_to(fd_to, opts.hints, /*writing*/true);
+#if defined(C4_LINUX)
+    // files in eg /proc report a size of 0, so they can only be
+    // copied by reading until EOF
+    if(size > 0)
+    {
+        if(opts.try_reflink && ::ioctl(fd_to, FICLONE, fd_from) == 0)
+        {
+            result->strategy = COPY_REFLINK;
+            result->size = size;
+            return true;
+        }
+        if(opts.try_copy_file_range && _copy_in_kernel(&_copy_file_range_chunk, fd_from, fd_to, size, &result->size, &db_from, &db_to))
+            result->strategy = COPY_FILE_RANGE;
+        else if(opts.try_sendfile && _copy_in_kernel(&_sendfile_chunk, fd_from, fd_to, size, &result->size, &db_from, &db_to))
+            result->strategy = COPY_SENDFILE;
+    }
+#endif
+    bool ok = true;
+    if(result->strategy == COPY_NONE)
+    {
+        result->strategy = COPY_USERSPACE;
+        ok = _copy_userspace(fd_from, fd_to, size, opts.buffer_size, &result->size, &db_from, &db_to);
+    }
+    db_from.finish();
+    db_to.finish();
+    return ok;
+}
+
+} // namespace /*anon*/
+#endif
+
+
+copy_result copy_file(const char *file, const char *dst, copy_options const& opts)
+{
+    copy_result result = {COPY_NONE, 0};
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int fd_from = ::open(file, O_RDONLY);
+    C4_CHECK_MSG(fd_from >= 0, "could not open file %s", file);
+    struct stat s;
+    if(::fstat(fd_from, &s) != 0)
+    {
+        ::close(fd_from);
+        C4_ERROR("could not stat file %s", file);
+    }
+    _advise_fd(fd_from, opts.hints);
+    int fd_to = ::open(dst, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if(fd_to < 0)
+    {
+        ::close(fd_from);
+        C4_ERROR("could not open file %s", dst);
+    }
+    bool ok = _copy_fd(fd_from, fd_to, static_cast<size_t>(s.st_size), opts, &result);
+    if(::close(fd_to) < 0)
+        ok = false;
+    ::close(fd_from);
+    C4_CHECK_MSG(ok, "i/o error copying %s to %s", file, dst);
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    C4_UNUSED(opts);
+    C4_CHECK(CopyFile(file, dst, /*failifexists*/true));
+    result.strategy = COPY_NATIVE;
+    result.size = file_size(dst);
+#else
+    C4_NOT_IMPLEMENTED();
+#endif
+    return result;
+}
+
+void move_file(const char *file, const char *dst)
+{
+    C4_CHECK(!file_exists(dst));
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    C4_CHECK(rename(file, dst) != -1);
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    C4_CHECK(rename(file, dst) == 0);
+#else
+    C4_NOT_IMPLEMENTED();
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+char *cwd(char *buf, size_t sz)
+{
+    C4_ASSERT(sz > 0);
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    return ::getcwd(buf, sz);
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    return ::getcwd(buf, (int)sz);
+#else
+    C4_NOT_IMPLEMENTED();
+    return nullptr;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+namespace /*anon*/ {
+/** the buffer used by walk_entries() when none is given */
+constexpr const size_t _default_dirbuf_size = size_t(32) * 1024;
+/** getdents64() fails if the buffer cannot hold the next record */
+constexpr const size_t _min_dirbuf_size = size_t(1024);
+
+} // namespace anon
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+PathType_e _dirent_type(unsigned char d_type)
+{
+    switch(d_type)
+    {
+    case DT_REG: return REGFILE;
+    case DT_DIR: return DIR;
+    case DT_LNK: return SYMLINK;
+    case DT_FIFO: return PIPE;
+    case DT_SOCK: return SOCK;
+    case DT_UNKNOWN: return INVALID; // needs stat
+    default: return OTHER;
+    }
+}
+
+#if defined(C4_LINUX) && defined(SYS_getdents64)
+#define C4FS_GETDENTS64
+/** glibc's struct dirent has the same layout as the records written
+ * by getdents64() when its d_ino and d_off are 64 bit wide. Only then
+ * can the records be handed out as VisitedFile::dirent_data. */
+constexpr const bool _getdents64_is_dirent = sizeof(dirent::d_ino) == 8
+    && sizeof(dirent::d_off) == 8
+    && offsetof(struct dirent, d_reclen) == 16
+    && offsetof(struct dirent, d_type) == 18
+    && offsetof(struct dirent, d_name) == 19;
+#endif
+
+struct _DirEntry
+{
+    const char    *name;
+    size_t         len;
+    uint64_t       ino;
+    unsigned char  d_type;
+    struct dirent *dirent_data;
+};
+
+/** reads the entries of a directory, skipping . and .. ; on linux,
+ * the entries are read in batches with getdents64() into the given
+ * buffer. Otherwise, readdir() is used, and the buffer is ignored. */
+class _DirReader
+{
+public:
+
+    /** takes ownership of the directory file descriptor */
+    _DirReader(int dfd, substr buf) : m_fd(dfd), m_dir(nullptr), m_buf(), m_pos(0), m_end(0), m_errno(0)
+    {
+        #ifdef C4FS_GETDENTS64
+        // the records have 64 bit members
+        size_t skip = (8u - (reinterpret_cast<uintptr_t>(buf.str) & 7u)) & 7u;
+        if(_getdents64_is_dirent && buf.len >= skip + _min_dirbuf_size)
+        {
+            m_buf = buf.sub(skip);
+            return;
+        }
+        #else
+        C4_UNUSED(buf);
+        #endif
+        m_dir = ::fdopendir(dfd);
+        if(!m_dir)
+        {
+            m_errno = errno ? errno : EBADF;
+            ::close(dfd);
+        }
+        m_fd = -1;
+    }
+
+    ~_DirReader()
+    {
+        if(m_dir)
+            ::closedir(m_dir);
+        else if(m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    _DirReader(_DirReader const&) = delete;
+    _DirReader& operator= (_DirReader const&) = delete;
+
+    /** false if the directory could not be read to the end */
+    bool ok() const { return m_errno == 0; }
+    /** the errno of the failure, or 0 */
+    int error() const { return m_errno; }
+
+    /** @return false when there are no more entries, or on error */
+    bool next(_DirEntry *e)
+    {
+        #ifdef C4FS_GETDENTS64
+        if(m_fd >= 0)
+            return _next_getdents(e);
+        #endif
+        if(!m_dir)
+            return false;
+        struct dirent *entry;
+        errno = 0;
+        while((entry = ::readdir(m_dir)) != nullptr)
+        {
+            const char *n = entry->d_name;
+            if(n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0')))
+                continue;
+            e->name = n;
+            e->len = strlen(n);
+            e->ino = static_cast<uint64_t>(entry->d_ino);
+            e->d_type = entry->d_type;
+            e->dirent_data = entry;
+            return true;
+        }
+        m_errno = errno; // readdir() returns null with errno unchanged at the end
+        return false;
+    }
+
+private:
+
+    #ifdef C4FS_GETDENTS64
+    bool _next_getdents(_DirEntry *e)
+    {
+        constexpr const size_t name_pos = 19; // offsetof(linux_dirent64, d_name)
+        while(true)
+        {
+            if(m_pos >= m_end)
+            {
+                long ret;
+                do {
+                    ret = ::syscall(SYS_getdents64, m_fd, m_buf.str, m_buf.len);
+                } while(ret < 0 && errno == EINTR);
+                if(ret <= 0)
+                {
+                    if(ret < 0)
+                        m_errno = errno;
+                    return false;
+                }
+                m_pos = 0;
+                m_end = static_cast<size_t>(ret);
+            }
+            char *rec = m_buf.str + m_pos;
+            unsigned short reclen;
+            memcpy(&reclen, rec + 16, sizeof(reclen));
+            m_pos += reclen;
+            // the records are padded to 8 bytes, so the name's
+            // terminating null is in the record's last 8 bytes.
+            // The padding after the null is not zeroed.
+            size_t start = reclen > name_pos + 8u ? reclen - 8u : name_pos;
+            const char *nul = static_cast<const char*>(memchr(rec + start, '\0', reclen - start));
+            C4_ASSERT(nul != nullptr);
+            const char *n = rec + name_pos;
+            size_t len = static_cast<size_t>(nul - n);
+            if(len <= 2 && n[0] == '.' && (len == 1 || n[1] == '.'))
+                continue;
+            e->name = n;
+            e->len = len;
+            memcpy(&e->ino, rec, sizeof(e->ino));
+            e->d_type = static_cast<unsigned char>(rec[18]);
+            e->dirent_data = reinterpret_cast<struct dirent*>(rec);
+            return true;
+        }
+    }
+    #endif
+
+    int    m_fd;
+    ::DIR *m_dir;
+    substr m_buf;
+    size_t m_pos;
+    size_t m_end;
+    int    m_errno;
+};
+
+} // namespace anon
+#endif // POSIX
+
+namespace /*anon*/ {
+bool _walk_entries(const char *pathname, FileVisitor fn, maybe_buf<char> *buf, void *user_data, substr dirbuf)
+{
+    C4_CHECK((buf->buf == nullptr) == (buf->size == 0));
+    csubstr base = to_csubstr(pathname);
+    size_t base_size = (base.len + 1/* / */) + 1/* \0 */;
+    substr namebuf(buf->buf, buf->size);
+    size_t maxlen = 0;
+    C4_ASSERT(!namebuf.overlaps(base));
+    buf->required_size = base_size;
+    _c4fs_dbgf("base=~~~{}~~~ reqsz={}", base, buf->required_size);
+    VisitedFile vp = {};
+    vp.user_data = user_data;
+    vp.name = namebuf.str;
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int dfd;
+    do {
+        dfd = ::open(pathname, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    } while(dfd < 0 && errno == EINTR);
+    C4_CHECK_MSG(dfd >= 0, "could not open directory %s", pathname);
+    // copy the base path only once; the entries are written after the slash
+    if(buf->valid())
+    {
+        memcpy(namebuf.str, base.str, base.len);
+        namebuf[base.len] = '/';
+    }
+    substr after_slash = buf->valid() ? namebuf.sub(base.len + 1) : substr{};
+    int read_errno = 0;
+    {
+        _DirReader reader(dfd, dirbuf);
+        _DirEntry entry;
+        while(reader.next(&entry))
+        {
+            if(entry.len > maxlen)
+            {
+                maxlen = entry.len;
+                buf->required_size = base_size + maxlen + 1;
+            }
+            _c4fs_dbgf("base=[{}]~~~{}~~~ entry=[{}]~~~{}~~~ valid={} maxlen={}",
+                       base.len, base, entry.len, csubstr(entry.name, entry.len), buf->valid(), maxlen);
+            if(buf->valid())
+            {
+                memcpy(after_slash.str, entry.name, entry.len + 1); // with the terminating null
+                vp.name_len = base.len + 1 + entry.len;
+                vp.entry_name = csubstr(after_slash.str, entry.len);
+                vp.inode = entry.ino;
+                vp.type = _dirent_type(entry.d_type);
+                vp.dirent_data = entry.dirent_data;
+                if(fn(vp) != 0)
+                    break;
+            }
+        }
+        read_errno = reader.error();
+    }
+    if(read_errno)
+    {
+        errno = read_errno;
+        return false;
+    }
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    C4_UNUSED(dirbuf);
+    C4_CHECK(is_dir(pathname));
+    base_size = base.len + 4;
+    buf->required_size = base_size;
+    if(!buf->valid())
+    {
+        // if the buffer cannot accomodate the base_size,
+        // we cannot open the directory to iterate.
+        // To be safer, let's require 64 characters for appending
+        // the filenames.
+        buf->required_size += 64u;
+        return false;
+    }
+    memcpy(namebuf.str, base.str, base.len);
+    memcpy(namebuf.str + base.len, "\\*\0", 3);
+    WIN32_FIND_DATAA ffd = {};
+    HANDLE hFindFile = FindFirstFileA(namebuf.str, &ffd);
+    C4_CHECK(hFindFile != INVALID_HANDLE_VALUE);
+    namebuf[base.len] = '/';
+    vp.find_file_data = &ffd;
+    while(FindNextFileA(hFindFile, &ffd))
+    {
+        if(!strcmp(ffd.cFileName, "."))
+            continue;
+        if(!strcmp(ffd.cFileName, ".."))
+            continue;
+        csubstr entry_name = to_csubstr((const char*)ffd.cFileName);
+        maxlen = entry_name.len > maxlen ? entry_name.len : maxlen;
+        buf->required_size = base_size + maxlen + 1;
+        if(buf->valid())
+        {
+            substr after_slash = namebuf.sub(base.len + 1);
+            memcpy(after_slash.str, entry_name.str, entry_name.len);
+            after_slash[entry_name.len] = '\0';
+            vp.name_len = base.len + 1 + entry_name.len;
+            vp.entry_name = after_slash.first(entry_name.len);
+            vp.type = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? DIR : REGFILE;
+            if(fn(vp) != 0)
+                break;
+        }
+    }
+    FindClose(hFindFile);
+#else
+#error unknown platform
+#endif
+    return buf->valid();
+}
+} // namespace anon
+
+bool walk_entries(const char *pathname, FileVisitor fn, maybe_buf<char> *namebuf, void *user_data)
+{
+#ifdef C4FS_GETDENTS64
+    alignas(8) char dirbuf[_default_dirbuf_size];
+    return _walk_entries(pathname, fn, namebuf, user_data, dirbuf);
+#else
+    return _walk_entries(pathname, fn, namebuf, user_data, substr{});
+#endif
+}
+
+bool walk_entries(const char *pathname, FileVisitor fn, maybe_buf<char> *namebuf, void *user_data, maybe_buf<char> *dirbuf)
+{
+    C4_CHECK((dirbuf->buf == nullptr) == (dirbuf->size == 0));
+    dirbuf->required_size = 0;
+    if(dirbuf->size < _min_dirbuf_size)
+    {
+        if(dirbuf->size)
+            dirbuf->required_size = _min_dirbuf_size;
+        return walk_entries(pathname, fn, namebuf, user_data);
+    }
+    return _walk_entries(pathname, fn, namebuf, user_data, substr(dirbuf->buf, dirbuf->size));
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+bool _is_dot_or_dotdot(const char *n)
+{
+    return n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0'));
+}
+
+/** get the type of an entry, stat-ing it if required or requested.
+ * @return the ftw_info for the entry */
+int _entry_info(int dfd, const char *name, unsigned char d_type, bool do_stat, struct stat *st, PathType_e *type)
+{
+    *type = _dirent_type(d_type);
+    if(do_stat || *type == INVALID)
+    {
+        if(::fstatat(dfd, name, st, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            *type = INVALID;
+            return FTW_NS;
+        }
+        *type = _path_type(st);
+    }
+    return *type == DIR ? FTW_D : (*type == SYMLINK ? FTW_SL : FTW_F);
+}
+
+int _open_dir_at(int dfd, const char *name)
+{
+    int fd;
+    do {
+        fd = ::openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    } while(fd < 0 && errno == EINTR);
+    return fd;
+}
+
+/** the state of a walk_tree() call */
+struct _TreeWalk
+{
+    PathVisitor fn;
+    void *user_data;
+    bool do_stat;
+    size_t max_fds;
+    size_t num_open;
+    std::string path; //!< the path of the current entry
+
+    int visit(struct stat const* st, int ftw_info, int level, size_t base, PathType_e type)
+    {
+        struct FTW ftw;
+        ftw.base = static_cast<int>(base);
+        ftw.level = level;
+        VisitedPath vp;
+        vp.name = path.c_str();
+        vp.user_data = user_data;
+        vp.stat_data = do_stat && ftw_info != FTW_NS ? st : nullptr;
+        vp.ftw_info = ftw_info;
+        vp.ftw_data = &ftw;
+        vp.type = type;
+        return fn(vp);
+    }
+
+    /** walk the contents of the directory in path, which is open in
+     * dfd. Takes ownership of dfd. */
+    int walk_dir(int dfd, int level)
+    {
+        ::DIR *dir = ::fdopendir(dfd);
+        if(!dir)
+        {
+            ::close(dfd);
+            return 0;
+        }
+        ++num_open;
+        const size_t dirlen = path.size();
+        const size_t base = path.back() == '/' ? dirlen : dirlen + 1; // eg for "/"
+        struct _Entry
+        {
+            std::string name;
+            unsigned char d_type;
+        };
+        std::vector<_Entry> remaining; // used only when exceeding the fd budget
+        size_t remaining_pos = 0;
+        int status = 0;
+        int read_err = 0;
+        while(true)
+        {
+            const char *name;
+            unsigned char d_type;
+            if(dir)
+            {
+                errno = 0;
+                struct dirent *entry = ::readdir(dir);
+                if(!entry)
+                {
+                    read_err = errno; // unchanged at the end of the directory
+                    break;
+                }
+                name = entry->d_name;
+                d_type = entry->d_type;
+                if(_is_dot_or_dotdot(name))
+                    continue;
+            }
+            else
+            {
+                if(remaining_pos >= remaining.size())
+                    break;
+                name = remaining[remaining_pos].name.c_str();
+                d_type = remaining[remaining_pos].d_type;
+                ++remaining_pos;
+            }
+            path.resize(dirlen);
+            if(base > dirlen)
+                path += '/';
+            path += name;
+            // once the directory is closed, the entries are accessed
+            // through their full path
+            const int rel_fd = dir ? ::dirfd(dir) : AT_FDCWD;
+            const char *rel_name = dir ? name : path.c_str();
+            struct stat st;
+            PathType_e type;
+            int info = _entry_info(rel_fd, rel_name, d_type, do_stat, &st, &type);
+            int child_fd = -1;
+            if(type == DIR)
+            {
+                if(dir && num_open >= max_fds)
+                {
+                    // read the remaining entries and close the directory
+                    // to get back under the budget
+                    struct dirent *entry;
+                    while(errno = 0, (entry = ::readdir(dir)) != nullptr)
+                        if(!_is_dot_or_dotdot(entry->d_name))
+                            remaining.push_back(_Entry{entry->d_name, entry->d_type});
+                    read_err = errno;
+                    ::closedir(dir);
+                    dir = nullptr;
+                    --num_open;
+                    if(read_err)
+                        break;
+                    rel_name = path.c_str();
+                    child_fd = _open_dir_at(AT_FDCWD, rel_name);
+                }
+                else
+                {
+                    child_fd = _open_dir_at(rel_fd, rel_name);
+                }
+                if(child_fd < 0)
+                    info = FTW_DNR;
+            }
+            int ret = visit(&st, info, level + 1, base, type);
+            if(ret == WALK_SKIP_SUBTREE)
+                ret = 0;
+            else if(ret == 0 && child_fd >= 0)
+            {
+                ret = walk_dir(child_fd, level + 1);
+                child_fd = -1;
+            }
+            if(child_fd >= 0)
+                ::close(child_fd);
+            if(ret != 0)
+            {
+                status = ret;
+                break;
+            }
+        }
+        const int err = read_err ? read_err : errno; // keep the errno of a nested -1
+        if(dir)
+        {
+            ::closedir(dir);
+            --num_open;
+        }
+        path.resize(dirlen);
+        errno = err;
+        return read_err ? -1 : status;
+    }
+};
+
+} // namespace /*anon*/
+#elif defined(C4_WIN) || defined(__MINGW32__)
+int _walk_tree(PathVisitor fn, void *user_data, substr namebuf, size_t namelen)
+{
+    int exit_status = 0;
+    VisitedPath vp;
+    vp.user_data = user_data;
+    vp.name = namebuf.str;
+    if(namebuf.len < namelen + 4)
+        return ENAMETOOLONG;
+    WIN32_FIND_DATAA ffd = {};
+    memcpy(namebuf.str + namelen, "\\*\0", 3);
+    HANDLE hFindFile = FindFirstFileA(namebuf.str, &ffd);
+    C4_CHECK(hFindFile != INVALID_HANDLE_VALUE);
+    namebuf[namelen] = '/';
+    substr filenamebuf = namebuf.sub(namelen + 1);
+    vp.find_file_data = &ffd;
+    while(FindNextFileA(hFindFile, &ffd))
+    {
+        if(!strcmp(ffd.cFileName, "."))
+            continue;
+        if(!strcmp(ffd.cFileName, ".."))
+            continue;
+        csubstr entry_name = to_csubstr((const char*)ffd.cFileName);
+        if(filenamebuf.len < entry_name.len + 2)
+        {
+            exit_status = ENAMETOOLONG;
+            break;
+        }
+        memcpy(filenamebuf.str, entry_name.str, entry_name.len);
+        filenamebuf[entry_name.len] = '\0';
+        if(ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            int ret = _walk_tree(fn, user_data, namebuf, namelen + 1 + entry_name.len);
+            if(ret)
+            {
+                exit_status = ret;
+                break;
+            }
+        }
+        if(fn(vp) != 0)
+            break;
+    }
+    FindClose(hFindFile);
+    namebuf[namelen] = '\0';
+    return exit_status;
+}
+#endif
+
+int walk_tree(const char *pathname, PathVisitor fn, void *user_data)
+{
+    return walk_tree(pathname, fn, walk_options{}, user_data);
+}
+
+int walk_tree(const char *pathname, PathVisitor fn, walk_options const& opts, void *user_data)
+{
+    C4_CHECK(is_dir(pathname));
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    _TreeWalk walk;
+    walk.fn = fn;
+    walk.user_data = user_data;
+    walk.do_stat = opts.stat;
+    walk.max_fds = opts.max_fds ? opts.max_fds : 1u;
+    walk.num_open = 0;
+    walk.path = pathname;
+    while(walk.path.size() > 1 && walk.path.back() == '/')
+        walk.path.pop_back();
+    struct stat st;
+    if(opts.stat)
+        C4_CHECK(::stat(pathname, &st) == 0);
+    int fd;
+    do {
+        fd = ::open(walk.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } while(fd < 0 && errno == EINTR);
+    const size_t base = to_csubstr(walk.path.c_str()).last_of('/') + 1; // npos+1 == 0
+    int ret = walk.visit(&st, fd >= 0 ? FTW_D : FTW_DNR, 0, base, DIR);
+    if(ret == WALK_SKIP_SUBTREE)
+        ret = 0;
+    else if(ret == 0 && fd >= 0)
+        return walk.walk_dir(fd, 0);
+    if(fd >= 0)
+        ::close(fd);
+    return ret;
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    C4_UNUSED(opts);
+    substr namebuf;
+    namebuf.len = MAX_PATH;
+    csubstr base = to_csubstr(pathname);
+    if(namebuf.len < base.len + 1)
+        namebuf.len = 2 * (base.len + 1);
+    namebuf.str = (char*) c4::aalloc(namebuf.len, alignof(std::max_align_t));
+    C4_ASSERT(!namebuf.overlaps(base));
+    memcpy(namebuf.str, base.str, base.len);
+    namebuf[base.len] = '\0';
+    int exit_status = _walk_tree(fn, user_data, namebuf, base.len);
+    while(exit_status == ENAMETOOLONG)
+    {
+        c4::afree(namebuf.str);
+        namebuf.len *= 2;
+        namebuf.str = (char*) c4::aalloc(namebuf.len, alignof(std::max_align_t));
+        exit_status = _walk_tree(fn, user_data, namebuf, base.len);
+    }
+    if(!exit_status)
+    {
+        VisitedPath vp = {};
+        vp.name = pathname;
+        fn(vp);
+    }
+    c4::afree(namebuf.str);
+    return exit_status;
+#else
+    C4_NOT_IMPLEMENTED();
+    return 0;
+#endif
+}
+
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+struct _WalkDir;
+
+/** an entry found by walk_tree_parallel(), kept for ordered delivery */
+struct _WalkEntry
+{
+    std::string name;
+    struct stat stat_data;
+    int ftw_info;
+    struct FTW ftw_data;
+    PathType_e type;
+    std::unique_ptr<_WalkDir> dir; //!< the contents, when the entry is a directory
+};
+
+struct _WalkDir
+{
+    int ftw_info;
+    std::vector<_WalkEntry> entries;
+};
+
+/** the state of a walk_tree_parallel() call */
+struct _ParallelWalk
+{
+    _WorkPool pool;
+    PathVisitor fn;
+    void *user_data;
+    bool do_stat;
+    bool ordered;
+    std::atomic<int> status;
+
+    _ParallelWalk(walk_options const& opts, PathVisitor fn_, void *user_data_)
+        : pool(opts.num_threads), fn(fn_), user_data(user_data_), do_stat(opts.stat), ordered(opts.ordered), status(0)
+    {
+    }
+
+    int visit(const char *name, struct stat const* stat_data, int ftw_info, struct FTW const* ftw_data, PathType_e type)
+    {
+        VisitedPath vp;
+        vp.name = name;
+        vp.user_data = user_data;
+        vp.stat_data = do_stat && ftw_info != FTW_NS ? stat_data : nullptr;
+        vp.ftw_info = ftw_info;
+        vp.ftw_data = ftw_data;
+        vp.type = type;
+        return fn(vp);
+    }
+
+    /** called only from unordered walks
+     * @return the visitor's return value */
+    int visit_concurrent(const char *name, struct stat const* stat_data, int ftw_info, struct FTW const* ftw_data, PathType_e type)
+    {
+        if(pool.stopped())
+            return WALK_STOP;
+        int ret = visit(name, stat_data, ftw_info, ftw_data, type);
+        if(ret != 0 && ret != WALK_SKIP_SUBTREE)
+        {
+            int expected = 0;
+            status.compare_exchange_strong(expected, ret);
+            pool.stop();
+        }
+        return ret;
+    }
+
+    void push_dir(size_t worker_id, std::string &&path, struct stat const& st, struct FTW ftw, _WalkDir *node)
+    {
+        struct _Task
+        {
+            _ParallelWalk *walk;
+            std::string path;
+            struct stat st;
+            struct FTW ftw;
+            _WalkDir *node;
+            void operator() (size_t id) { walk->scan_dir(id, path, st, ftw, node); }
+        };
+        pool.push(worker_id, _Task{this, std::move(path), st, ftw, node});
+    }
+
+    void scan_dir(size_t worker_id, std::string const& path, struct stat const& st, struct FTW ftw, _WalkDir *node)
+    {
+        ::DIR *dir = ::opendir(path.c_str());
+        const int info = dir ? FTW_D : FTW_DNR;
+        if(ordered)
+        {
+            node->ftw_info = info;
+        }
+        else if(visit_concurrent(path.c_str(), &st, info, &ftw, DIR) != 0) // stop or skip
+        {
+            if(dir)
+                ::closedir(dir);
+            return;
+        }
+        if(!dir)
+            return;
+        const int dfd = ::dirfd(dir);
+        const size_t base = path.back() == '/' ? path.size() : path.size() + 1;
+        std::string child;
+        struct dirent *entry;
+        while((entry = ::readdir(dir)) != nullptr && !pool.stopped())
+        {
+            const char *n = entry->d_name;
+            if(_is_dot_or_dotdot(n))
+                continue;
+            child.assign(path);
+            if(base > path.size())
+                child += '/';
+            child += n;
+            struct stat cst = {};
+            PathType_e ctype;
+            int cinfo = _entry_info(dfd, n, entry->d_type, do_stat, &cst, &ctype);
+            struct FTW cftw;
+            cftw.base = static_cast<int>(base);
+            cftw.level = ftw.level + 1;
+            _WalkDir *cnode = nullptr;
+            if(ordered)
+            {
+                node->entries.emplace_back();
+                _WalkEntry &e = node->entries.back();
+                e.name = child;
+                e.stat_data = cst;
+                e.ftw_info = cinfo;
+                e.ftw_data = cftw;
+                e.type = ctype;
+                if(ctype == DIR)
+                {
+                    e.dir.reset(new _WalkDir{FTW_D, {}});
+                    cnode = e.dir.get();
+                }
+            }
+            if(ctype == DIR)
+                push_dir(worker_id, std::move(child), cst, cftw, cnode);
+            else if(!ordered)
+                visit_concurrent(child.c_str(), &cst, cinfo, &cftw, ctype);
+        }
+        ::closedir(dir);
+    }
+
+    /** @return non-zero to stop the delivery */
+    int deliver(_WalkEntry &e)
+    {
+        int info = e.dir ? e.dir->ftw_info : e.ftw_info;
+        int ret = visit(e.name.c_str(), &e.stat_data, info, &e.ftw_data, e.type);
+        if(ret == WALK_SKIP_SUBTREE)
+            return 0;
+        if(ret != 0 || !e.dir)
+            return ret;
+        std::vector<_WalkEntry> &entries = e.dir->entries;
+        std::sort(entries.begin(), entries.end(), [](_WalkEntry const& l, _WalkEntry const& r){
+            return l.name < r.name;
+        });
+        for(_WalkEntry &child : entries)
+        {
+            ret = deliver(child);
+            if(ret != 0)
+                return ret;
+        }
+        e.dir.reset(); // release memory as soon as possible
+        return 0;
+    }
+};
+
+} // namespace /*anon*/
+#endif
+
+int walk_tree_parallel(const char *pathname, PathVisitor fn, walk_options const& opts, void *user_data)
+{
+    C4_CHECK(is_dir(pathname));
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    _ParallelWalk walk(opts, fn, user_data);
+    _WalkEntry root;
+    root.name = pathname;
+    while(root.name.size() > 1 && root.name.back() == '/')
+        root.name.pop_back();
+    C4_CHECK(::stat(pathname, &root.stat_data) == 0);
+    root.ftw_info = FTW_D;
+    root.ftw_data.level = 0;
+    root.ftw_data.base = static_cast<int>(to_csubstr(root.name.c_str()).last_of('/') + 1); // npos+1 == 0
+    root.type = DIR;
+    if(opts.ordered)
+        root.dir.reset(new _WalkDir{FTW_D, {}});
+    walk.push_dir(0, std::string(root.name), root.stat_data, root.ftw_data, root.dir.get());
+    walk.pool.run();
+    if(opts.ordered)
+        return walk.deliver(root);
+    return walk.status.load();
+#else
+    C4_UNUSED(opts);
+    return walk_tree(pathname, fn, user_data);
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+/** a directory being removed by rmtree_parallel() */
+struct _RmDir
+{
+    std::string path;
+    _RmDir *parent;
+    /** the scan of the directory, plus its subdirectories not yet removed */
+    std::atomic<size_t> pending;
+    /** set when an entry of the subtree could not be removed */
+    std::atomic<bool> failed;
+    bool rescanned;
+
+    _RmDir(std::string &&path_, _RmDir *parent_) : path(std::move(path_)), parent(parent_), pending(1), failed(false), rescanned(false) {}
+};
+
+/** the state of a rmtree_parallel() call */
+struct _ParallelRmtree
+{
+    _WorkPool pool;
+    rmtree_options const& opts;
+    std::vector<std::vector<char>> dirbufs; //!< one per worker
+    std::atomic<size_t> files;
+    std::atomic<size_t> dirs;
+    std::atomic<size_t> errors;
+    std::atomic<size_t> removed;
+    std::atomic<int> first_errno;
+    std::mutex progress_mtx;
+
+    explicit _ParallelRmtree(rmtree_options const& opts_)
+        : pool(opts_.num_threads)
+        , opts(opts_)
+        , dirbufs(pool.num_workers(), std::vector<char>(_default_dirbuf_size))
+        , files(0)
+        , dirs(0)
+        , errors(0)
+        , removed(0)
+        , first_errno(0)
+        , progress_mtx()
+    {
+    }
+
+    rmtree_stats stats() const
+    {
+        return rmtree_stats{files.load(), dirs.load(), errors.load()};
+    }
+
+    void on_removed(std::atomic<size_t> *counter)
+    {
+        counter->fetch_add(1, std::memory_order_relaxed);
+        const size_t n = removed.fetch_add(1, std::memory_order_relaxed) + 1;
+        if(opts.progress && opts.progress_interval && n % opts.progress_interval == 0)
+        {
+            // skip this report if another thread is reporting
+            std::unique_lock<std::mutex> lock(progress_mtx, std::try_to_lock);
+            if(lock.owns_lock())
+                opts.progress(stats(), opts.user_data);
+        }
+    }
+
+    void on_error(_RmDir *dir, int err)
+    {
+        errors.fetch_add(1, std::memory_order_relaxed);
+        int expected = 0;
+        first_errno.compare_exchange_strong(expected, err);
+        dir->failed.store(true);
+    }
+
+    void push_scan(size_t worker_id, _RmDir *dir)
+    {
+        pool.push(worker_id, [this, dir](size_t id){ scan(id, dir); });
+    }
+
+    /** remove the entries of the directory, and queue its subdirectories */
+    void scan(size_t worker_id, _RmDir *dir)
+    {
+        int dfd;
+        do {
+            dfd = ::open(dir->path.c_str(), O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+        } while(dfd < 0 && errno == EINTR);
+        if(dfd < 0)
+        {
+            on_error(dir, errno);
+            done(worker_id, dir);
+            return;
+        }
+        std::vector<char> &dirbuf = dirbufs[worker_id];
+        _DirReader reader(dfd, substr(dirbuf.data(), dirbuf.size()));
+        _DirEntry e;
+        while(reader.next(&e))
+        {
+            bool is_dir = e.d_type == DT_DIR;
+            if(e.d_type == DT_UNKNOWN)
+            {
+                struct stat st;
+                is_dir = ::fstatat(dfd, e.name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if(is_dir)
+            {
+                std::string child;
+                child.reserve(dir->path.size() + 1 + e.len);
+                child.append(dir->path);
+                child += '/';
+                child.append(e.name, e.len);
+                dir->pending.fetch_add(1);
+                push_scan(worker_id, new _RmDir(std::move(child), dir));
+            }
+            else if(::unlinkat(dfd, e.name, 0) == 0)
+                on_removed(&files);
+            else if(errno != ENOENT)
+                on_error(dir, errno);
+        }
+        if(!reader.ok())
+            on_error(dir, reader.error());
+        done(worker_id, dir);
+    }
+
+    /** account for a finished scan or subdirectory, and remove the
+     * directories which have nothing else pending, bottom-up */
+    void done(size_t worker_id, _RmDir *dir)
+    {
+        while(dir && dir->pending.fetch_sub(1) == 1)
+        {
+            if(::rmdir(dir->path.c_str()) == 0)
+            {
+                on_removed(&this->dirs);
+            }
+            else if(errno == ENOTEMPTY && !dir->failed.load() && !dir->rescanned)
+            {
+                // entries were missed by the scan, or were created
+                // meanwhile: scan it once more
+                dir->rescanned = true;
+                dir->pending.store(1);
+                push_scan(worker_id, dir);
+                return;
+            }
+            else
+            {
+                on_error(dir, errno);
+            }
+            _RmDir *parent = dir->parent;
+            if(parent && dir->failed.load())
+                parent->failed.store(true);
+            delete dir;
+            dir = parent;
+        }
+    }
+};
+
+} // namespace anon
+#endif
+
+int rmtree_parallel(const char *pathname, rmtree_options const& opts, rmtree_stats *stats)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    struct stat st;
+    if(::lstat(pathname, &st) != 0)
+    {
+        if(stats)
+            *stats = rmtree_stats{0, 0, 1};
+        return -1;
+    }
+    if(!S_ISDIR(st.st_mode))
+    {
+        const int ret = ::unlink(pathname);
+        if(stats)
+            *stats = ret == 0 ? rmtree_stats{1, 0, 0} : rmtree_stats{0, 0, 1};
+        return ret;
+    }
+    std::string root(pathname);
+    while(root.size() > 1 && root.back() == '/')
+        root.pop_back();
+    _ParallelRmtree rm(opts);
+    rm.push_scan(0, new _RmDir(std::move(root), nullptr));
+    rm.pool.run();
+    if(stats)
+        *stats = rm.stats();
+    if(rm.errors.load() == 0)
+        return 0;
+    errno = rm.first_errno.load();
+    return -1;
+#else
+    C4_UNUSED(opts);
+    if(stats)
+        *stats = rmtree_stats{0, 0, 0};
+    if(!dir_exists(pathname))
+        return rmfile(pathname);
+    return rmtree(pathname);
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+
+namespace /*anon*/ {
+std::string _parent_dir(const char *filename);
+} // namespace anon
+
+struct TrashCan::_Impl
+{
+    std::string trash_dirname;
+    rmtree_options opts;
+    mutable std::mutex mtx;
+    std::condition_variable cv_work;
+    std::condition_variable cv_idle;
+    std::deque<std::string> queue;
+    /** the number of entries queued (or being moved) into each trash
+     * directory. A trash directory is removed when its count drops to
+     * zero. */
+    std::unordered_map<std::string, size_t> trash_refs;
+    /** the names of the entries queued or being removed, so that
+     * recover() does not queue them again */
+    std::unordered_set<std::string> known;
+    bool busy;
+    bool stop;
+    rmtree_stats stats;
+    std::thread thread;
+
+    _Impl(const char *trash_dirname_, size_t num_threads)
+        : trash_dirname(trash_dirname_)
+        , opts()
+        , mtx()
+        , cv_work()
+        , cv_idle()
+        , queue()
+        , trash_refs()
+        , known()
+        , busy(false)
+        , stop(false)
+        , stats()
+        , thread()
+    {
+        opts.num_threads = num_threads;
+    }
+
+    ~_Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+        cv_work.notify_one();
+        if(thread.joinable())
+            thread.join();
+    }
+
+    static csubstr entry_name(csubstr path)
+    {
+        size_t pos = path.last_of('/');
+        return pos == csubstr::npos ? path : path.sub(pos + 1);
+    }
+
+    /** queue an entry of a trash directory. The caller must have
+     * taken a reference to the trash directory. */
+    void push(std::string &&path)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        csubstr name = entry_name(to_csubstr(path));
+        known.emplace(name.str, name.len);
+        queue.push_back(std::move(path));
+        if(!thread.joinable())
+            thread = std::thread(&_Impl::reclaim, this);
+        cv_work.notify_one();
+    }
+
+    /** the background thread: remove the queued trees until stopped
+     * and the queue is empty */
+    void reclaim()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while(true)
+        {
+            cv_work.wait(lock, [this]{ return stop || !queue.empty(); });
+            if(queue.empty())
+                return;
+            std::string path = std::move(queue.front());
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+            rmtree_stats s = {};
+            rmtree_parallel(path.c_str(), opts, &s);
+            lock.lock();
+            stats.files += s.files;
+            stats.dirs += s.dirs;
+            stats.errors += s.errors;
+            csubstr name = entry_name(to_csubstr(path));
+            known.erase(std::string(name.str, name.len));
+            unref_trash(_parent_dir(path.c_str()));
+            busy = false;
+            if(queue.empty())
+                cv_idle.notify_all();
+        }
+    }
+
+    /** take a reference to a trash directory, so that it is not
+     * removed while an entry is moved into it */
+    void ref_trash(std::string const& trash)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        ++trash_refs[trash];
+    }
+
+    /** drop a reference to a trash directory, removing the directory
+     * when it was the last one. Must be called with the lock held. */
+    void unref_trash(std::string const& trash)
+    {
+        auto it = trash_refs.find(trash);
+        if(it == trash_refs.end() || --it->second != 0)
+            return;
+        trash_refs.erase(it);
+        rmdir(trash.c_str()); // fails harmlessly if something else is in it
+    }
+
+    /** the trash directory for the path */
+    std::string trash_dir(const char *pathname) const
+    {
+        std::string trash = _parent_dir(pathname);
+        trash += '/';
+        trash += trash_dirname;
+        return trash;
+    }
+};
+
+TrashCan::TrashCan(const char *trash_dirname, size_t num_threads)
+    : m_impl(new _Impl(trash_dirname, num_threads))
+{
+}
+
+TrashCan::~TrashCan()
+{
+    delete m_impl;
+}
+
+int TrashCan::remove(const char *pathname)
+{
+    std::string path(pathname);
+    while(path.size() > 1 && path.back() == '/')
+        path.pop_back();
+    const std::string trash = m_impl->trash_dir(path.c_str());
+    m_impl->ref_trash(trash);
+    if(mkdir(trash.c_str()) == 0 || errno == EEXIST)
+    {
+        static const TmpPattern name_pat("XXXXXXXXXXXXXXXX");
+        char name[24];
+        tmpnam(name_pat, name, sizeof(name));
+        std::string dst = trash;
+        dst += '/';
+        dst += name;
+        if(::rename(path.c_str(), dst.c_str()) == 0)
+        {
+            m_impl->push(std::move(dst));
+            return 0;
+        }
+        if(errno == ENOENT)
+        {
+            int err = errno;
+            std::lock_guard<std::mutex> lock(m_impl->mtx);
+            m_impl->unref_trash(trash);
+            errno = err;
+            return -1;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mtx);
+        m_impl->unref_trash(trash);
+    }
+    // the rename failed (eg EXDEV, or EBUSY for a mount point), or
+    // there is no trash: remove it here
+    rmtree_stats s = {};
+    int ret = rmtree_parallel(path.c_str(), m_impl->opts, &s);
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    m_impl->stats.files += s.files;
+    m_impl->stats.dirs += s.dirs;
+    m_impl->stats.errors += s.errors;
+    return ret;
+}
+
+namespace /*anon*/ {
+int _list_dir_visitor(VisitedFile const& p)
+{
+    static_cast<std::vector<std::string>*>(p.user_data)->emplace_back(p.name, p.name_len);
+    return 0;
+}
+
+/** get the full paths of the entries of the directory */
+std::vector<std::string> _list_dir(const char *dirname)
+{
+    std::vector<std::string> entries;
+    std::vector<char> namebuf(strlen(dirname) + 64);
+    maybe_buf<char> buf(namebuf.data(), namebuf.size());
+    while(!walk_entries(dirname, &_list_dir_visitor, &buf, &entries) && !buf.valid())
+    {
+        entries.clear();
+        namebuf.resize(buf.required_size);
+        buf = maybe_buf<char>(namebuf.data(), namebuf.size());
+    }
+    return entries;
+}
+} // namespace anon
+
+size_t TrashCan::recover(const char *dirname)
+{
+    std::string trash(dirname);
+    while(trash.size() > 1 && trash.back() == '/')
+        trash.pop_back();
+    trash += '/';
+    trash += m_impl->trash_dirname;
+    if(!dir_exists(trash.c_str()))
+        return 0;
+    std::vector<std::string> entries = _list_dir(trash.c_str());
+    size_t num = 0;
+    for(std::string &e : entries)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_impl->mtx);
+            csubstr name = _Impl::entry_name(to_csubstr(e));
+            if(m_impl->known.find(std::string(name.str, name.len)) != m_impl->known.end())
+                continue;
+            ++m_impl->trash_refs[trash];
+        }
+        m_impl->push(std::move(e));
+        ++num;
+    }
+    return num;
+}
+
+void TrashCan::wait()
+{
+    std::unique_lock<std::mutex> lock(m_impl->mtx);
+    m_impl->cv_idle.wait(lock, [this]{ return m_impl->queue.empty() && !m_impl->busy; });
+}
+
+size_t TrashCan::pending() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    return m_impl->queue.size() + m_impl->busy;
+}
+
+rmtree_stats TrashCan::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    return m_impl->stats;
+}
+
+namespace /*anon*/ {
+TrashCan& _process_trash()
+{
+    static TrashCan trash;
+    return trash;
+}
+} // namespace anon
+
+int rmtree_async(const char *pathname)
+{
+    return _process_trash().remove(pathname);
+}
+
+void rmtree_async_wait()
+{
+    _process_trash().wait();
+}
+
+size_t rmtree_async_recover(const char *dirname)
+{
+    return _process_trash().recover(dirname);
+}
+
+
+//-----------------------------------------------------------------------------
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+/** the access and modification times, as for futimens() */
+void _stat_times(struct stat const& s, struct timespec ts[2])
+{
+#if defined(C4_MACOS) || defined(C4_IOS)
+    ts[0] = s.st_atimespec;
+    ts[1] = s.st_mtimespec;
+#else
+    ts[0] = s.st_atim;
+    ts[1] = s.st_mtim;
+#endif
+}
+
+unsigned char _stat_dirent_type(struct stat const& s)
+{
+    if(S_ISREG(s.st_mode)) return DT_REG;
+    if(S_ISDIR(s.st_mode)) return DT_DIR;
+    if(S_ISLNK(s.st_mode)) return DT_LNK;
+    return DT_UNKNOWN;
+}
+
+/** a directory being copied by copy_tree() */
+struct _CopyDir
+{
+    std::string src;
+    std::string dst;
+    _CopyDir *parent;
+    struct stat st; ///< of the source
+    /** the scan of the directory, plus its subdirectories not yet finished */
+    std::atomic<size_t> pending;
+
+    _CopyDir(std::string &&src_, std::string &&dst_, _CopyDir *parent_, struct stat const& st_)
+        : src(std::move(src_)), dst(std::move(dst_)), parent(parent_), st(st_), pending(1)
+    {
+    }
+};
+
+/** the state of a copy_tree() call */
+struct _ParallelCopy
+{
+    _WorkPool pool;
+    copy_tree_options const& opts;
+    std::vector<std::vector<char>> dirbufs; //!< one per worker
+    std::atomic<size_t> files;
+    std::atomic<size_t> hardlinks;
+    std::atomic<size_t> dirs;
+    std::atomic<size_t> symlinks;
+    std::atomic<size_t> bytes;
+    std::atomic<size_t> errors;
+    std::atomic<int> first_errno;
+
+    explicit _ParallelCopy(copy_tree_options const& opts_)
+        : pool(opts_.num_threads)
+        , opts(opts_)
+        , dirbufs(pool.num_workers(), std::vector<char>(_default_dirbuf_size))
+        , files(0)
+        , hardlinks(0)
+        , dirs(0)
+        , symlinks(0)
+        , bytes(0)
+        , errors(0)
+        , first_errno(0)
+    {
+    }
+
+    copy_tree_stats stats() const
+    {
+        return copy_tree_stats{files.load(), hardlinks.load(), dirs.load(), symlinks.load(), bytes.load(), errors.load()};
+    }
+
+    void on_error(int err)
+    {
+        errors.fetch_add(1, std::memory_order_relaxed);
+        int expected = 0;
+        first_errno.compare_exchange_strong(expected, err);
+    }
+
+    void push_scan(size_t worker_id, _CopyDir *dir)
+    {
+        pool.push(worker_id, [this, dir](size_t id){ scan(id, dir); });
+    }
+
+    /** copy the entries of the directory, and queue its subdirectories */
+    void scan(size_t worker_id, _CopyDir *dir)
+    {
+        int sfd, dfd = -1;
+        do {
+            sfd = ::open(dir->src.c_str(), O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+        } while(sfd < 0 && errno == EINTR);
+        if(sfd >= 0)
+        {
+            do {
+                dfd = ::open(dir->dst.c_str(), O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+            } while(dfd < 0 && errno == EINTR);
+            if(dfd < 0)
+                ::close(sfd);
+        }
+        if(dfd < 0)
+        {
+            on_error(errno);
+            done(dir);
+            return;
+        }
+        std::vector<char> &dirbuf = dirbufs[worker_id];
+        _DirReader reader(sfd, substr(dirbuf.data(), dirbuf.size()));
+        _DirEntry e;
+        while(reader.next(&e))
+        {
+            unsigned char type = e.d_type;
+            struct stat st = {};
+            // the files are stat-ed after they are opened
+            if(type == DT_UNKNOWN || (type != DT_REG && (opts.preserve_mode || opts.preserve_times)))
+            {
+                if(::fstatat(sfd, e.name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                {
+                    on_error(errno);
+                    continue;
+                }
+                type = _stat_dirent_type(st);
+            }
+            if(type == DT_DIR)
+                copy_dir(worker_id, dir, dfd, e, st);
+            else if(type == DT_REG)
+                copy_file(sfd, dfd, e.name);
+            else if(type == DT_LNK)
+                copy_symlink(sfd, dfd, e.name, st);
+            // other types are skipped
+        }
+        if(!reader.ok())
+            on_error(reader.error());
+        ::close(dfd);
+        done(dir);
+    }
+
+    void copy_dir(size_t worker_id, _CopyDir *dir, int dfd, _DirEntry const& e, struct stat const& st)
+    {
+        // when preserving the mode, it is set after the contents are
+        // copied, as it may not allow writing
+        if(::mkdirat(dfd, e.name, opts.preserve_mode ? 0700 : 0777) != 0)
+        {
+            on_error(errno);
+            return;
+        }
+        dirs.fetch_add(1, std::memory_order_relaxed);
+        std::string src, dst;
+        src.reserve(dir->src.size() + 1 + e.len);
+        src.append(dir->src).append(1, '/').append(e.name, e.len);
+        dst.reserve(dir->dst.size() + 1 + e.len);
+        dst.append(dir->dst).append(1, '/').append(e.name, e.len);
+        dir->pending.fetch_add(1);
+        push_scan(worker_id, new _CopyDir(std::move(src), std::move(dst), dir, st));
+    }
+
+    void copy_file(int sfd, int dfd, const char *name)
+    {
+        if(opts.hardlink && ::linkat(sfd, name, dfd, name, 0) == 0)
+        {
+            files.fetch_add(1, std::memory_order_relaxed);
+            hardlinks.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        int from;
+        do {
+            from = ::openat(sfd, name, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+        } while(from < 0 && errno == EINTR);
+        struct stat st;
+        if(from < 0 || ::fstat(from, &st) != 0)
+        {
+            on_error(errno);
+            if(from >= 0)
+                ::close(from);
+            return;
+        }
+        const mode_t mode = opts.preserve_mode ? (st.st_mode & 07777) : 0666;
+        int to;
+        do {
+            to = ::openat(dfd, name, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, mode);
+        } while(to < 0 && errno == EINTR);
+        if(to < 0)
+        {
+            on_error(errno);
+            ::close(from);
+            return;
+        }
+        copy_result result = {COPY_NONE, 0};
+        bool ok = _copy_fd(from, to, static_cast<size_t>(st.st_size), opts.file, &result);
+        // the mode given to openat() was masked by the umask
+        if(ok && opts.preserve_mode)
+            ok = ::fchmod(to, mode) == 0;
+        if(ok && opts.preserve_times)
+        {
+            struct timespec ts[2];
+            _stat_times(st, ts);
+            ok = ::futimens(to, ts) == 0;
+        }
+        int err = errno;
+        if(::close(to) != 0 && ok)
+        {
+            ok = false;
+            err = errno;
+        }
+        ::close(from);
+        bytes.fetch_add(result.size, std::memory_order_relaxed);
+        if(ok)
+            files.fetch_add(1, std::memory_order_relaxed);
+        else
+            on_error(err);
+    }
+
+    void copy_symlink(int sfd, int dfd, const char *name, struct stat const& st)
+    {
+        std::string target(256, '\0');
+        ::ssize_t len;
+        while((len = ::readlinkat(sfd, name, &target[0], target.size())) >= static_cast<::ssize_t>(target.size()))
+            target.resize(2 * target.size());
+        if(len < 0)
+        {
+            on_error(errno);
+            return;
+        }
+        target.resize(static_cast<size_t>(len));
+        if(::symlinkat(target.c_str(), dfd, name) != 0)
+        {
+            on_error(errno);
+            return;
+        }
+        if(opts.preserve_times)
+        {
+            struct timespec ts[2];
+            _stat_times(st, ts);
+            if(::utimensat(dfd, name, ts, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                on_error(errno);
+                return;
+            }
+        }
+        symlinks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** account for a finished scan or subdirectory, and finish the
+     * directories which have nothing else pending, bottom-up: their
+     * mode and times can be set only after their contents are done */
+    void done(_CopyDir *dir)
+    {
+        while(dir && dir->pending.fetch_sub(1) == 1)
+        {
+            if(opts.preserve_mode && ::chmod(dir->dst.c_str(), dir->st.st_mode & 07777) != 0)
+                on_error(errno);
+            if(opts.preserve_times)
+            {
+                struct timespec ts[2];
+                _stat_times(dir->st, ts);
+                if(::utimensat(AT_FDCWD, dir->dst.c_str(), ts, 0) != 0)
+                    on_error(errno);
+            }
+            _CopyDir *parent = dir->parent;
+            delete dir;
+            dir = parent;
+        }
+    }
+};
+
+} // namespace anon
+#else
+namespace /*anon*/ {
+/** copy the tree with the calling thread. Like the parallel copy,
+ * this carries on past the entries which cannot be copied.
+ * @param first_errno receives the errno of the first failure */
+void _copy_tree_seq(std::string const& src, std::string const& dst, copy_tree_options const& opts, copy_tree_stats *stats, int *first_errno)
+{
+    C4_UNUSED(opts); // see the note of copy_tree()
+    auto on_error = [&](int err){
+        if(!stats->errors++)
+            *first_errno = err;
+    };
+    if(mkdir(dst.c_str()) != 0)
+    {
+        on_error(errno);
+        return;
+    }
+    ++stats->dirs;
+    for(std::string const& entry : _list_dir(src.c_str()))
+    {
+        std::string child = dst + entry.substr(src.size());
+        if(is_dir(entry.c_str()))
+        {
+            _copy_tree_seq(entry, child, opts, stats, first_errno);
+            continue;
+        }
+        // not with copy_file(), which aborts on failure
+#if defined(C4_WIN) || defined(__MINGW32__)
+        if(!CopyFileA(entry.c_str(), child.c_str(), /*failifexists*/TRUE))
+        {
+            on_error(EIO); // CopyFileA() reports through GetLastError(), not errno
+            continue;
+        }
+        ++stats->files;
+        path_info pi = info(child.c_str(), INFO_SIZE);
+        if(pi.mask & INFO_SIZE)
+            stats->bytes += static_cast<size_t>(pi.size);
+#else
+        C4_NOT_IMPLEMENTED();
+#endif
+    }
+}
+} // namespace anon
+#endif
+
+namespace /*anon*/ {
+/** whether @p dst, which does not exist yet, would be @p src or a
+ * path below it, once the symbolic links and dots of @p src and of
+ * the parent of @p dst are resolved. False when either cannot be
+ * resolved: the copy then reports the failure. */
+bool _is_within(std::string const& src, std::string const& dst)
+{
+    std::string parent = _parent_dir(dst.c_str());
+    csubstr name = to_csubstr(dst);
+#if defined(C4_WIN) || defined(__MINGW32__)
+    const char seps[] = "/\\";
+#else
+    const char seps[] = "/";
+#endif
+    size_t pos = name.last_of(seps);
+    if(pos != csubstr::npos)
+        name = name.sub(pos + 1);
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    char *src_real = ::realpath(src.c_str(), nullptr);
+    char *parent_real = ::realpath(parent.c_str(), nullptr);
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    char *src_real = ::_fullpath(nullptr, src.c_str(), 0);
+    char *parent_real = ::_fullpath(nullptr, parent.c_str(), 0);
+#else
+    char *src_real = nullptr, *parent_real = nullptr;
+#endif
+    bool within = false;
+    if(src_real && parent_real)
+    {
+        std::string dst_real(parent_real);
+        if(dst_real.empty() || to_csubstr(seps).find(dst_real.back()) == csubstr::npos)
+            dst_real += seps[0];
+        dst_real.append(name.str, name.len);
+        csubstr s = to_csubstr(src_real);
+        csubstr d = to_csubstr(dst_real);
+        within = d.begins_with(s) && (d.len == s.len
+                                      || to_csubstr(seps).find(d[s.len]) != csubstr::npos
+                                      || s.last_of(seps) + 1 == s.len); // src is the root
+    }
+    ::free(src_real);
+    ::free(parent_real);
+    return within;
+}
+} // namespace anon
+
+int copy_tree(const char *src, const char *dst, copy_tree_options const& opts, copy_tree_stats *stats)
+{
+    if(stats)
+        *stats = copy_tree_stats{};
+    std::string srcdir(src), dstdir(dst);
+    while(srcdir.size() > 1 && srcdir.back() == '/')
+        srcdir.pop_back();
+    while(dstdir.size() > 1 && dstdir.back() == '/')
+        dstdir.pop_back();
+    // like cp -r, do not copy a directory into itself
+    if(_is_within(srcdir, dstdir))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    struct stat st;
+    if(::stat(srcdir.c_str(), &st) != 0)
+        return -1;
+    if(!S_ISDIR(st.st_mode))
+    {
+        errno = ENOTDIR;
+        return -1;
+    }
+    if(::mkdir(dstdir.c_str(), opts.preserve_mode ? 0700 : 0777) != 0)
+        return -1;
+    _ParallelCopy cp(opts);
+    cp.dirs.store(1);
+    cp.push_scan(0, new _CopyDir(std::move(srcdir), std::move(dstdir), nullptr, st));
+    cp.pool.run();
+    if(stats)
+        *stats = cp.stats();
+    if(cp.errors.load() == 0)
+        return 0;
+    errno = cp.first_errno.load();
+    return -1;
+#else
+    if(!dir_exists(srcdir.c_str()))
+    {
+        errno = ENOTDIR;
+        return -1;
+    }
+    copy_tree_stats st = {};
+    int first_errno = 0;
+    _copy_tree_seq(srcdir, dstdir, opts, &st, &first_errno);
+    if(stats)
+        *stats = st;
+    if(st.errors == 0)
+        return 0;
+    errno = first_errno;
+    return -1;
+#endif
+}
+
+namespace /*anon*/ {
+
+constexpr const size_t _entry_list_initial_arena_size = 4096u;
+constexpr const size_t _entry_list_initial_size = 64u;
+
+template<class T>
+void _entry_list_alloc(MemoryResource *mr, maybe_buf<T> *b, size_t num)
+{
+    b->buf = static_cast<T*>(mr->allocate(num * sizeof(T), alignof(T)));
+    C4_CHECK(b->buf != nullptr);
+    b->size = num;
+    b->required_size = 0;
+}
+
+template<class T>
+void _entry_list_free(MemoryResource *mr, maybe_buf<T> *b)
+{
+    if(b->buf)
+        mr->deallocate(b->buf, b->size * sizeof(T), alignof(T));
+    *b = maybe_buf<T>();
+}
+
+size_t _entry_list_capacity(size_t size, size_t required_size)
+{
+    size_t cap = 2u * size;
+    return cap > required_size ? cap : required_size;
+}
+
+/** grow the buffer geometrically to accomodate its required size,
+ * keeping its first @p num_used elements */
+template<class T>
+void _entry_list_grow(MemoryResource *mr, maybe_buf<T> *b, size_t num_used)
+{
+    C4_ASSERT(num_used <= b->size);
+    maybe_buf<T> prev = *b;
+    _entry_list_alloc(mr, b, _entry_list_capacity(prev.size, prev.required_size));
+    b->required_size = prev.required_size;
+    if(num_used)
+        memcpy(b->buf, prev.buf, num_used * sizeof(T));
+    _entry_list_free(mr, &prev);
+}
+
+/** grow the buffers of a growable list which do not accomodate their
+ * required sizes. The names are relocated to the new arena. */
+void _entry_list_grow(EntryList *el, size_t num_entries, size_t arena_used)
+{
+    MemoryResource *mr = el->resource;
+    if(!el->names.valid())
+        _entry_list_grow(mr, &el->names, num_entries);
+    if(el->lengths.buf && !el->lengths.valid())
+        _entry_list_grow(mr, &el->lengths, num_entries);
+    if(el->inodes.buf && !el->inodes.valid())
+        _entry_list_grow(mr, &el->inodes, num_entries);
+    if(el->types.buf && !el->types.valid())
+        _entry_list_grow(mr, &el->types, num_entries);
+    if(!el->arena.valid())
+    {
+        maybe_buf<char> prev = el->arena;
+        _entry_list_alloc(mr, &el->arena, _entry_list_capacity(prev.size, prev.required_size));
+        el->arena.required_size = prev.required_size;
+        if(arena_used)
+            memcpy(el->arena.buf, prev.buf, arena_used);
+        for(size_t i = 0; i < num_entries; ++i)
+            el->names.buf[i] = el->arena.buf + (el->names.buf[i] - prev.buf);
+        _entry_list_free(mr, &prev);
+    }
+    C4_ASSERT(el->valid());
+}
+
+void _entry_list_free(EntryList *el)
+{
+    if(!el->resource)
+        return;
+    _entry_list_free(el->resource, &el->arena);
+    _entry_list_free(el->resource, &el->names);
+    _entry_list_free(el->resource, &el->lengths);
+    _entry_list_free(el->resource, &el->inodes);
+    _entry_list_free(el->resource, &el->types);
+    el->resource = nullptr;
+}
+
+int _list_entries_visitor(VisitedFile const& vf)
+{
+    EntryList *el = static_cast<EntryList*>(vf.user_data);
+    size_t namelen = vf.name_len;
+    const size_t pos = el->names.required_size;
+    const size_t arena_pos = el->arena.required_size;
+    el->names.required_size += 1u;
+    el->arena.required_size += namelen + 1u;
+    if(el->lengths.buf)
+        el->lengths.required_size = el->names.required_size;
+    if(el->inodes.buf)
+        el->inodes.required_size = el->names.required_size;
+    if(el->types.buf)
+        el->types.required_size = el->names.required_size;
+    if(el->resource && !el->valid())
+        _entry_list_grow(el, pos, arena_pos);
+    if(el->valid())
+    {
+        char *dst = el->arena.buf + arena_pos;
+        memcpy(dst, vf.name, namelen);
+        dst[namelen] = '\0';
+        el->names.buf[pos] = dst;
+        if(el->lengths.buf)
+            el->lengths.buf[pos] = namelen;
+        if(el->inodes.buf)
+            el->inodes.buf[pos] = vf.inode;
+        if(el->types.buf)
+        {
+            PathType_e type = vf.type;
+            #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+            struct stat st;
+            if(type == INVALID && ::lstat(vf.name, &st) == 0)
+                type = _path_type(&st);
+            #endif
+            el->types.buf[pos] = static_cast<uint8_t>(type);
+        }
+    }
+    return 0;
+}
+
+/** apply the permutation to the array, ie, make arr[i] = arr[perm[i]] */
+template<class T>
+void _permute(T *arr, std::vector<size_t> const& perm)
+{
+    if(!arr)
+        return;
+    std::vector<T> tmp(perm.size());
+    for(size_t i = 0; i < perm.size(); ++i)
+        tmp[i] = arr[perm[i]];
+    memcpy(arr, tmp.data(), tmp.size() * sizeof(T));
+}
+
+/** call fn(first, last) over subranges of [0,num), in parallel when
+ * num is above the threshold */
+template<class Fn>
+void _parallel_for(size_t num, sort_options const& opts, Fn &&fn)
+{
+    size_t num_threads = _num_threads(opts.num_threads);
+    if(num < opts.parallel_threshold || num_threads < 2)
+    {
+        fn(size_t(0), num);
+        return;
+    }
+    size_t chunk = (num + num_threads - 1) / num_threads;
+    _WorkPool pool(num_threads);
+    for(size_t first = 0; first < num; first += chunk)
+    {
+        size_t last = first + chunk < num ? first + chunk : num;
+        pool.push(0, [first, last, &fn](size_t){ fn(first, last); });
+    }
+    pool.run();
+}
+
+/** an entry's sort key: 8 bytes of the name (after the common
+ * prefix) packed in big-endian order, so that comparing keys
+ * compares the names without dereferencing them */
+struct _SortKey
+{
+    uint64_t prefix;
+    size_t   idx;
+};
+
+uint64_t _sort_prefix(const char *s)
+{
+    uint64_t key = 0;
+    size_t i = 0;
+    for( ; i < 8u && s[i]; ++i)
+        key = (key << 8u) | static_cast<unsigned char>(s[i]);
+    if(i > 0 && i < 8u)
+        key <<= 8u * (8u - i);
+    return key;
+}
+
+bool _sort_prefix_less(_SortKey const& lhs, _SortKey const& rhs)
+{
+    return lhs.prefix < rhs.prefix;
+}
+
+/** sort the keys by their prefix at the given depth, and then
+ * recursively sort the runs of equal prefix by the next 8 bytes. The
+ * prefixes are restored before returning. */
+void _sort_keys(_SortKey *keys, size_t num, char *const* names, size_t depth)
+{
+    std::sort(keys, keys + num, &_sort_prefix_less);
+    for(size_t first = 0; first < num; )
+    {
+        const uint64_t prefix = keys[first].prefix;
+        size_t last = first + 1;
+        while(last < num && keys[last].prefix == prefix)
+            ++last;
+        // when the last byte is zero, the names ended and are equal
+        if(last - first > 1 && (prefix & 0xffu) != 0)
+        {
+            for(size_t i = first; i < last; ++i)
+                keys[i].prefix = _sort_prefix(names[keys[i].idx] + depth + 8u);
+            _sort_keys(keys + first, last - first, names, depth + 8u);
+            for(size_t i = first; i < last; ++i)
+                keys[i].prefix = prefix;
+        }
+        first = last;
+    }
+}
+
+bool _is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/** compare the digit sequences by their numeric value, and the rest
+ * bytewise. Names differing only in leading zeros are ordered
+ * bytewise, so that the order is deterministic. */
+int _natural_cmp(const char *a, const char *b)
+{
+    const char *a0 = a, *b0 = b;
+    while(*a && *b)
+    {
+        if(_is_digit(*a) && _is_digit(*b))
+        {
+            while(*a == '0' && _is_digit(a[1]))
+                ++a;
+            while(*b == '0' && _is_digit(b[1]))
+                ++b;
+            size_t alen = 0, blen = 0;
+            while(_is_digit(a[alen]))
+                ++alen;
+            while(_is_digit(b[blen]))
+                ++blen;
+            if(alen != blen)
+                return alen < blen ? -1 : 1;
+            int cmp = memcmp(a, b, alen);
+            if(cmp != 0)
+                return cmp;
+            a += alen;
+            b += blen;
+            continue;
+        }
+        if(*a != *b)
+            return static_cast<unsigned char>(*a) < static_cast<unsigned char>(*b) ? -1 : 1;
+        ++a;
+        ++b;
+    }
+    if(*a || *b)
+        return *a ? 1 : -1;
+    return strcmp(a0, b0);
+}
+
+/** sort the chunks in parallel, then merge them pairwise */
+template<class SortChunk, class Less>
+void _parallel_sort(_SortKey *keys, size_t num, sort_options const& opts, SortChunk &&sort_chunk, Less &&less)
+{
+    size_t num_threads = _num_threads(opts.num_threads);
+    if(num < opts.parallel_threshold || num_threads < 2)
+    {
+        sort_chunk(keys, num);
+        return;
+    }
+    size_t chunk = (num + num_threads - 1) / num_threads;
+    _WorkPool pool(num_threads);
+    for(size_t first = 0; first < num; first += chunk)
+    {
+        size_t len = first + chunk < num ? chunk : num - first;
+        pool.push(0, [keys, first, len, &sort_chunk](size_t){ sort_chunk(keys + first, len); });
+    }
+    pool.run();
+    for(size_t width = chunk; width < num; width *= 2u)
+    {
+        for(size_t first = 0; first + width < num; first += 2u * width)
+        {
+            size_t last = first + 2u * width < num ? first + 2u * width : num;
+            pool.push(0, [keys, first, width, last, &less](size_t){
+                std::inplace_merge(keys + first, keys + first + width, keys + last, less);
+            });
+        }
+        pool.run();
+    }
+}
+
+/** the length of the prefix common to all the names */
+size_t _common_prefix(char *const* names, size_t num)
+{
+    if(!num)
+        return 0;
+    const char *first = names[0];
+    size_t len = strlen(first);
+    for(size_t i = 1; i < num && len; ++i)
+    {
+        const char *n = names[i];
+        size_t k = 0;
+        while(k < len && n[k] == first[k])
+            ++k;
+        len = k;
+    }
+    return len;
+}
+} // namespace anon
+
+EntryList::EntryList(MemoryResource *mr, int metadata)
+    : EntryList()
+{
+    C4_CHECK(mr != nullptr);
+    resource = mr;
+    _entry_list_alloc(mr, &arena, _entry_list_initial_arena_size);
+    _entry_list_alloc(mr, &names, _entry_list_initial_size);
+    if(metadata & ENTRY_LENGTHS)
+        _entry_list_alloc(mr, &lengths, _entry_list_initial_size);
+    if(metadata & ENTRY_INODES)
+        _entry_list_alloc(mr, &inodes, _entry_list_initial_size);
+    if(metadata & ENTRY_TYPES)
+        _entry_list_alloc(mr, &types, _entry_list_initial_size);
+}
+
+EntryList::~EntryList()
+{
+    _entry_list_free(this);
+}
+
+EntryList::EntryList(EntryList const& that)
+    : arena(that.arena)
+    , names(that.names)
+    , lengths(that.lengths)
+    , inodes(that.inodes)
+    , types(that.types)
+    , resource(nullptr)
+{
+    C4_CHECK_MSG(that.resource == nullptr, "a growable EntryList cannot be copied");
+}
+
+EntryList& EntryList::operator=(EntryList const& that)
+{
+    C4_CHECK_MSG(that.resource == nullptr, "a growable EntryList cannot be copied");
+    if(&that == this)
+        return *this;
+    _entry_list_free(this);
+    arena = that.arena;
+    names = that.names;
+    lengths = that.lengths;
+    inodes = that.inodes;
+    types = that.types;
+    return *this;
+}
+
+EntryList::EntryList(EntryList && that) noexcept
+    : arena(that.arena)
+    , names(that.names)
+    , lengths(that.lengths)
+    , inodes(that.inodes)
+    , types(that.types)
+    , resource(that.resource)
+{
+    that.arena = {};
+    that.names = {};
+    that.lengths = {};
+    that.inodes = {};
+    that.types = {};
+    that.resource = nullptr;
+}
+
+EntryList& EntryList::operator=(EntryList && that) noexcept
+{
+    if(&that == this)
+        return *this;
+    _entry_list_free(this);
+    arena = that.arena;
+    names = that.names;
+    lengths = that.lengths;
+    inodes = that.inodes;
+    types = that.types;
+    resource = that.resource;
+    that.arena = {};
+    that.names = {};
+    that.lengths = {};
+    that.inodes = {};
+    that.types = {};
+    that.resource = nullptr;
+    return *this;
+}
+
+void EntryList::sort(sort_options const& opts)
+{
+    C4_CHECK(valid());
+    const size_t num = names.required_size;
+    if(num < 2)
+        return;
+    char *const* n = names.buf;
+    size_t depth = _common_prefix(n, num);
+    if(opts.natural) // do not start in the middle of a number
+        while(depth && _is_digit(n[0][depth - 1]))
+            --depth;
+    std::vector<_SortKey> keys(num);
+    _SortKey *k = keys.data();
+    _parallel_for(num, opts, [k, n, depth](size_t first, size_t last){
+        for(size_t i = first; i < last; ++i)
+            k[i] = _SortKey{_sort_prefix(n[i] + depth), i};
+    });
+    if(opts.natural)
+    {
+        auto less = [n, depth](_SortKey const& lhs, _SortKey const& rhs){
+            return _natural_cmp(n[lhs.idx] + depth, n[rhs.idx] + depth) < 0;
+        };
+        _parallel_sort(k, num, opts, [&less](_SortKey *chunk, size_t len){
+            std::sort(chunk, chunk + len, less);
+        }, less);
+    }
+    else
+    {
+        _parallel_sort(k, num, opts, [n, depth](_SortKey *chunk, size_t len){
+            _sort_keys(chunk, len, n, depth);
+        }, [n, depth](_SortKey const& lhs, _SortKey const& rhs){
+            if(lhs.prefix != rhs.prefix)
+                return lhs.prefix < rhs.prefix;
+            if((lhs.prefix & 0xffu) == 0)
+                return false;
+            return strcmp(n[lhs.idx] + depth + 8u, n[rhs.idx] + depth + 8u) < 0;
+        });
+    }
+    std::vector<size_t> perm(num);
+    for(size_t i = 0; i < num; ++i)
+        perm[i] = keys[i].idx;
+    keys = std::vector<_SortKey>();
+    _permute(names.buf, perm);
+    _permute(lengths.buf, perm);
+    _permute(inodes.buf, perm);
+    _permute(types.buf, perm);
+}
+
+bool list_entries(const char *pathname, EntryList *C4_RESTRICT entries, maybe_buf<char> *scratch)
+{
+    entries->reset();
+    // enough for most entry names, so that the
+    // directory is scanned only once
+    size_t scratch_size = strlen(pathname) + 2u + 256u;
+    if(entries->resource && (!scratch || scratch->size < scratch_size))
+    {
+        MemoryResource *mr = entries->resource;
+        maybe_buf<char> tmp;
+        bool ok = false;
+        while(true)
+        {
+            _entry_list_alloc(mr, &tmp, scratch_size);
+            ok = walk_entries(pathname, _list_entries_visitor, &tmp, entries);
+            const bool retry = !ok && !tmp.valid();
+            scratch_size = tmp.required_size;
+            _entry_list_free(mr, &tmp);
+            if(!retry)
+                break;
+            entries->reset();
+        }
+        return ok && entries->valid();
+    }
+    scratch->reset();
+    if(!walk_entries(pathname, _list_entries_visitor, scratch, entries))
+        return false;
+    scratch->required_size = scratch->size;
+    return entries->valid() && scratch->valid();
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+void TmpRandom::seed(uint64_t seed)
+{
+    for(uint64_t &s : m_s)
+    {
+        // splitmix64
+        seed += UINT64_C(0x9e3779b97f4a7c15);
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        s = z ^ (z >> 31);
+    }
+}
+
+namespace /*anon*/ {
+
+uint64_t _tmp_seed()
+{
+    std::random_device rd;
+    uint64_t seed = rd();
+    seed = (seed << 32) ^ rd();
+    return seed;
+}
+
+thread_local TmpRandom *_tmp_random_ptr = nullptr;
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+/** the child of a fork() has only the forking thread, so only its
+ * generator needs a new seed */
+void _tmp_random_reseed_child()
+{
+    if(_tmp_random_ptr)
+        _tmp_random_ptr->seed(_tmp_seed());
+}
+#endif
+
+/** substitute each pair at the given positions by a random byte, in
+ * hexadecimal. Each draw of the generator fills 8 pairs. */
+template<class Positions>
+void _tmpnam_fill(char *buf, Positions const& positions, size_t num)
+{
+    constexpr static const char hexchars_[] = "0123456789abcdef";
+    TmpRandom &rng = tmp_random();
+    uint64_t bits = 0;
+    for(size_t i = 0; i < num; ++i)
+    {
+        if((i & 7u) == 0)
+            bits = rng();
+        const size_t pos = positions(i);
+        buf[pos    ] = hexchars_[ bits       & 0xf];
+        buf[pos + 1] = hexchars_[(bits >> 4) & 0xf];
+        bits >>= 8;
+    }
+}
+
+} // namespace anon
+
+TmpRandom& tmp_random()
+{
+    thread_local TmpRandom rng(_tmp_seed());
+    if(C4_UNLIKELY(!_tmp_random_ptr))
+    {
+        _tmp_random_ptr = &rng;
+        #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+        static const int registered = ::pthread_atfork(nullptr, nullptr, &_tmp_random_reseed_child);
+        C4_UNUSED(registered);
+        #endif
+    }
+    return rng;
+}
+
+const char* tmpnam(char *buf_, size_t bufsz, const char *fmt_, char subchar)
+{
+    const char lookup[3] = {subchar, subchar, '\0'};
+    csubstr fmt = to_csubstr(fmt_);
+    C4_CHECK(bufsz > fmt.len);
+    memcpy(buf_, fmt.str, fmt.len);
+    buf_[fmt.len] = '\0';
+    // find the substitutions on the format, and fill them in batches
+    constexpr const size_t batch = 8u;
+    size_t positions[batch];
+    size_t num = 0, total = 0;
+    auto at = [&positions](size_t i){ return positions[i]; };
+    for(size_t pos = 0; (pos = fmt.find(lookup, pos)) != csubstr::npos; pos += 2)
+    {
+        positions[num++] = pos;
+        if(num == batch)
+        {
+            _tmpnam_fill(buf_, at, num);
+            total += num;
+            num = 0;
+        }
+    }
+    _tmpnam_fill(buf_, at, num);
+    total += num;
+    C4_CHECK(total > 0);
+    return buf_;
+}
+
+const char* tmpnam(TmpPattern const& pat, char *buf, size_t bufsz)
+{
+    C4_CHECK(pat.valid());
+    C4_CHECK(bufsz > pat.len());
+    memcpy(buf, pat.fmt(), pat.len());
+    buf[pat.len()] = '\0';
+    _tmpnam_fill(buf, [&pat](size_t i){ return pat.pos(i); }, pat.num_subs());
+    return buf;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+size_t file_size(const char *filename, const char *access)
+{
+    C4_UNUSED(access);
+    path_info pi = info(filename, INFO_SIZE);
+    C4_CHECK_MSG(pi.mask & INFO_SIZE, "could not stat file %s", filename);
+    return static_cast<size_t>(pi.size);
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+int _open_for_read(const char *filename)
+{
+    int fd;
+    do {
+        fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+    } while(fd < 0 && errno == EINTR);
+    return fd;
+}
+
+/** read until @p sz bytes are read or the end of file is reached.
+ * @return the number of bytes read, or -1 on error */
+::ssize_t _read_all(int fd, char *buf, size_t sz)
+{
+    size_t pos = 0;
+    while(pos < sz)
+    {
+        ::ssize_t nread = ::read(fd, buf + pos, sz - pos);
+        if(nread > 0)
+            pos += static_cast<size_t>(nread);
+        else if(nread == 0)
+            break;
+        else if(errno != EINTR)
+            return -1;
+    }
+    return static_cast<::ssize_t>(pos);
+}
+
+/** like _read_all(), dropping the pages behind as requested */
+::ssize_t _read_all(int fd, char *buf, size_t sz, _DropBehind *db)
+{
+    if(!db->enabled)
+        return _read_all(fd, buf, sz);
+    size_t pos = 0;
+    while(pos < sz)
+    {
+        const size_t want = db->chunk(sz - pos);
+        ::ssize_t nread = _read_all(fd, buf + pos, want);
+        if(nread < 0)
+            return -1;
+        pos += static_cast<size_t>(nread);
+        db->advance(static_cast<size_t>(nread));
+        if(static_cast<size_t>(nread) < want)
+            break;
+    }
+    return static_cast<::ssize_t>(pos);
+}
+
+/** read from the offset until @p sz bytes are read or the end of
+ * file is reached.
+ * @return the number of bytes read, or -1 on error */
+::ssize_t _pread_all(int fd, char *buf, size_t sz, size_t offset)
+{
+    size_t pos = 0;
+    while(pos < sz)
+    {
+        ::ssize_t nread = ::pread(fd, buf + pos, sz - pos, static_cast<off_t>(offset + pos));
+        if(nread > 0)
+            pos += static_cast<size_t>(nread);
+        else if(nread == 0)
+            break;
+        else if(errno != EINTR)
+            return -1;
+    }
+    return static_cast<::ssize_t>(pos);
+}
+
+/** get the size of an open file, or 0 if the size is unknown (eg
+ * pipes or files in /proc)
+ * @param regular receives whether the file is a regular file: only
+ * then can a size of 0 mean an empty file */
+size_t _fd_size(int fd, bool *regular=nullptr)
+{
+    struct stat s;
+    const bool reg = ::fstat(fd, &s) == 0 && S_ISREG(s.st_mode);
+    if(regular)
+        *regular = reg;
+    return reg ? static_cast<size_t>(s.st_size) : 0;
+}
+
+} // namespace /*anon*/
+#endif
+
+size_t file_get_contents(const char *filename, char *buf, size_t sz, const char* access, int hints)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    C4_UNUSED(access);
+    int fd = _open_for_read(filename);
+    C4_CHECK_MSG(fd >= 0, "could not open file %s", filename);
+    size_t fs = _fd_size(fd);
+    bool ok = true;
+    if(fs > 0)
+    {
+        if(fs <= sz && buf != nullptr)
+        {
+            _advise_fd(fd, hints);
+            _DropBehind db(fd, hints, /*writing*/false);
+            ::ssize_t nread = _read_all(fd, buf, fs, &db);
+            ok = nread >= 0;
+            if(ok && static_cast<size_t>(nread) < fs) // the file was truncated meanwhile
+                fs = static_cast<size_t>(nread);
+            db.finish();
+        }
+    }
+    else // unknown size: read what fits, and count the rest
+    {
+        ::ssize_t nread = buf != nullptr ? _read_all(fd, buf, sz) : 0;
+        ok = nread >= 0;
+        fs = ok ? static_cast<size_t>(nread) : 0;
+        if(ok && (buf == nullptr || fs == sz))
+        {
+            char scratch[4096];
+            while((nread = _read_all(fd, scratch, sizeof(scratch))) > 0)
+                fs += static_cast<size_t>(nread);
+            ok = nread == 0;
+        }
+    }
+    ::close(fd);
+    C4_CHECK_MSG(ok, "failed to read file %s", filename);
+    return fs;
+#else
+    C4_UNUSED(hints);
+    C4_SUPPRESS_WARNING_GCC_PUSH
+    #if defined(__GNUC__) && __GNUC__ > 8
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-null-argument")
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-fclose")
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-free")
+    #endif
+    ::FILE *fp = ::fopen(filename, access);
+    C4_CHECK_MSG(fp != nullptr, "could not open file %s", filename);
+    ::fseek(fp, 0, SEEK_END);
+    const size_t fs = static_cast<size_t>(::ftell(fp));
+    ::rewind(fp);
+    if(fs <= sz && buf != nullptr)
+    {
+        if(fs != ::fread(buf, 1, fs, fp))
+        {
+            ::fclose(fp);
+            C4_ERROR("failed to read");
+        }
+    }
+    C4_CHECK(::fclose(fp) == 0);
+    C4_SUPPRESS_WARNING_GCC_POP
+    return fs;
+#endif
+}
+
+size_t file_get_contents(const char *filename, container_resizer resize, const char* access, int hints)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    C4_UNUSED(access);
+    int fd = _open_for_read(filename);
+    C4_CHECK_MSG(fd >= 0, "could not open file %s", filename);
+    _advise_fd(fd, hints);
+    _DropBehind db(fd, hints, /*writing*/false);
+    bool regular;
+    size_t fs = _fd_size(fd, &regular);
+    bool ok = true;
+    if(fs > 0)
+    {
+        char *buf = resize(fs);
+        ::ssize_t nread = _read_all(fd, buf, fs, &db);
+        ok = nread >= 0;
+        if(ok && static_cast<size_t>(nread) < fs) // the file was truncated meanwhile
+        {
+            fs = static_cast<size_t>(nread);
+            resize(fs);
+        }
+    }
+    else // unknown size: grow the container until the end of file
+    {
+        size_t capacity = 0;
+        if(regular) // most likely empty, but files in /proc report 0 too
+        {
+            // read to the stack first, to not allocate for empty files
+            char probe[512];
+            ::ssize_t nread = _read_all(fd, probe, sizeof(probe), &db);
+            ok = nread >= 0;
+            if(ok && nread > 0)
+            {
+                fs = static_cast<size_t>(nread);
+                memcpy(resize(fs), probe, fs);
+            }
+            capacity = sizeof(probe);
+        }
+        while(ok && fs == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 4096;
+            char *buf = resize(capacity);
+            ::ssize_t nread = _read_all(fd, buf + fs, capacity - fs, &db);
+            ok = nread >= 0;
+            if(ok)
+                fs += static_cast<size_t>(nread);
+        }
+        resize(fs);
+    }
+    db.finish();
+    ::close(fd);
+    C4_CHECK_MSG(ok, "failed to read file %s", filename);
+    return fs;
+#else
+    C4_UNUSED(hints);
+    C4_SUPPRESS_WARNING_GCC_PUSH
+    #if defined(__GNUC__) && __GNUC__ > 8
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-null-argument")
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-fclose")
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-free")
+    #endif
+    ::FILE *fp = ::fopen(filename, access);
+    C4_CHECK_MSG(fp != nullptr, "could not open file %s", filename);
+    ::fseek(fp, 0, SEEK_END);
+    size_t fs = static_cast<size_t>(::ftell(fp));
+    ::rewind(fp);
+    char *buf = resize(fs);
+    size_t nread = fs ? ::fread(buf, 1, fs, fp) : 0;
+    if(nread != fs) // eg, text mode in windows shrinks \r\n to \n
+    {
+        fs = nread;
+        resize(fs);
+    }
+    C4_CHECK(::fclose(fp) == 0);
+    C4_SUPPRESS_WARNING_GCC_POP
+    return fs;
+#endif
+}
+
+void file_put_contents(const char *filename, const char *buf, size_t sz, const char* access, int hints)
+{
+    C4_SUPPRESS_WARNING_GCC_PUSH
+    #if defined(__GNUC__) && __GNUC__ > 8
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-null-argument")
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-fclose")
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-free")
+    #endif
+    ::FILE *fp = ::fopen(filename, access);
+    C4_CHECK_MSG(fp != nullptr, "could not open file");
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    const int fd = ::fileno(fp);
+    _advise_fd(fd, hints);
+    // when appending, the pages to drop start at the end of the file
+    const size_t offset = strchr(access, 'a') ? _fd_size(fd) : 0;
+    _DropBehind db(fd, hints, /*writing*/true, offset);
+    bool ok = true;
+    for(size_t pos = 0; ok && pos < sz; )
+    {
+        // the chunks must reach the file before they can be dropped
+        const size_t n = db.chunk(sz - pos);
+        ok = ::fwrite(buf + pos, 1, n, fp) == n && (!db.enabled || ::fflush(fp) == 0);
+        pos += n;
+        db.advance(n);
+    }
+    if(ok)
+        db.finish();
+#else
+    C4_UNUSED(hints);
+    bool ok = sz == ::fwrite(buf, 1, sz, fp);
+#endif
+    if(!ok)
+    {
+        ::fclose(fp);
+        C4_ERROR("failed to write");
+    }
+    C4_CHECK(::fclose(fp) == 0);
+    C4_SUPPRESS_WARNING_GCC_POP
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+#ifdef IOV_MAX
+constexpr const size_t _iov_batch = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#else
+constexpr const size_t _iov_batch = 16; // the minimum required by POSIX
+#endif
+
+/** write all the slices with writev(), in batches of _iov_batch */
+bool _writev_all(int fd, slice_array slices, size_t num)
+{
+    struct iovec iov[_iov_batch];
+    size_t first = 0; // the first slice not yet fully written
+    size_t skip = 0;  // the bytes of the first slice already written
+    while(first < num)
+    {
+        size_t niov = 0;
+        size_t pending = 0;
+        for(size_t i = first; i < num && niov < _iov_batch; ++i)
+        {
+            csubstr s = slices[i];
+            const size_t offs = i == first ? skip : 0;
+            iov[niov].iov_base = const_cast<char*>(s.str) + offs;
+            iov[niov].iov_len = s.len - offs;
+            pending += iov[niov].iov_len;
+            ++niov;
+        }
+        ::ssize_t nwritten = ::writev(fd, iov, static_cast<int>(niov));
+        if(nwritten < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        if(nwritten == 0 && pending > 0)
+        {
+            errno = EIO; // no progress: do not spin
+            return false;
+        }
+        // advance past the slices which were written
+        size_t remaining = static_cast<size_t>(nwritten);
+        for(size_t i = 0; i < niov && remaining >= iov[i].iov_len; ++i)
+        {
+            remaining -= iov[i].iov_len;
+            ++first;
+            skip = 0;
+        }
+        skip += remaining;
+    }
+    return true;
+}
+
+} // namespace anon
+#endif
+
+void _file_put_slices(const char *filename, slice_array slices, size_t num_slices, const char* access)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int flags = O_WRONLY|O_CREAT|O_CLOEXEC;
+    flags |= strchr(access, 'a') ? O_APPEND : O_TRUNC;
+    if(strchr(access, 'x'))
+        flags |= O_EXCL;
+    int fd;
+    do {
+        fd = ::open(filename, flags, 0666);
+    } while(fd < 0 && errno == EINTR);
+    C4_CHECK_MSG(fd >= 0, "could not open file %s", filename);
+    bool ok = _writev_all(fd, slices, num_slices);
+    ok = (::close(fd) == 0) && ok;
+    C4_CHECK_MSG(ok, "failed to write file %s", filename);
+#else
+    C4_SUPPRESS_WARNING_GCC_PUSH
+    #if defined(__GNUC__) && __GNUC__ > 8
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-null-argument")
+    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-fclose")
+    #endif
+    ::FILE *fp = ::fopen(filename, access);
+    C4_CHECK_MSG(fp != nullptr, "could not open file %s", filename);
+    bool ok = true;
+    for(size_t i = 0; i < num_slices && ok; ++i)
+    {
+        csubstr s = slices[i];
+        ok = ::fwrite(s.str, 1, s.len, fp) == s.len;
+    }
+    ok = (::fclose(fp) == 0) && ok;
+    C4_CHECK_MSG(ok, "failed to write file %s", filename);
+    C4_SUPPRESS_WARNING_GCC_POP
+#endif
+}
+
+namespace /*anon*/ {
+csubstr _get_csubstr_slice(const void *slices, size_t i)
+{
+    return static_cast<csubstr const*>(slices)[i];
+}
+} // namespace anon
+
+void file_put_contents(const char *filename, csubstr const* slices, size_t num_slices, const char* access)
+{
+    _file_put_slices(filename, slice_array{slices, &_get_csubstr_slice}, num_slices, access);
+}
+
+
+//-----------------------------------------------------------------------------
+
+namespace /*anon*/ {
+
+/** the directory of the file, to sync it after a rename */
+std::string _parent_dir(const char *filename)
+{
+    csubstr f = to_csubstr(filename);
+#if defined(C4_WIN) || defined(__MINGW32__)
+    size_t pos = f.last_of("/\\");
+#else
+    size_t pos = f.last_of('/');
+#endif
+    if(pos == csubstr::npos)
+        return std::string(".");
+    if(pos == 0)
+        return std::string("/");
+    return std::string(f.str, pos);
+}
+
+/** write the contents to a new temporary file next to @p filename.
+ * When @p sync is true, the file's data is synced before closing it.
+ * @return false on failure, in which case the temporary file was
+ * removed */
+bool _put_sibling_tmp(const char *filename, const char *buf, size_t sz, bool sync, std::string *tmpname)
+{
+    // the suffix is generated separately: the filename may have XX in it
+    static const TmpPattern suffix_pat(".XXXXXXXX.tmp");
+    char suffix[16];
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int fd;
+    do {
+        tmpnam(suffix_pat, suffix, sizeof(suffix));
+        tmpname->assign(filename);
+        tmpname->append(suffix);
+        fd = ::open(tmpname->c_str(), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0666);
+    } while(fd < 0 && (errno == EEXIST || errno == EINTR));
+    if(fd < 0)
+        return false;
+    bool ok = _write_all(fd, buf, sz);
+    #if defined(C4_MACOS) || defined(C4_IOS)
+    ok = ok && (!sync || ::fsync(fd) == 0);
+    #else
+    ok = ok && (!sync || ::fdatasync(fd) == 0);
+    #endif
+    ok = (::close(fd) == 0) && ok;
+    if(!ok)
+        ::unlink(tmpname->c_str());
+    return ok;
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    tmpnam(suffix_pat, suffix, sizeof(suffix));
+    tmpname->assign(filename);
+    tmpname->append(suffix);
+    ::FILE *fp = ::fopen(tmpname->c_str(), "wb");
+    if(!fp)
+        return false;
+    bool ok = ::fwrite(buf, 1, sz, fp) == sz;
+    ok = ok && ::fflush(fp) == 0;
+    ok = ok && (!sync || ::_commit(::_fileno(fp)) == 0);
+    ok = (::fclose(fp) == 0) && ok;
+    if(!ok)
+        ::remove(tmpname->c_str());
+    return ok;
+#else
+    C4_NOT_IMPLEMENTED();
+    return false;
+#endif
+}
+
+/** rename the temporary file over the target */
+bool _replace_file(const char *tmpname, const char *filename, bool sync)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    C4_UNUSED(sync);
+    return ::rename(tmpname, filename) == 0;
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    DWORD flags = MOVEFILE_REPLACE_EXISTING;
+    if(sync)
+        flags |= MOVEFILE_WRITE_THROUGH;
+    return MoveFileExA(tmpname, filename, flags) != 0;
+#else
     C4_NOT_IMPLEMENTED();
+    return false;
+#endif
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+/** sync a directory, so that the renames of its entries are durable */
+bool _sync_dir(const char *dirname)
+{
+    int dfd = ::open(dirname, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(dfd < 0)
+        return false;
+    bool ok = ::fsync(dfd) == 0;
+    ::close(dfd);
+    return ok;
+}
+#endif
+
+} // namespace anon
+
+void file_put_contents_atomic(const char *filename, const char *buf, size_t sz, Durability_e durability)
+{
+    const bool sync = durability != DURABILITY_NONE;
+    std::string tmpname;
+    C4_CHECK_MSG(_put_sibling_tmp(filename, buf, sz, sync, &tmpname), "could not write a temporary file for %s", filename);
+    if(!_replace_file(tmpname.c_str(), filename, sync))
+    {
+        rmfile(tmpname.c_str());
+        C4_ERROR("could not replace file %s", filename);
+    }
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    if(sync)
+        C4_CHECK_MSG(_sync_dir(_parent_dir(filename).c_str()), "could not sync the directory of %s", filename);
+#endif
+}
+
+
+struct AtomicWriteBatch::_Impl
+{
+    struct _Write
+    {
+        std::string filename;
+        std::string tmpname;
+    };
+
+    Durability_e m_durability;
+    mutable std::mutex m_mtx;
+    std::vector<_Write> m_pending;
+};
+
+AtomicWriteBatch::AtomicWriteBatch(Durability_e durability)
+    : m_impl(new _Impl)
+{
+    m_impl->m_durability = durability;
+}
+
+AtomicWriteBatch::~AtomicWriteBatch()
+{
+    discard();
+    delete m_impl;
+}
+
+void AtomicWriteBatch::put(const char *filename, const char *buf, size_t sz)
+{
+    _Impl::_Write w;
+    w.filename = filename;
+    // without syncfs(), the group is synced file by file
+#if defined(C4_LINUX)
+    const bool sync = m_impl->m_durability == DURABILITY_FILE;
+#else
+    const bool sync = m_impl->m_durability != DURABILITY_NONE;
+#endif
+    C4_CHECK_MSG(_put_sibling_tmp(filename, buf, sz, sync, &w.tmpname), "could not write a temporary file for %s", filename);
+    std::lock_guard<std::mutex> lock(m_impl->m_mtx);
+    m_impl->m_pending.emplace_back(std::move(w));
+}
+
+void AtomicWriteBatch::commit()
+{
+    std::vector<_Impl::_Write> writes;
+    {
+        std::lock_guard<std::mutex> lock(m_impl->m_mtx);
+        writes.swap(m_impl->m_pending);
+    }
+    if(writes.empty())
+        return;
+    const bool sync = m_impl->m_durability != DURABILITY_NONE;
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    std::vector<std::string> dirs;
+    std::vector<int> dfds;
+    auto close_dfds = [&dfds]{
+        for(int dfd : dfds)
+            ::close(dfd);
+        dfds.clear();
+    };
+    // nothing was replaced yet: drop the whole batch
+    auto abort_commit = [&]{
+        close_dfds();
+        for(_Impl::_Write const& w : writes)
+            rmfile(w.tmpname.c_str());
+    };
+    if(sync)
+    {
+        for(_Impl::_Write const& w : writes)
+            dirs.emplace_back(_parent_dir(w.filename.c_str()));
+        std::sort(dirs.begin(), dirs.end());
+        dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+        for(std::string const& dir : dirs)
+        {
+            int dfd = ::open(dir.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+            if(dfd < 0)
+            {
+                abort_commit();
+                C4_ERROR("could not open directory %s", dir.c_str());
+            }
+            dfds.push_back(dfd);
+        }
+    }
+    #if defined(C4_LINUX)
+    // flush the data of all the temporary files, once per filesystem
+    if(m_impl->m_durability == DURABILITY_GROUP)
+    {
+        std::vector<dev_t> synced;
+        for(int dfd : dfds)
+        {
+            struct stat s;
+            if(::fstat(dfd, &s) != 0)
+            {
+                const int err = errno;
+                abort_commit();
+                C4_ERROR("fstat() failed: %d", err);
+            }
+            if(std::find(synced.begin(), synced.end(), s.st_dev) != synced.end())
+                continue;
+            if(::syncfs(dfd) != 0)
+            {
+                const int err = errno;
+                abort_commit();
+                C4_ERROR("syncfs() failed: %d", err);
+            }
+            synced.push_back(s.st_dev);
+        }
+    }
+    #endif
+#endif
+    std::string failed;
+    for(_Impl::_Write const& w : writes)
+    {
+        if(!_replace_file(w.tmpname.c_str(), w.filename.c_str(), sync))
+        {
+            rmfile(w.tmpname.c_str());
+            if(!failed.empty())
+                failed.append(", ");
+            failed.append(w.filename);
+        }
+    }
+    bool synced = true;
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    for(int dfd : dfds)
+        synced = (::fsync(dfd) == 0) && synced;
+    close_dfds();
+#endif
+    if(!failed.empty())
+        C4_ERROR("could not replace: %s (the other files of the batch were replaced)", failed.c_str());
+    C4_CHECK_MSG(synced, "the batch was replaced, but its directories could not be synced");
+}
+
+void AtomicWriteBatch::discard()
+{
+    std::vector<_Impl::_Write> writes;
+    {
+        std::lock_guard<std::mutex> lock(m_impl->m_mtx);
+        writes.swap(m_impl->m_pending);
+    }
+    for(_Impl::_Write const& w : writes)
+        rmfile(w.tmpname.c_str());
+}
+
+size_t AtomicWriteBatch::pending() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->m_mtx);
+    return m_impl->m_pending.size();
+}
+
+
+namespace /*anon*/ {
+
+/** the number of files handled by each task of read_many() */
+constexpr const size_t _read_many_group_size = 16;
+/** the maximum number of files kept open by read_many() between
+ * sizing and reading them; the others are opened twice */
+constexpr const size_t _read_many_max_fds = 256;
+
+struct _ReadSlot
+{
+    int64_t size; //!< -1 if the file cannot be read
+    int fd;       //!< -1 if the file was closed after sizing it
+};
+
+void _size_slot(const char *filename, _ReadSlot *slot, std::atomic<size_t> *num_fds)
+{
+    slot->size = -1;
+    slot->fd = -1;
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int fd = _open_for_read(filename);
+    if(fd < 0)
+        return;
+    struct stat s;
+    if(::fstat(fd, &s) != 0 || !S_ISREG(s.st_mode))
+    {
+        ::close(fd);
+        return;
+    }
+    slot->size = static_cast<int64_t>(s.st_size);
+    if(num_fds->fetch_add(1) < _read_many_max_fds)
+        slot->fd = fd;
+    else
+        ::close(fd);
+#else
+    C4_UNUSED(num_fds);
+    path_info pi = info(filename, INFO_TYPE|INFO_SIZE);
+    if(pi.exists() && pi.type == REGFILE)
+        slot->size = static_cast<int64_t>(pi.size);
+#endif
+}
+
+/** read the file into its slot, updating the slot size with the
+ * number of bytes read */
+void _read_slot(const char *filename, _ReadSlot *slot, char *buf)
+{
+    const size_t sz = static_cast<size_t>(slot->size);
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int fd = slot->fd >= 0 ? slot->fd : _open_for_read(filename);
+    if(fd < 0)
+    {
+        slot->size = -1;
+        return;
+    }
+    ::ssize_t nread = sz ? _pread_all(fd, buf, sz, 0) : 0;
+    ::close(fd);
+    slot->size = static_cast<int64_t>(nread);
+#else
+    ::FILE *fp = ::fopen(filename, default_read_access);
+    if(!fp)
+    {
+        slot->size = -1;
+        return;
+    }
+    size_t nread = sz ? ::fread(buf, 1, sz, fp) : 0;
+    bool ok = nread == sz || !::ferror(fp);
+    ::fclose(fp);
+    slot->size = ok ? static_cast<int64_t>(nread) : -1;
+#endif
+}
+
+} // namespace anon
+
+size_t read_many(const char *const* paths, size_t num, container_resizer arena, csubstr *spans, size_t num_threads)
+{
+    std::vector<_ReadSlot> slots(num);
+    _ReadSlot *sl = slots.data();
+    const size_t num_groups = (num + _read_many_group_size - 1) / _read_many_group_size;
+    num_threads = _num_threads(num_threads);
+    _WorkPool pool(num_groups < num_threads ? (num_groups ? num_groups : 1u) : num_threads);
+    // first pass: open and size the files
+    std::atomic<size_t> num_fds(0);
+    std::atomic<size_t> *nfds = &num_fds;
+    for(size_t first = 0; first < num; first += _read_many_group_size)
+    {
+        size_t last = first + _read_many_group_size < num ? first + _read_many_group_size : num;
+        pool.push(0, [paths, sl, nfds, first, last](size_t){
+            for(size_t i = first; i < last; ++i)
+                _size_slot(paths[i], sl + i, nfds);
+        });
+    }
+    pool.run();
+    std::vector<size_t> offsets(num);
+    size_t total = 0;
+    for(size_t i = 0; i < num; ++i)
+    {
+        offsets[i] = total;
+        if(slots[i].size > 0)
+            total += static_cast<size_t>(slots[i].size);
+    }
+    char *base = arena(total);
+    // second pass: read each file into its slot
+    size_t const* offs = offsets.data();
+    for(size_t first = 0; first < num; first += _read_many_group_size)
+    {
+        size_t last = first + _read_many_group_size < num ? first + _read_many_group_size : num;
+        pool.push(0, [paths, sl, offs, base, first, last](size_t){
+            for(size_t i = first; i < last; ++i)
+                if(sl[i].size >= 0)
+                    _read_slot(paths[i], sl + i, base + offs[i]);
+        });
+    }
+    pool.run();
+    for(size_t i = 0; i < num; ++i)
+    {
+        if(sl[i].size < 0)
+            spans[i] = csubstr{};
+        else if(base)
+            spans[i] = csubstr(base + offs[i], static_cast<size_t>(sl[i].size));
+        else // all the files are empty
+            spans[i] = csubstr("", size_t(0));
+    }
+    return total;
+}
+
+
+//-----------------------------------------------------------------------------
+
+void* alloc_direct_buffer(size_t sz)
+{
+    return c4::aalloc(sz, direct_io_alignment);
+}
+
+void free_direct_buffer(void *buf)
+{
+    if(buf)
+        c4::afree(buf);
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+namespace /*anon*/ {
+
+/** the largest bounce buffer used for unaligned transfers */
+constexpr const size_t _direct_bounce_size = size_t(1) << 20;
+
+/** an aligned buffer, freed when leaving the scope */
+struct _DirectBuffer
+{
+    char *buf;
+    size_t size;
+    explicit _DirectBuffer(size_t sz) : buf(static_cast<char*>(alloc_direct_buffer(sz))), size(sz) {}
+    ~_DirectBuffer() { free_direct_buffer(buf); }
+    _DirectBuffer(_DirectBuffer const&) = delete;
+    _DirectBuffer& operator=(_DirectBuffer const&) = delete;
+};
+
+bool _is_direct_aligned(const void *p)
+{
+    return (reinterpret_cast<uintptr_t>(p) & (direct_io_alignment - 1)) == 0;
+}
+
+/** open the file for uncached I/O. When the filesystem rejects
+ * O_DIRECT (eg tmpfs in older kernels), the file is opened normally */
+int _open_direct(const char *filename, int flags)
+{
+    int fd;
+#ifdef O_DIRECT
+    do {
+        fd = ::open(filename, flags | O_DIRECT | O_CLOEXEC, 0666);
+    } while(fd < 0 && errno == EINTR);
+    if(fd >= 0 || errno != EINVAL)
+        return fd;
+#endif
+    do {
+        fd = ::open(filename, flags | O_CLOEXEC, 0666);
+    } while(fd < 0 && errno == EINTR);
+#ifdef F_NOCACHE
+    if(fd >= 0)
+        ::fcntl(fd, F_NOCACHE, 1);
+#endif
+    return fd;
+}
+
+/** turn off O_DIRECT after the kernel rejected a transfer, which
+ * happens when the device's block size is larger than
+ * direct_io_alignment.
+ * @return true if O_DIRECT was on */
+bool _drop_direct(int fd)
+{
+#ifdef O_DIRECT
+    int flags = ::fcntl(fd, F_GETFL);
+    return flags >= 0 && (flags & O_DIRECT) && ::fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0;
+#else
+    C4_UNUSED(fd);
+    return false;
 #endif
 }
 
+/** drop the pages of the file which were cached because direct I/O
+ * was not available */
+void _drop_cached(int fd)
+{
+#if defined(C4_LINUX)
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    C4_UNUSED(fd);
+#endif
+}
 
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
+::ssize_t _pread_direct(int fd, char *buf, size_t sz, size_t offset)
+{
+    ::ssize_t nread = _pread_all(fd, buf, sz, offset);
+    if(nread < 0 && errno == EINVAL && _drop_direct(fd))
+        nread = _pread_all(fd, buf, sz, offset);
+    return nread;
+}
 
-char *cwd(char *buf, size_t sz)
+/** write all the bytes at the offset, retrying on short writes and EINTR */
+bool _pwrite_all(int fd, const char *buf, size_t sz, size_t offset)
+{
+    size_t pos = 0;
+    while(pos < sz)
+    {
+        ::ssize_t nwritten = ::pwrite(fd, buf + pos, sz - pos, static_cast<off_t>(offset + pos));
+        if(nwritten >= 0)
+            pos += static_cast<size_t>(nwritten);
+        else if(errno != EINTR)
+            return false;
+    }
+    return true;
+}
+
+bool _pwrite_direct(int fd, const char *buf, size_t sz, size_t offset)
+{
+    if(_pwrite_all(fd, buf, sz, offset))
+        return true;
+    return errno == EINVAL && _drop_direct(fd) && _pwrite_all(fd, buf, sz, offset);
+}
+
+} // namespace anon
+#endif
+
+size_t file_get_contents_direct(const char *filename, container_resizer resize)
 {
-    C4_ASSERT(sz > 0);
 #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-    return ::getcwd(buf, sz);
-#elif defined(C4_WIN) || defined(__MINGW32__)
-    return ::getcwd(buf, (int)sz);
+    int fd = _open_direct(filename, O_RDONLY);
+    C4_CHECK_MSG(fd >= 0, "could not open file %s", filename);
+    const size_t fs = _fd_size(fd);
+    if(fs == 0) // empty, or of unknown size
+    {
+        ::close(fd);
+        return file_get_contents(filename, resize);
+    }
+    char *buf = resize(fs);
+    const size_t body = fs & ~(direct_io_alignment - 1); // the whole blocks
+    const bool aligned = _is_direct_aligned(buf);
+    size_t pos = 0;
+    ::ssize_t nread = 0;
+    if(aligned && body > 0)
+    {
+        nread = _pread_direct(fd, buf, body, 0);
+        if(nread > 0)
+            pos = static_cast<size_t>(nread);
+    }
+    if(nread >= 0 && pos < fs)
+    {
+        // the rest goes through the bounce buffer. The tail is read
+        // as a whole block, which is cut short by the end of file.
+        _DirectBuffer bounce(aligned ? direct_io_alignment : std::min(direct_io_size(fs), _direct_bounce_size));
+        while(pos < fs)
+        {
+            const size_t want = std::min(direct_io_size(fs - pos), bounce.size);
+            nread = _pread_direct(fd, bounce.buf, want, pos);
+            if(nread <= 0)
+                break;
+            const size_t n = std::min(static_cast<size_t>(nread), fs - pos);
+            memcpy(buf + pos, bounce.buf, n);
+            pos += n;
+            if(static_cast<size_t>(nread) < want) // end of file
+                break;
+        }
+    }
+    const bool ok = nread >= 0;
+    _drop_cached(fd);
+    ::close(fd);
+    C4_CHECK_MSG(ok, "failed to read file %s", filename);
+    if(pos < fs) // the file was truncated meanwhile
+        resize(pos);
+    return pos;
 #else
-    C4_NOT_IMPLEMENTED();
-    return nullptr;
+    return file_get_contents(filename, resize);
+#endif
+}
+
+void file_put_contents_direct(const char *filename, const char *buf, size_t sz)
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int fd = _open_direct(filename, O_WRONLY|O_CREAT|O_TRUNC);
+    C4_CHECK_MSG(fd >= 0, "could not open file %s", filename);
+    const size_t body = sz & ~(direct_io_alignment - 1); // the whole blocks
+    bool ok = true;
+    size_t pos = 0;
+    if(_is_direct_aligned(buf) && body > 0)
+    {
+        ok = _pwrite_direct(fd, buf, body, 0);
+        pos = body;
+    }
+    if(ok && pos < sz)
+    {
+        // the rest goes through the bounce buffer. The tail is padded
+        // with zeros to a whole block, and then cut from the file.
+        _DirectBuffer bounce(std::min(direct_io_size(sz - pos), _direct_bounce_size));
+        while(ok && pos < sz)
+        {
+            const size_t n = std::min(sz - pos, bounce.size);
+            const size_t nblk = direct_io_size(n);
+            memcpy(bounce.buf, buf + pos, n);
+            memset(bounce.buf + n, 0, nblk - n);
+            ok = _pwrite_direct(fd, bounce.buf, nblk, pos);
+            pos += n;
+        }
+        if(ok && sz != body)
+            ok = ::ftruncate(fd, static_cast<off_t>(sz)) == 0;
+    }
+    _drop_cached(fd);
+    ok = (::close(fd) == 0) && ok;
+    C4_CHECK_MSG(ok, "failed to write file %s", filename);
+#else
+    file_put_contents(filename, buf, sz);
 #endif
 }
 
@@ -484,305 +4754,913 @@ char *cwd(char *buf, size_t sz)
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 
-bool walk_entries(const char *pathname, FileVisitor fn, maybe_buf<char> *buf, void *user_data)
+bool file_read_chunks(const char *filename, maybe_buf<char> *scratch, ChunkVisitor fn, void *user_data)
 {
-    C4_CHECK(is_dir(pathname));
-    C4_CHECK((buf->buf == nullptr) == (buf->size == 0));
-    csubstr base = to_csubstr(pathname);
-    size_t base_size = (base.len + 1/* / */) + 1/* \0 */;
-    substr namebuf(buf->buf, buf->size);
-    size_t maxlen = 0;
-    C4_ASSERT(!namebuf.overlaps(base));
-    buf->required_size = base_size;
-    _c4fs_dbgf("base=~~~{}~~~ reqsz={}", base, buf->required_size);
-    VisitedFile vp;
-    vp.user_data = user_data;
-    vp.name = namebuf.str;
+    C4_CHECK((scratch->buf == nullptr) == (scratch->size == 0));
+    if(scratch->size == 0)
+    {
+        scratch->required_size = default_chunk_size;
+        return false;
+    }
+    scratch->required_size = 1;
+    VisitedChunk chunk;
+    chunk.offset = 0;
+    chunk.user_data = user_data;
+    bool ok = true;
 #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-    if(buf->valid())
+    int fd = _open_for_read(filename);
+    C4_CHECK_MSG(fd >= 0, "could not open file %s", filename);
+    #if defined(C4_LINUX)
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    #endif
+    while(true)
     {
-        memcpy(namebuf.str, base.str, base.len);
-        namebuf[base.len] = '/';
+        ::ssize_t nread = _read_all(fd, scratch->buf, scratch->size);
+        if(nread <= 0)
+        {
+            ok = nread == 0;
+            break;
+        }
+        chunk.data = csubstr(scratch->buf, static_cast<size_t>(nread));
+        if(fn(chunk) != 0)
+            break;
+        chunk.offset += chunk.data.len;
+        if(chunk.data.len < scratch->size)
+            break;
     }
+    ::close(fd);
+#else
     C4_SUPPRESS_WARNING_GCC_PUSH
     #if defined(__GNUC__) && __GNUC__ > 8
-    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-malloc-leak")
     C4_SUPPRESS_WARNING_GCC("-Wanalyzer-null-argument")
     #endif
-    ::DIR *dir = opendir(pathname);
-    C4_CHECK(dir);
-    struct dirent *entry;
-    while((entry = readdir(dir)) != nullptr)
-    C4_SUPPRESS_WARNING_GCC_POP
+    ::FILE *fp = ::fopen(filename, default_read_access);
+    C4_CHECK_MSG(fp != nullptr, "could not open file %s", filename);
+    while(true)
     {
-        if(strcmp(entry->d_name, ".") == 0)
-            continue;
-        if(strcmp(entry->d_name, "..") == 0)
-            continue;
-        csubstr entry_name = to_csubstr((const char*)entry->d_name);
-        maxlen = entry_name.len > maxlen ? entry_name.len : maxlen;
-        buf->required_size = base_size + maxlen + 1;
-        _c4fs_dbgf("base=[{}]~~~{}~~~ entry=[{}]~~~{}~~~ valid={} maxlen={}",
-                   base.len, base, entry_name.len, entry_name, buf->valid(), maxlen);
-        if(buf->valid())
+        size_t nread = ::fread(scratch->buf, 1, scratch->size, fp);
+        if(nread == 0)
         {
-            substr after_slash = namebuf.sub(base.len + 1);
-            memcpy(after_slash.str, entry_name.str, entry_name.len);
-            after_slash[entry_name.len] = '\0';
-            vp.dirent_data = entry;
-            if(fn(vp) != 0)
-                break;
+            ok = !::ferror(fp);
+            break;
         }
+        chunk.data = csubstr(scratch->buf, nread);
+        if(fn(chunk) != 0)
+            break;
+        chunk.offset += nread;
+        if(nread < scratch->size)
+            break;
     }
-    closedir(dir);
-#elif defined(C4_WIN) || defined(__MINGW32__)
-    base_size = base.len + 4;
-    buf->required_size = base_size;
-    if(!buf->valid())
+    ::fclose(fp);
+    C4_SUPPRESS_WARNING_GCC_POP
+#endif
+    C4_CHECK_MSG(ok, "failed to read file %s", filename);
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+// the io_uring ops used here were all available in linux 5.11, which
+// also added IORING_FEAT_EXT_ARG; the op enumerators are not macros,
+// so they cannot be tested directly
+#if defined(C4_LINUX) && defined(C4FS_STATX) && defined(IORING_FEAT_EXT_ARG) && defined(__NR_io_uring_setup)
+#define C4FS_IO_URING
+#endif
+
+namespace /*anon*/ {
+
+/** the largest transfer of a single read or write */
+constexpr const size_t _max_async_transfer = size_t(1) << 30;
+
+struct _AsyncReq
+{
+    AsyncOp_e     op;
+    AsyncCallback cb;
+    void         *user_data;
+    int           fd;
+    int           flags;
+    unsigned      mode;
+    const char   *path;
+    void         *buf;
+    size_t        size;
+    uint64_t      offset;
+    int           mask;
+    path_info    *info;
+    int64_t       result;
+#ifdef C4FS_IO_URING
+    struct statx  stx;
+#endif
+};
+
+/** run the operation with the blocking calls */
+void _async_exec(_AsyncReq *req)
+{
+    int64_t res = 0;
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    switch(req->op)
     {
-        // if the buffer cannot accomodate the base_size,
-        // we cannot open the directory to iterate.
-        // To be safer, let's require 64 characters for appending
-        // the filenames.
-        buf->required_size += 64u;
-        return false;
+    case ASYNC_OPEN:
+        do {
+            res = ::open(req->path, req->flags, static_cast<mode_t>(req->mode));
+        } while(res < 0 && errno == EINTR);
+        break;
+    case ASYNC_READ:
+        do {
+            res = ::pread(req->fd, req->buf, req->size, static_cast<off_t>(req->offset));
+        } while(res < 0 && errno == EINTR);
+        break;
+    case ASYNC_WRITE:
+        do {
+            res = ::pwrite(req->fd, req->buf, req->size, static_cast<off_t>(req->offset));
+        } while(res < 0 && errno == EINTR);
+        break;
+    case ASYNC_STAT:
+        *req->info = path_info{};
+        req->info->type = INVALID;
+        _info_at(AT_FDCWD, req->path, req->mask, req->info);
+        res = req->info->exists() ? 0 : -1;
+        break;
+    case ASYNC_UNLINK:
+        res = ::unlink(req->path);
+        break;
+    case ASYNC_CLOSE:
+        res = ::close(req->fd);
+        break;
     }
-    memcpy(namebuf.str, base.str, base.len);
-    memcpy(namebuf.str + base.len, "\\*\0", 3);
-    WIN32_FIND_DATAA ffd = {};
-    HANDLE hFindFile = FindFirstFileA(namebuf.str, &ffd);
-    C4_CHECK(hFindFile != INVALID_HANDLE_VALUE);
-    namebuf[base.len] = '/';
-    vp.find_file_data = &ffd;
-    while(FindNextFileA(hFindFile, &ffd))
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    switch(req->op)
     {
-        if(!strcmp(ffd.cFileName, "."))
-            continue;
-        if(!strcmp(ffd.cFileName, ".."))
-            continue;
-        csubstr entry_name = to_csubstr((const char*)ffd.cFileName);
-        maxlen = entry_name.len > maxlen ? entry_name.len : maxlen;
-        buf->required_size = base_size + maxlen + 1;
-        if(buf->valid())
-        {
-            substr after_slash = namebuf.sub(base.len + 1);
-            memcpy(after_slash.str, entry_name.str, entry_name.len);
-            after_slash[entry_name.len] = '\0';
-            if(fn(vp) != 0)
-                break;
-        }
+    case ASYNC_OPEN:
+        res = ::_open(req->path, req->flags, static_cast<int>(req->mode));
+        break;
+    case ASYNC_READ:
+    case ASYNC_WRITE:
+    {
+        // there is no positional read/write: the seek and the
+        // transfer must not be interleaved with those of other threads
+        static std::mutex mtx;
+        std::lock_guard<std::mutex> lock(mtx);
+        unsigned sz = static_cast<unsigned>(req->size);
+        if(::_lseeki64(req->fd, static_cast<__int64>(req->offset), SEEK_SET) < 0)
+            res = -1;
+        else if(req->op == ASYNC_READ)
+            res = ::_read(req->fd, req->buf, sz);
+        else
+            res = ::_write(req->fd, req->buf, sz);
+        break;
+    }
+    case ASYNC_STAT:
+        *req->info = info(req->path, req->mask);
+        res = req->info->exists() ? 0 : -1;
+        break;
+    case ASYNC_UNLINK:
+        res = ::_unlink(req->path);
+        break;
+    case ASYNC_CLOSE:
+        res = ::_close(req->fd);
+        break;
     }
-    FindClose(hFindFile);
 #else
-#error unknown platform
+    C4_NOT_IMPLEMENTED();
 #endif
-    return buf->valid();
+    req->result = res < 0 ? -static_cast<int64_t>(errno) : res;
 }
 
-PathVisitor wtf; // fixme
-#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-int _path_visitor_adapter(const char *name, const struct stat *stat_data, int ftw_info, struct FTW *ftw_data)
+#ifdef C4FS_IO_URING
+/** a minimal io_uring, set up directly with the syscalls */
+class _Uring
 {
-    VisitedPath vp;
-    vp.name = name;
-    vp.user_data = nullptr; // fixme
-    vp.stat_data = stat_data;
-    vp.ftw_info = ftw_info;
-    vp.ftw_data = ftw_data;
-    return wtf(vp);
+public:
+
+    _Uring()
+        : m_fd(-1)
+        , m_sq_ptr(MAP_FAILED), m_sq_size(0)
+        , m_cq_ptr(MAP_FAILED), m_cq_size(0)
+        , m_sqes(nullptr), m_sqes_size(0)
+        , m_sq_head(nullptr), m_sq_tail(nullptr), m_sq_mask(0), m_sq_entries(0)
+        , m_cq_head(nullptr), m_cq_tail(nullptr), m_cq_mask(0)
+        , m_cqes(nullptr)
+        , m_tail(0)
+        , m_to_submit(0)
+    {
+    }
+
+    ~_Uring()
+    {
+        if(m_sqes)
+            ::munmap(m_sqes, m_sqes_size);
+        if(m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+            ::munmap(m_cq_ptr, m_cq_size);
+        if(m_sq_ptr != MAP_FAILED)
+            ::munmap(m_sq_ptr, m_sq_size);
+        if(m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    _Uring(_Uring const&) = delete;
+    _Uring& operator=(_Uring const&) = delete;
+
+    /** @return false if the kernel does not provide io_uring, or
+     * does not support all the ops */
+    bool init(unsigned entries)
+    {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if(m_fd < 0)
+            return false;
+        m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if(single_mmap)
+            m_sq_size = m_cq_size = m_sq_size > m_cq_size ? m_sq_size : m_cq_size;
+        m_sq_ptr = ::mmap(nullptr, m_sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_fd, static_cast<off_t>(IORING_OFF_SQ_RING));
+        if(m_sq_ptr == MAP_FAILED)
+            return false;
+        if(single_mmap)
+            m_cq_ptr = m_sq_ptr;
+        else
+        {
+            m_cq_ptr = ::mmap(nullptr, m_cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_fd, static_cast<off_t>(IORING_OFF_CQ_RING));
+            if(m_cq_ptr == MAP_FAILED)
+                return false;
+        }
+        m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqes = ::mmap(nullptr, m_sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_fd, static_cast<off_t>(IORING_OFF_SQES));
+        if(sqes == MAP_FAILED)
+            return false;
+        m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+        char *sq = static_cast<char*>(m_sq_ptr);
+        char *cq = static_cast<char*>(m_cq_ptr);
+        m_sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        m_sq_entries = p.sq_entries;
+        m_cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+        // use the sqes in ring order
+        unsigned *array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        for(unsigned i = 0; i < p.sq_entries; ++i)
+            array[i] = i;
+        m_tail = *m_sq_tail;
+        return _probe();
+    }
+
+    unsigned sq_entries() const { return m_sq_entries; }
+
+    /** @return a zeroed sqe, or null if the submission queue is full */
+    struct io_uring_sqe* get_sqe()
+    {
+        unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if(m_tail - head >= m_sq_entries)
+            return nullptr;
+        struct io_uring_sqe *sqe = &m_sqes[m_tail & m_sq_mask];
+        ++m_tail;
+        ++m_to_submit;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    /** submit the new sqes, and optionally wait for a completion */
+    void enter(bool wait)
+    {
+        __atomic_store_n(m_sq_tail, m_tail, __ATOMIC_RELEASE);
+        if(!m_to_submit && !wait)
+            return;
+        long ret;
+        do {
+            ret = ::syscall(__NR_io_uring_enter, m_fd, m_to_submit, wait ? 1u : 0u, wait ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+        } while(ret < 0 && errno == EINTR);
+        C4_CHECK_MSG(ret >= 0, "io_uring_enter() failed: %d", errno);
+        m_to_submit -= static_cast<unsigned>(ret);
+    }
+
+    /** call fn(user_data, res) for each of the available completions */
+    template<class Fn>
+    size_t reap(Fn &&fn)
+    {
+        unsigned head = *m_cq_head; // only written by us
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        size_t num = 0;
+        for( ; head != tail; ++head, ++num)
+        {
+            struct io_uring_cqe const& cqe = m_cqes[head & m_cq_mask];
+            fn(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        return num;
+    }
+
+private:
+
+    bool _probe()
+    {
+        // the probe ends with a flexible array member, so the ops
+        // are reached past the end of the struct
+        constexpr const unsigned num_ops = 256;
+        alignas(struct io_uring_probe) char buf[sizeof(struct io_uring_probe) + num_ops * sizeof(struct io_uring_probe_op)];
+        memset(buf, 0, sizeof(buf));
+        if(::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, buf, num_ops) < 0)
+            return false;
+        auto const* probe = reinterpret_cast<struct io_uring_probe const*>(buf);
+        auto const* ops = reinterpret_cast<struct io_uring_probe_op const*>(buf + sizeof(struct io_uring_probe));
+        const unsigned required[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_STATX, IORING_OP_UNLINKAT, IORING_OP_CLOSE};
+        for(unsigned op : required)
+            if(op > probe->last_op || op >= probe->ops_len || !(ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        return true;
+    }
+
+    int m_fd;
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+    unsigned m_tail;      //!< the sq tail, including the sqes not yet published
+    unsigned m_to_submit; //!< the sqes not yet consumed by the kernel
+};
+
+void _uring_prep(struct io_uring_sqe *sqe, _AsyncReq *req)
+{
+    sqe->user_data = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(req));
+    switch(req->op)
+    {
+    case ASYNC_OPEN:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(req->path);
+        sqe->len = req->mode;
+        sqe->open_flags = static_cast<uint32_t>(req->flags);
+        break;
+    case ASYNC_READ:
+    case ASYNC_WRITE:
+        sqe->opcode = req->op == ASYNC_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = req->fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(req->buf);
+        sqe->len = static_cast<uint32_t>(req->size);
+        sqe->off = req->offset;
+        break;
+    case ASYNC_STAT:
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(req->path);
+        sqe->len = _statx_mask(req->mask);
+        sqe->off = reinterpret_cast<uintptr_t>(&req->stx);
+        break;
+    case ASYNC_UNLINK:
+        sqe->opcode = IORING_OP_UNLINKAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(req->path);
+        break;
+    case ASYNC_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = req->fd;
+        break;
+    }
 }
-#elif defined(C4_WIN) || defined(__MINGW32__)
-int _walk_tree(PathVisitor fn, void *user_data, substr namebuf, size_t namelen)
+#endif // C4FS_IO_URING
+
+} // namespace anon
+
+
+struct AsyncEngine::_Impl
 {
-    int exit_status = 0;
-    VisitedPath vp;
-    vp.user_data = user_data;
-    vp.name = namebuf.str;
-    if(namebuf.len < namelen + 4)
-        return ENAMETOOLONG;
-    WIN32_FIND_DATAA ffd = {};
-    memcpy(namebuf.str + namelen, "\\*\0", 3);
-    HANDLE hFindFile = FindFirstFileA(namebuf.str, &ffd);
-    C4_CHECK(hFindFile != INVALID_HANDLE_VALUE);
-    namebuf[namelen] = '/';
-    substr filenamebuf = namebuf.sub(namelen + 1);
-    vp.find_file_data = &ffd;
-    while(FindNextFileA(hFindFile, &ffd))
+    size_t m_depth;
+    size_t m_in_flight;
+    std::deque<_AsyncReq> m_reqs; //!< a deque keeps the addresses stable
+    std::vector<_AsyncReq*> m_free;
+    std::deque<_AsyncReq*> m_queued;
+    std::vector<_AsyncReq*> m_completed;
+#ifdef C4FS_IO_URING
+    std::unique_ptr<_Uring> m_ring;
+#endif
+    // without io_uring, the blocking calls are run by a pool of
+    // threads, started on the first submission
+    size_t m_num_threads;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mtx;
+    std::condition_variable m_work_cv;
+    std::condition_variable m_done_cv;
+    std::deque<_AsyncReq*> m_work;
+    std::vector<_AsyncReq*> m_done;
+    bool m_stop;
+
+    explicit _Impl(async_options const& opts)
+        : m_depth(opts.queue_depth ? opts.queue_depth : 1u)
+        , m_in_flight(0)
+        , m_reqs()
+        , m_free()
+        , m_queued()
+        , m_completed()
+#ifdef C4FS_IO_URING
+        , m_ring()
+#endif
+        , m_num_threads(_num_threads(opts.num_threads))
+        , m_threads()
+        , m_mtx()
+        , m_work_cv()
+        , m_done_cv()
+        , m_work()
+        , m_done()
+        , m_stop(false)
     {
-        if(!strcmp(ffd.cFileName, "."))
-            continue;
-        if(!strcmp(ffd.cFileName, ".."))
-            continue;
-        csubstr entry_name = to_csubstr((const char*)ffd.cFileName);
-        if(filenamebuf.len < entry_name.len + 2)
+#ifdef C4FS_IO_URING
+        if(opts.use_io_uring)
         {
-            exit_status = ENAMETOOLONG;
-            break;
+            constexpr const size_t max_entries = 4096;
+            std::unique_ptr<_Uring> ring(new _Uring);
+            if(ring->init(static_cast<unsigned>(m_depth < max_entries ? m_depth : max_entries)))
+            {
+                // the completion queue has room for twice as many
+                // entries, so it cannot overflow
+                if(m_depth > ring->sq_entries())
+                    m_depth = ring->sq_entries();
+                m_ring = std::move(ring);
+            }
         }
-        memcpy(filenamebuf.str, entry_name.str, entry_name.len);
-        filenamebuf[entry_name.len] = '\0';
-        if(ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+#endif
+    }
+
+    ~_Impl()
+    {
         {
-            int ret = _walk_tree(fn, user_data, namebuf, namelen + 1 + entry_name.len);
-            if(ret)
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_stop = true;
+        }
+        m_work_cv.notify_all();
+        for(std::thread &t : m_threads)
+            t.join();
+    }
+
+    _AsyncReq* push(AsyncOp_e op, AsyncCallback cb, void *user_data)
+    {
+        _AsyncReq *req;
+        if(!m_free.empty())
+        {
+            req = m_free.back();
+            m_free.pop_back();
+        }
+        else
+        {
+            m_reqs.emplace_back();
+            req = &m_reqs.back();
+        }
+        req->op = op;
+        req->cb = cb;
+        req->user_data = user_data;
+        req->result = 0;
+        m_queued.push_back(req);
+        return req;
+    }
+
+    size_t pending() const { return m_queued.size() + m_in_flight; }
+
+    size_t submit()
+    {
+        size_t num = 0;
+#ifdef C4FS_IO_URING
+        if(m_ring)
+        {
+            while(!m_queued.empty() && m_in_flight < m_depth)
             {
-                exit_status = ret;
-                break;
+                struct io_uring_sqe *sqe = m_ring->get_sqe();
+                if(!sqe)
+                    break;
+                _uring_prep(sqe, m_queued.front());
+                m_queued.pop_front();
+                ++m_in_flight;
+                ++num;
+            }
+            m_ring->enter(false);
+            return num;
+        }
+#endif
+        if(m_queued.empty())
+            return 0;
+        if(m_threads.empty())
+            for(size_t i = 0; i < m_num_threads; ++i)
+                m_threads.emplace_back(&_Impl::_work, this);
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            while(!m_queued.empty() && m_in_flight < m_depth)
+            {
+                m_work.push_back(m_queued.front());
+                m_queued.pop_front();
+                ++m_in_flight;
+                ++num;
             }
         }
-        if(fn(vp) != 0)
-            break;
+        m_work_cv.notify_all();
+        return num;
+    }
+
+    size_t poll()
+    {
+#ifdef C4FS_IO_URING
+        if(m_ring)
+        {
+            m_ring->reap([this](uint64_t ud, int32_t res){
+                _AsyncReq *req = reinterpret_cast<_AsyncReq*>(static_cast<uintptr_t>(ud));
+                req->result = res;
+                if(req->op == ASYNC_STAT)
+                {
+                    *req->info = path_info{};
+                    req->info->type = INVALID;
+                    if(res == 0)
+                        _path_info_from_statx(req->stx, req->info);
+                }
+                m_completed.push_back(req);
+            });
+        }
+        else
+#endif
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_completed.insert(m_completed.end(), m_done.begin(), m_done.end());
+            m_done.clear();
+        }
+        const size_t num = m_completed.size();
+        for(_AsyncReq *req : m_completed)
+        {
+            AsyncResult r = {req->op, req->result, req->user_data};
+            AsyncCallback cb = req->cb;
+            m_free.push_back(req);
+            --m_in_flight;
+            if(cb)
+                cb(r);
+        }
+        m_completed.clear();
+        return num;
     }
-    FindClose(hFindFile);
-    namebuf[namelen] = '\0';
-    return exit_status;
-}
-#endif
 
-int walk_tree(const char *pathname, PathVisitor fn, void *user_data)
-{
-    C4_CHECK(is_dir(pathname));
-    wtf = fn; // fixme
-#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
-    (void)user_data;
-    return nftw(pathname, _path_visitor_adapter, 64, FTW_PHYS);
-#elif defined(C4_WIN) || defined(__MINGW32__)
-    substr namebuf;
-    namebuf.len = MAX_PATH;
-    csubstr base = to_csubstr(pathname);
-    if(namebuf.len < base.len + 1)
-        namebuf.len = 2 * (base.len + 1);
-    namebuf.str = (char*) c4::aalloc(namebuf.len, alignof(std::max_align_t));
-    C4_ASSERT(!namebuf.overlaps(base));
-    memcpy(namebuf.str, base.str, base.len);
-    namebuf[base.len] = '\0';
-    int exit_status = _walk_tree(fn, user_data, namebuf, base.len);
-    while(exit_status == ENAMETOOLONG)
+    /** block until an operation completes */
+    void block()
     {
-        c4::afree(namebuf.str);
-        namebuf.len *= 2;
-        namebuf.str = (char*) c4::aalloc(namebuf.len, alignof(std::max_align_t));
-        exit_status = _walk_tree(fn, user_data, namebuf, base.len);
+#ifdef C4FS_IO_URING
+        if(m_ring)
+        {
+            m_ring->enter(true);
+            return;
+        }
+#endif
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_done_cv.wait(lock, [this]{ return !m_done.empty(); });
     }
-    if(!exit_status)
+
+    void _work()
     {
-        VisitedPath vp = {};
-        vp.name = pathname;
-        fn(vp);
+        std::unique_lock<std::mutex> lock(m_mtx);
+        while(true)
+        {
+            m_work_cv.wait(lock, [this]{ return m_stop || !m_work.empty(); });
+            if(m_work.empty())
+                return;
+            _AsyncReq *req = m_work.front();
+            m_work.pop_front();
+            lock.unlock();
+            _async_exec(req);
+            lock.lock();
+            m_done.push_back(req);
+            m_done_cv.notify_one();
+        }
     }
-    c4::afree(namebuf.str);
-    return exit_status;
+};
+
+
+AsyncEngine::AsyncEngine(async_options const& opts)
+    : m_impl(new _Impl(opts))
+{
+}
+
+AsyncEngine::~AsyncEngine()
+{
+    drain();
+    delete m_impl;
+}
+
+bool AsyncEngine::uses_io_uring() const
+{
+#ifdef C4FS_IO_URING
+    return m_impl->m_ring != nullptr;
 #else
-    C4_NOT_IMPLEMENTED();
-    return 0;
+    return false;
 #endif
 }
 
+void AsyncEngine::open(const char *pathname, int flags, unsigned mode, AsyncCallback cb, void *user_data)
+{
+    _AsyncReq *req = m_impl->push(ASYNC_OPEN, cb, user_data);
+    req->path = pathname;
+    req->flags = flags;
+    req->mode = mode;
+}
 
-thread_local static EntryList _list_entries_workspace = {};
-int _list_entries_visitor(VisitedFile const& vf)
+void AsyncEngine::read(int fd, void *buf, size_t sz, uint64_t offset, AsyncCallback cb, void *user_data)
 {
-    size_t namelen = strlen(vf.name);
-    auto arena_prev = _list_entries_workspace.arena;
-    auto names_prev = _list_entries_workspace.names;
-    _list_entries_workspace.names.required_size += 1u;
-    _list_entries_workspace.arena.required_size += namelen + 1u;
-    if(_list_entries_workspace.valid())
-    {
-        char *dst = arena_prev.buf + arena_prev.required_size;
-        memcpy(dst, vf.name, namelen);
-        dst[namelen] = '\0';
-        names_prev.buf[names_prev.required_size] = dst;
-    }
-    return 0;
+    _AsyncReq *req = m_impl->push(ASYNC_READ, cb, user_data);
+    req->fd = fd;
+    req->buf = buf;
+    req->size = sz < _max_async_transfer ? sz : _max_async_transfer;
+    req->offset = offset;
 }
 
-bool list_entries(const char *pathname, EntryList *C4_RESTRICT entries, maybe_buf<char> *scratch)
+void AsyncEngine::write(int fd, const void *buf, size_t sz, uint64_t offset, AsyncCallback cb, void *user_data)
 {
-    scratch->reset();
-    entries->reset();
-    _list_entries_workspace = *entries;
-    if(!walk_entries(pathname, _list_entries_visitor, scratch))
-        return false;
-    scratch->required_size = scratch->size;
-    *entries = _list_entries_workspace;
-    return entries->valid() && scratch->valid();
+    _AsyncReq *req = m_impl->push(ASYNC_WRITE, cb, user_data);
+    req->fd = fd;
+    req->buf = const_cast<void*>(buf);
+    req->size = sz < _max_async_transfer ? sz : _max_async_transfer;
+    req->offset = offset;
 }
 
+void AsyncEngine::stat(const char *pathname, path_info *info, int mask, AsyncCallback cb, void *user_data)
+{
+    _AsyncReq *req = m_impl->push(ASYNC_STAT, cb, user_data);
+    req->path = pathname;
+    req->info = info;
+    req->mask = mask;
+}
 
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
+void AsyncEngine::unlink(const char *pathname, AsyncCallback cb, void *user_data)
+{
+    _AsyncReq *req = m_impl->push(ASYNC_UNLINK, cb, user_data);
+    req->path = pathname;
+}
 
-const char* tmpnam(char *buf_, size_t bufsz, const char *fmt_, char subchar)
+void AsyncEngine::close(int fd, AsyncCallback cb, void *user_data)
 {
-    thread_local static std::random_device rand_eng;
-    return tmpnam(rand_eng, buf_, bufsz, fmt_, subchar);
+    _AsyncReq *req = m_impl->push(ASYNC_CLOSE, cb, user_data);
+    req->fd = fd;
 }
 
+size_t AsyncEngine::submit()
+{
+    return m_impl->submit();
+}
 
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
+size_t AsyncEngine::poll()
+{
+    return m_impl->poll();
+}
 
-size_t file_size(const char *filename, const char *access)
+size_t AsyncEngine::wait(size_t min_completions)
 {
-    ::FILE *fp = ::fopen(filename, access);
-    C4_CHECK_MSG(fp != nullptr, "could not open file %s", filename);
-    C4_SUPPRESS_WARNING_GCC_PUSH
-    #if defined(__GNUC__) && __GNUC__ > 8
-    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-null-argument")
-    #endif
-    ::fseek(fp, 0, SEEK_END);
-    C4_SUPPRESS_WARNING_GCC_POP
-    size_t fs = static_cast<size_t>(::ftell(fp));
-    C4_CHECK(::fclose(fp) == 0);
-    return fs;
+    size_t num = 0;
+    while(true)
+    {
+        m_impl->submit();
+        num += m_impl->poll();
+        if(num >= min_completions || !m_impl->pending())
+            return num;
+        // the callbacks may have queued more operations: send them
+        // before blocking
+        if(m_impl->submit() == 0)
+            m_impl->block();
+    }
 }
 
-size_t file_get_contents(const char *filename, char *buf, size_t sz, const char* access)
+void AsyncEngine::drain()
 {
-    C4_SUPPRESS_WARNING_GCC_PUSH
-    #if defined(__GNUC__) && __GNUC__ > 8
-    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-null-argument")
-    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-fclose")
-    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-free")
-    #endif
-    ::FILE *fp = ::fopen(filename, access);
-    C4_CHECK_MSG(fp != nullptr, "could not open file %s", filename);
-    ::fseek(fp, 0, SEEK_END);
-    const size_t fs = static_cast<size_t>(::ftell(fp));
-    ::rewind(fp);
-    if(fs <= sz && buf != nullptr)
+    while(m_impl->pending())
+        wait(m_impl->pending());
+}
+
+size_t AsyncEngine::pending() const
+{
+    return m_impl->pending();
+}
+
+
+//-----------------------------------------------------------------------------
+
+namespace /*anon*/ {
+
+#if defined(C4_WIN) || defined(__MINGW32__)
+constexpr const int _async_read_flags = _O_RDONLY|_O_BINARY;
+constexpr const int _async_write_flags = _O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY;
+constexpr const unsigned _async_write_mode = _S_IREAD|_S_IWRITE;
+#else
+constexpr const int _async_read_flags = O_RDONLY|O_CLOEXEC;
+constexpr const int _async_write_flags = O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC;
+constexpr const unsigned _async_write_mode = 0666;
+#endif
+
+/** the state of file_get_contents_async(): open and stat, then read
+ * until the end of file, then close */
+struct _AsyncGet
+{
+    AsyncEngine *engine;
+    container_resizer resizer;
+    AsyncCallback cb;
+    void *user_data;
+    path_info info;
+    int fd;
+    int64_t error;
+    unsigned waiting; //!< for the open and the stat
+    size_t size;      //!< the size of the file, or 0 if unknown
+    size_t capacity;  //!< the size of the container, when the file size is unknown
+    size_t pos;
+    char *buf;
+
+    static void on_open(AsyncResult const& r)
     {
-        if(fs != ::fread(buf, 1, fs, fp))
+        _AsyncGet *s = static_cast<_AsyncGet*>(r.user_data);
+        if(r.ok())
+            s->fd = static_cast<int>(r.result);
+        else
+            s->error = r.result;
+        if(--s->waiting == 0)
+            s->start();
+    }
+
+    static void on_stat(AsyncResult const& r)
+    {
+        _AsyncGet *s = static_cast<_AsyncGet*>(r.user_data);
+        if(--s->waiting == 0)
+            s->start();
+    }
+
+    void start()
+    {
+        if(fd < 0)
         {
-            ::fclose(fp);
-            C4_ERROR("failed to read");
+            finish();
+            return;
         }
+        if(info.exists() && info.type == REGFILE)
+            size = static_cast<size_t>(info.size);
+        read_next();
     }
-    C4_CHECK(::fclose(fp) == 0);
-    C4_SUPPRESS_WARNING_GCC_POP
-    return fs;
-}
 
-void file_put_contents(const char *filename, const char *buf, size_t sz, const char* access)
+    void read_next()
+    {
+        size_t end = size;
+        if(size == 0) // unknown size: grow the container until the end of file
+        {
+            if(pos == capacity)
+            {
+                capacity = capacity ? 2 * capacity : 4096;
+                buf = resizer(capacity);
+            }
+            end = capacity;
+        }
+        else if(buf == nullptr)
+        {
+            buf = resizer(size);
+        }
+        engine->read(fd, buf + pos, end - pos, pos, &on_read, this);
+    }
+
+    static void on_read(AsyncResult const& r)
+    {
+        _AsyncGet *s = static_cast<_AsyncGet*>(r.user_data);
+        if(!r.ok())
+            s->error = r.result;
+        else
+            s->pos += static_cast<size_t>(r.result);
+        if(!r.ok() || r.result == 0 || (s->size && s->pos == s->size))
+        {
+            if(!s->error && (s->size == 0 || s->pos != s->size)) // unknown size, or the file was truncated meanwhile
+                s->resizer(s->pos);
+            s->engine->close(s->fd, &on_close, s);
+            return;
+        }
+        s->read_next();
+    }
+
+    static void on_close(AsyncResult const& r)
+    {
+        static_cast<_AsyncGet*>(r.user_data)->finish();
+    }
+
+    void finish()
+    {
+        AsyncResult r = {ASYNC_READ, error < 0 ? error : static_cast<int64_t>(pos), user_data};
+        AsyncCallback fn = cb;
+        delete this;
+        if(fn)
+            fn(r);
+    }
+};
+
+/** the state of file_put_contents_async(): open, then write until
+ * done, then close */
+struct _AsyncPut
 {
-    C4_SUPPRESS_WARNING_GCC_PUSH
-    #if defined(__GNUC__) && __GNUC__ > 8
-    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-null-argument")
-    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-fclose")
-    C4_SUPPRESS_WARNING_GCC("-Wanalyzer-double-free")
-    #endif
-    ::FILE *fp = ::fopen(filename, access);
-    C4_CHECK_MSG(fp != nullptr, "could not open file");
-    if(sz != ::fwrite(buf, 1, sz, fp))
+    AsyncEngine *engine;
+    const char *buf;
+    size_t size;
+    size_t pos;
+    int fd;
+    int64_t error;
+    AsyncCallback cb;
+    void *user_data;
+
+    static void on_open(AsyncResult const& r)
     {
-        ::fclose(fp);
-        C4_ERROR("failed to write");
+        _AsyncPut *s = static_cast<_AsyncPut*>(r.user_data);
+        if(!r.ok())
+        {
+            s->error = r.result;
+            s->finish();
+            return;
+        }
+        s->fd = static_cast<int>(r.result);
+        s->write_next();
     }
-    C4_CHECK(::fclose(fp) == 0);
-    C4_SUPPRESS_WARNING_GCC_POP
+
+    void write_next()
+    {
+        if(pos == size)
+            engine->close(fd, &on_close, this);
+        else
+            engine->write(fd, buf + pos, size - pos, pos, &on_write, this);
+    }
+
+    static void on_write(AsyncResult const& r)
+    {
+        _AsyncPut *s = static_cast<_AsyncPut*>(r.user_data);
+        if(r.result <= 0)
+        {
+            s->error = r.ok() ? -EIO : r.result;
+            s->engine->close(s->fd, &on_close, s);
+            return;
+        }
+        s->pos += static_cast<size_t>(r.result);
+        s->write_next();
+    }
+
+    static void on_close(AsyncResult const& r)
+    {
+        _AsyncPut *s = static_cast<_AsyncPut*>(r.user_data);
+        if(!r.ok() && !s->error)
+            s->error = r.result;
+        s->finish();
+    }
+
+    void finish()
+    {
+        AsyncResult r = {ASYNC_WRITE, error < 0 ? error : static_cast<int64_t>(pos), user_data};
+        AsyncCallback fn = cb;
+        delete this;
+        if(fn)
+            fn(r);
+    }
+};
+
+} // namespace anon
+
+void file_get_contents_async(AsyncEngine *engine, const char *filename, container_resizer resizer, AsyncCallback cb, void *user_data)
+{
+    _AsyncGet *s = new _AsyncGet;
+    s->engine = engine;
+    s->resizer = resizer;
+    s->cb = cb;
+    s->user_data = user_data;
+    s->info = path_info{};
+    s->fd = -1;
+    s->error = 0;
+    s->waiting = 2;
+    s->size = 0;
+    s->capacity = 0;
+    s->pos = 0;
+    s->buf = nullptr;
+    engine->open(filename, _async_read_flags, 0, &_AsyncGet::on_open, s);
+    engine->stat(filename, &s->info, INFO_TYPE|INFO_SIZE, &_AsyncGet::on_stat, s);
+}
+
+void file_put_contents_async(AsyncEngine *engine, const char *filename, const char *buf, size_t sz, AsyncCallback cb, void *user_data)
+{
+    _AsyncPut *s = new _AsyncPut;
+    s->engine = engine;
+    s->buf = buf;
+    s->size = sz;
+    s->pos = 0;
+    s->fd = -1;
+    s->error = 0;
+    s->cb = cb;
+    s->user_data = user_data;
+    engine->open(filename, _async_write_flags, _async_write_mode, &_AsyncPut::on_open, s);
+}
+
+void rmfile_async(AsyncEngine *engine, const char *filename, AsyncCallback cb, void *user_data)
+{
+    engine->unlink(filename, cb, user_data);
 }
 
 
@@ -839,6 +5717,145 @@ const char* ScopedTmpFile::full_path(char *buf, size_t sz) const
     return buf;
 }
 
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+MappedFile::MappedFile() noexcept
+    : m_data(nullptr)
+    , m_size(0)
+#if defined(C4_WIN)
+    , m_file(nullptr)
+    , m_mapping(nullptr)
+#endif
+{
+}
+
+MappedFile::MappedFile(const char *filename, int hints)
+    : MappedFile()
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    int fd = _open_for_read(filename);
+    C4_CHECK_MSG(fd >= 0, "could not open file %s", filename);
+    struct stat s;
+    if(::fstat(fd, &s) != 0 || !S_ISREG(s.st_mode))
+    {
+        ::close(fd);
+        C4_ERROR("not a regular file: %s", filename);
+    }
+    m_size = static_cast<size_t>(s.st_size);
+    if(m_size == 0)
+    {
+        m_data = ""; // mmap() does not accept zero lengths
+        ::close(fd);
+        return;
+    }
+    void *mem = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps its own reference to the file
+    C4_CHECK_MSG(mem != MAP_FAILED, "could not map file %s", filename);
+    m_data = static_cast<const char*>(mem);
+    if(hints != ACCESS_NORMAL)
+        advise(hints);
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    C4_CHECK_MSG(file != INVALID_HANDLE_VALUE, "could not open file %s", filename);
+    LARGE_INTEGER sz = {};
+    if(!GetFileSizeEx(file, &sz))
+    {
+        CloseHandle(file);
+        C4_ERROR("could not get the size of file %s", filename);
+    }
+    m_size = static_cast<size_t>(sz.QuadPart);
+    if(m_size == 0)
+    {
+        m_data = ""; // CreateFileMapping() does not accept zero lengths
+        CloseHandle(file);
+        return;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mapping == nullptr)
+    {
+        CloseHandle(file);
+        C4_ERROR("could not map file %s", filename);
+    }
+    m_file = file;
+    m_mapping = mapping;
+    m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if(m_data == nullptr)
+    {
+        unmap();
+        C4_ERROR("could not map file %s", filename);
+    }
+    if(hints != ACCESS_NORMAL)
+        advise(hints);
+#else
+    C4_UNUSED(filename);
+    C4_UNUSED(hints);
+    C4_NOT_IMPLEMENTED();
+#endif
+}
+
+bool MappedFile::advise(int hints) const
+{
+    if(m_size == 0)
+        return true;
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    void *addr = const_cast<char*>(m_data);
+    bool ok = true;
+    if(hints & ACCESS_SEQUENTIAL)
+        ok &= ::madvise(addr, m_size, MADV_SEQUENTIAL) == 0;
+    if(hints & ACCESS_RANDOM)
+        ok &= ::madvise(addr, m_size, MADV_RANDOM) == 0;
+    if(hints & ACCESS_WILLNEED)
+        ok &= ::madvise(addr, m_size, MADV_WILLNEED) == 0;
+    if(hints & ACCESS_HUGEPAGE)
+    {
+    #ifdef MADV_HUGEPAGE
+        ok &= ::madvise(addr, m_size, MADV_HUGEPAGE) == 0;
+    #else
+        ok = false;
+    #endif
+    }
+    return ok;
+#else
+    return hints == ACCESS_NORMAL;
+#endif
+}
+
+void MappedFile::unmap()
+{
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    if(m_data && m_size)
+        ::munmap(const_cast<char*>(m_data), m_size);
+#elif defined(C4_WIN) || defined(__MINGW32__)
+    if(m_data && m_size)
+        UnmapViewOfFile(m_data);
+    if(m_mapping)
+        CloseHandle(m_mapping);
+    if(m_file)
+        CloseHandle(m_file);
+    m_mapping = nullptr;
+    m_file = nullptr;
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+void MappedFile::_move(MappedFile *that)
+{
+    m_data = that->m_data;
+    m_size = that->m_size;
+    that->m_data = nullptr;
+    that->m_size = 0;
+#if defined(C4_WIN)
+    m_file = that->m_file;
+    m_mapping = that->m_mapping;
+    that->m_file = nullptr;
+    that->m_mapping = nullptr;
+#endif
+}
+
 C4_SUPPRESS_WARNING_GCC_CLANG_POP
 
 } // namespace fs
@@ -16,11 +16,13 @@ struct dirent;
 struct stat;
 struct FTW;
 #elif defined(C4_WIN)
+struct stat;
 struct _WIN32_FIND_DATAA;
 typedef struct _WIN32_FIND_DATAA WIN32_FIND_DATAA;
 #endif
 
 namespace c4 {
+struct MemoryResource;
 namespace fs {
 
 using ssize_t = typename std::make_signed<size_t>::type;
@@ -78,28 +80,420 @@ uint64_t atime(const char *pathname);
 /** @} */
 
 
+//-----------------------------------------------------------------------------
+
+/** @name path info */
+
+/** @{ */
+
+/** the fields of path_info, to choose which are obtained by info() */
+typedef enum {
+    INFO_TYPE  = 1,  ///< path_info::type
+    INFO_SIZE  = 2,  ///< path_info::size
+    INFO_INODE = 4,  ///< path_info::inode
+    INFO_MTIME = 8,  ///< path_info::mtime_ns
+    INFO_ATIME = 16, ///< path_info::atime_ns
+    INFO_CTIME = 32, ///< path_info::ctime_ns
+    INFO_BTIME = 64, ///< path_info::btime_ns: not provided by every filesystem
+    INFO_ALL   = INFO_TYPE|INFO_SIZE|INFO_INODE|INFO_MTIME|INFO_ATIME|INFO_CTIME|INFO_BTIME,
+} PathInfo_e;
+
+/** the metadata of a path. The times are in nanoseconds since the epoch. */
+struct path_info
+{
+    int        mask;     ///< the fields which were obtained, a combination of PathInfo_e. 0 if the path could not be stat-ed.
+    PathType_e type;
+    uint64_t   size;     ///< in bytes
+    uint64_t   inode;
+    uint64_t   mtime_ns; ///< modification time
+    uint64_t   atime_ns; ///< access time
+    uint64_t   ctime_ns; ///< status change time
+    uint64_t   btime_ns; ///< birth (creation) time
+
+    bool exists() const { return mask != 0; }
+};
+
+/** get the metadata of a path (following symlinks) with a single
+ * syscall. On linux, this is statx(), and only the fields in the mask
+ * are requested from the filesystem; elsewhere, it is stat().
+ * @param mask a combination of PathInfo_e. The fields which were
+ * obtained are reported in path_info::mask; fields not in the mask may
+ * be obtained anyway.
+ * @return the info. Its mask is 0 if the path could not be stat-ed. */
+path_info info(const char *pathname, int mask=INFO_ALL);
+
+/** get the info of many paths at once. The paths are grouped by
+ * their parent directory, and each group is stat-ed relative to a
+ * directory fd (with fstatat()/statx()) in a task of a worker pool, so
+ * that a slow directory does not serialize the whole batch.
+ * @param results an array of @p num elements, receiving the info of
+ * each path, as from info()
+ * @param num_threads the number of workers. 0 means the hardware
+ * concurrency; more threads than that help when the paths are on
+ * slow (eg, network) filesystems. */
+void stat_many(const char *const* paths, size_t num, path_info *results, int mask=INFO_ALL, size_t num_threads=0);
+
+/** @} */
+
+
+//-----------------------------------------------------------------------------
+
+/** @name stat cache */
+
+/** @{ */
+
+/** an opt-in cache of stat() results, for callers which query the
+ * same paths repeatedly, eg path_exists() followed by is_dir() and
+ * mtime(). Both successful and failed stats are memoized, so repeated
+ * existence checks of missing paths are also cheap.
+ *
+ * The cache does not see changes to the filesystem: entries must be
+ * invalidated explicitly, or expire after the time-to-live given at
+ * construction. A stat which is concurrent with an invalidation of
+ * its shard is returned but not stored, so invalidations are never
+ * lost.
+ *
+ * It is thread-safe: the paths are spread over shards, each with its
+ * own lock. */
+class StatCache
+{
+public:
+
+    /** @param ttl_ns the time after which an entry expires, in
+     * nanoseconds. 0 means the entries never expire.
+     * @param num_shards the number of shards. More shards reduce the
+     * contention between threads. */
+    explicit StatCache(uint64_t ttl_ns=0, size_t num_shards=64);
+    ~StatCache();
+
+    StatCache(StatCache const&) = delete;
+    StatCache& operator=(StatCache const&) = delete;
+
+    /** like ::stat(), but memoized.
+     * @return 0 on success. Otherwise, -1, with errno set to the
+     * (possibly memoized) error */
+    int stat(const char *pathname, struct stat *s);
+
+    /** forget the entry for the path */
+    void invalidate(const char *pathname);
+    /** forget the entries for the path and for every path below it */
+    void invalidate_tree(const char *pathname);
+    /** forget all the entries */
+    void clear();
+
+    /** the number of entries, including the expired ones which were
+     * not looked up since they expired (expired entries are erased
+     * when they are found) */
+    size_t size() const;
+
+private:
+
+    struct _Shard;
+    _Shard *m_shards;
+    size_t m_num_shards;
+    uint64_t m_ttl_ns;
+
+    _Shard& _shard(csubstr pathname) const;
+};
+
+/** @name cached queries
+ * like the functions above, but stat-ing through the cache.
+ * The cache can be null. */
+/** @{ */
+bool path_exists(const char *pathname, StatCache *cache);
+bool file_exists(const char *pathname, StatCache *cache);
+bool dir_exists(const char *pathname, StatCache *cache);
+PathType_e path_type(const char *pathname, StatCache *cache);
+inline bool is_file(const char *pathname, StatCache *cache) { return path_type(pathname, cache) == REGFILE; }
+inline bool is_dir(const char *pathname, StatCache *cache) { return path_type(pathname, cache) == DIR; }
+path_info info(const char *pathname, StatCache *cache, int mask=INFO_ALL);
+path_times times(const char *pathname, StatCache *cache);
+uint64_t ctime(const char *pathname, StatCache *cache);
+uint64_t mtime(const char *pathname, StatCache *cache);
+uint64_t atime(const char *pathname, StatCache *cache);
+/** @} */
+
+/** @} */
+
+
 //-----------------------------------------------------------------------------
 
 /** @name creation and deletion */
 
 /** @{ */
+/** create a directory and its missing parents. The prefixes of the
+ * path are tried from the deepest backwards, so that only the missing
+ * components are created: when only the last one is missing, this
+ * costs a single mkdir. */
 void mkdirs(char *pathname);
 int mkdir(const char *pathname);
+
+/** the counts of mkdirs_many() */
+struct mkdirs_stats
+{
+    size_t created; ///< the number of directories created, including the parents
+    size_t errors;  ///< the number of paths which could not be created
+};
+
+/** create many directories and their missing parents. The paths are
+ * normalized and sorted so that each shared prefix is created (or
+ * found to exist) only once, and the directories are created with
+ * mkdirat() relative to fds of their parents, which are kept open
+ * while their subtree is being created. Duplicate paths are fine.
+ * @param stats receives the counts, when not null
+ * @return 0 if all the directories exist at the end; otherwise -1,
+ * with errno set by the first failure
+ * @note in windows each path is created with mkdirs() */
+int mkdirs_many(const char *const* paths, size_t num, mkdirs_stats *stats=nullptr);
 int rmdir(const char *pathname);
 
 int rmfile(const char *filename);
 int rmtree(const char *pathname);
 
+/** the counts of rmtree_parallel() */
+struct rmtree_stats
+{
+    size_t files;  ///< the number of files (and other non-directories) removed
+    size_t dirs;   ///< the number of directories removed
+    size_t errors; ///< the number of entries which could not be removed
+};
+
+/** called by rmtree_parallel() to report its progress */
+using RmtreeProgress = void (*)(rmtree_stats const& stats, void *user_data);
+
+/** options for rmtree_parallel() */
+struct rmtree_options
+{
+    /** the number of threads, including the calling thread. Use 0
+     * for std::thread::hardware_concurrency(). The removal is bound
+     * by the filesystem's metadata operations, so more threads than
+     * that can help, especially on network filesystems. */
+    size_t num_threads;
+    /** called every progress_interval removals, from any of the
+     * threads, but never concurrently. Can be null. */
+    RmtreeProgress progress;
+    void *user_data;
+    size_t progress_interval;
+
+    rmtree_options() : num_threads(0), progress(nullptr), user_data(nullptr), progress_interval(size_t(1) << 14) {}
+};
+
+/** remove a directory tree, spreading the subdirectories across a
+ * pool of work-stealing threads. The entries of each directory are
+ * removed with unlinkat() relative to the directory's fd, and each
+ * directory is removed as soon as its last subdirectory was removed.
+ * Each thread keeps at most one directory open at a time. Symbolic
+ * links are removed, not followed. When @p pathname is not a
+ * directory, it is removed as a file. The removal carries on past
+ * the entries which cannot be removed.
+ * @param stats receives the counts, when not null
+ * @return 0 if the whole tree was removed; otherwise -1, with errno
+ * set by the first failure
+ * @note in windows, this is the same as rmtree(), and the counts
+ * are not reported */
+int rmtree_parallel(const char *pathname, rmtree_options const& opts=rmtree_options{}, rmtree_stats *stats=nullptr);
+
+/** the default name of the trash directories of TrashCan */
+constexpr const char default_trash_dirname[] = ".c4fs_trash";
+
+/** removes trees in the background. remove() renames the tree into a
+ * trash directory created next to it, so that it is on the same
+ * filesystem, and the rename takes constant time and is atomic. A
+ * background thread (started by the first remove()) then removes the
+ * trash with rmtree_parallel().
+ *
+ * A trash directory is removed once the trees queued into it are
+ * reclaimed (unless something else was put in it). Trash which was
+ * not reclaimed when the process ended stays in the trash
+ * directories, and can be queued again with recover(), eg at
+ * startup. */
+class TrashCan
+{
+public:
+
+    /** @param trash_dirname the name of the trash directories
+     * @param num_threads the number of threads removing each tree,
+     * including the background thread. See rmtree_options. */
+    explicit TrashCan(const char *trash_dirname=default_trash_dirname, size_t num_threads=1);
+    /** waits for the pending removals */
+    ~TrashCan();
+
+    TrashCan(TrashCan const&) = delete;
+    TrashCan& operator=(TrashCan const&) = delete;
+
+    /** move the tree (or file) to the trash, and queue its removal.
+     * When it cannot be moved to the trash (eg, it is a mount point,
+     * which fails with EXDEV or EBUSY) or the trash directory cannot
+     * be created, it is removed right away. A path which does not
+     * exist fails with ENOENT.
+     * @return 0 if the path is gone; otherwise -1, with errno set */
+    int remove(const char *pathname);
+
+    /** queue the removal of the trash left in the trash directory of
+     * @p dirname, ie by a previous process. The entries which this
+     * TrashCan already queued, or is removing, are skipped. Must not
+     * be called while another process is using the same trash
+     * directory.
+     * @return the number of entries queued */
+    size_t recover(const char *dirname);
+
+    /** wait until the trash is empty */
+    void wait();
+    /** the number of trees waiting for removal, or being removed */
+    size_t pending() const;
+    /** the counts of the removals finished so far */
+    rmtree_stats stats() const;
+
+public:
+
+    struct _Impl;
+
+private:
+
+    _Impl *m_impl;
+
+};
+
+/** @name rmtree_async
+ * like the members of TrashCan, using a TrashCan shared by the whole
+ * process, which finishes the pending removals when the process exits */
+/** @{ */
+int rmtree_async(const char *pathname);
+void rmtree_async_wait();
+size_t rmtree_async_recover(const char *dirname);
+/** @} */
+
 /** @} */
 
 
+//-----------------------------------------------------------------------------
+
+/** hints on how the contents of a file will be accessed. These are
+ * flags, and can be combined, eg ACCESS_SEQUENTIAL|ACCESS_WILLNEED.
+ * They are given to the kernel with posix_fadvise() by the file
+ * contents functions and copy_file(), and with madvise() by
+ * MappedFile. Hints which do not apply are ignored. */
+typedef enum {
+    ACCESS_NORMAL      = 0,      ///< no hint
+    ACCESS_SEQUENTIAL  = 1 << 0, ///< the contents will be accessed sequentially: read ahead more aggressively
+    ACCESS_RANDOM      = 1 << 1, ///< the contents will be accessed in random order
+    ACCESS_WILLNEED    = 1 << 2, ///< the contents will be needed soon: start reading ahead now
+    ACCESS_HUGEPAGE    = 1 << 3, ///< back the mapping with huge pages, if possible (linux only, MappedFile only)
+    ACCESS_NOREUSE     = 1 << 4, ///< the contents will be accessed only once
+    /** drop the contents from the page cache once they were processed,
+     * so that a one-pass transfer of a large file does not evict
+     * everything else. Writes are flushed as they progress, and the
+     * call returns only after the written data reached the device.
+     * (linux only, not for MappedFile) */
+    ACCESS_DROP_BEHIND = 1 << 5,
+} AccessHint_e;
+
+
 //-----------------------------------------------------------------------------
 
 /** @name file copy and move */
 
 /** @{ */
-void copy_file(const char *file, const char *dst);
+
+/** the default size of the buffer used by copy_file() when the copy
+ * has to go through userspace */
+constexpr const size_t default_copy_buffer_size = size_t(1) << 20;
+
+/** the ways in which copy_file() can copy the contents of a file */
+typedef enum {
+    COPY_NONE,       ///< nothing was copied
+    COPY_REFLINK,    ///< ioctl(FICLONE): the copy shares the extents of the source (linux only)
+    COPY_FILE_RANGE, ///< copy_file_range(): in-kernel copy (linux only)
+    COPY_SENDFILE,   ///< sendfile(): in-kernel copy (linux only)
+    COPY_USERSPACE,  ///< read()/write() through a userspace buffer
+    COPY_NATIVE,     ///< the platform's copy function, eg CopyFile() in windows
+} CopyStrategy_e;
+
+/** the options for copy_file(). The strategies are attempted in
+ * order (reflink, copy_file_range, sendfile), each picking up where
+ * the previous one stopped. The userspace copy is used if all of the
+ * enabled strategies fail. */
+struct copy_options
+{
+    bool   try_reflink;         ///< try ioctl(FICLONE) first
+    bool   try_copy_file_range; ///< try copy_file_range()
+    bool   try_sendfile;        ///< try sendfile()
+    size_t buffer_size;         ///< size of the buffer for the userspace copy
+    int    hints;               ///< AccessHint_e flags for reading the source. ACCESS_DROP_BEHIND applies also to the destination.
+
+    copy_options()
+        : try_reflink(true)
+        , try_copy_file_range(true)
+        , try_sendfile(true)
+        , buffer_size(default_copy_buffer_size)
+        , hints(ACCESS_NORMAL)
+    {
+    }
+};
+
+struct copy_result
+{
+    CopyStrategy_e strategy; ///< the strategy which completed the copy
+    size_t size;             ///< the number of bytes copied
+};
+
+/** copy a file. The destination must not exist. */
+copy_result copy_file(const char *file, const char *dst, copy_options const& opts);
+/** copy a file. The destination must not exist. */
+inline void copy_file(const char *file, const char *dst) { copy_file(file, dst, copy_options{}); }
+
 void move_file(const char *file, const char *dst);
+
+/** the options for copy_tree() */
+struct copy_tree_options
+{
+    /** how the contents of the files are copied: by default, with a
+     * reflink where the filesystem supports it, and with an in-kernel
+     * copy otherwise */
+    copy_options file;
+    /** hard link the files instead of copying them, falling back to
+     * copying when linking fails (eg across filesystems). The links
+     * share the inode of the source, so this is only for trees which
+     * are not modified afterwards, eg read-only caches. */
+    bool hardlink;
+    /** copy the permission bits of the files and directories */
+    bool preserve_mode;
+    /** copy the access and modification times of the files,
+     * directories and symbolic links */
+    bool preserve_times;
+    /** the number of threads, including the calling thread. Use 0 for
+     * std::thread::hardware_concurrency(). */
+    size_t num_threads;
+
+    copy_tree_options() : file(), hardlink(false), preserve_mode(false), preserve_times(false), num_threads(0) {}
+};
+
+/** the counts of copy_tree() */
+struct copy_tree_stats
+{
+    size_t files;     ///< the number of files copied or hard linked
+    size_t hardlinks; ///< the number of files which were hard linked
+    size_t dirs;      ///< the number of directories created, including the root
+    size_t symlinks;  ///< the number of symbolic links recreated
+    size_t bytes;     ///< the number of bytes copied (hard links copy no bytes)
+    size_t errors;    ///< the number of entries which could not be copied
+};
+
+/** copy a directory tree. The destination must not exist. The
+ * subdirectories are spread across a pool of work-stealing threads,
+ * which recreate them and copy their files concurrently, opening the
+ * entries relative to the fds of their directories. Symbolic links
+ * are recreated, not followed. Other entries (pipes, sockets,
+ * devices) are skipped. The copy carries on past the entries which
+ * cannot be copied.
+ * @param stats receives the counts, when not null
+ * @return 0 if the whole tree was copied; otherwise -1, with errno
+ * set by the first failure
+ * @note in windows the tree is copied by the calling thread, and
+ * symbolic links are copied as files. The files are copied with
+ * CopyFile(), so opts.file is not used, and opts.hardlink,
+ * opts.preserve_mode and opts.preserve_times are ignored. */
+int copy_tree(const char *src, const char *dst, copy_tree_options const& opts=copy_tree_options{}, copy_tree_stats *stats=nullptr);
 /** @} */
 
 
@@ -155,6 +549,101 @@ constexpr const char default_tmppat[] = "_c4fs_tmpname_XXXXXXXX.tmp";
 /** the default character to look for */
 constexpr const char default_tmpchar = 'X';
 
+/** a fast pseudo-random generator (xoshiro256**), used by tmpnam()
+ * to fill the substitutions. It satisfies UniformRandomBitGenerator.
+ * It is not suitable for cryptographic use. */
+class TmpRandom
+{
+public:
+
+    using result_type = uint64_t;
+    static constexpr result_type min() { return 0u; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    /** the state is expanded from the seed with splitmix64 */
+    explicit TmpRandom(uint64_t seed) { this->seed(seed); }
+
+    void seed(uint64_t seed);
+
+    result_type operator()()
+    {
+        const uint64_t result = _rotate(m_s[1] * 5u, 7) * 9u;
+        const uint64_t t = m_s[1] << 17;
+        m_s[2] ^= m_s[0];
+        m_s[3] ^= m_s[1];
+        m_s[1] ^= m_s[2];
+        m_s[0] ^= m_s[3];
+        m_s[2] ^= t;
+        m_s[3] = _rotate(m_s[3], 45);
+        return result;
+    }
+
+private:
+
+    static constexpr uint64_t _rotate(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+    uint64_t m_s[4];
+};
+
+/** the generator of the calling thread. It is seeded from
+ * std::random_device on its first use in the thread, and seeded
+ * again in the child of a fork(), so that parent and child do not
+ * produce the same names. */
+TmpRandom& tmp_random();
+
+/** a tmpnam() format, with the positions of its substitutions found
+ * once, so that creating a name does not scan the format. In C++14
+ * and later, it can be built at compile time from a literal:
+ * @code
+ * constexpr const TmpPattern pat("log_XXXXXXXX.txt");
+ * char buf[pat.len() + 1];
+ * tmpnam(pat, buf, sizeof(buf));
+ * @endcode
+ * The format string is not copied, and must outlive the pattern. */
+class TmpPattern
+{
+public:
+
+    /** the largest number of substitutions in a pattern */
+    static constexpr const size_t max_subs = 32;
+
+    C4_CONSTEXPR14 TmpPattern(const char *fmt=default_tmppat, char subchar=default_tmpchar)
+        : m_fmt(fmt), m_len(0), m_num_subs(0), m_pos()
+    {
+        while(fmt[m_len])
+            ++m_len;
+        for(size_t i = 0; i + 1 < m_len; )
+        {
+            if(fmt[i] == subchar && fmt[i + 1] == subchar)
+            {
+                if(m_num_subs < max_subs)
+                    m_pos[m_num_subs] = i;
+                ++m_num_subs;
+                i += 2;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    C4_CONSTEXPR14 const char* fmt() const { return m_fmt; }
+    /** the length of the names, without the null terminator */
+    C4_CONSTEXPR14 size_t len() const { return m_len; }
+    C4_CONSTEXPR14 size_t num_subs() const { return m_num_subs; }
+    /** the position of the i-th substitution */
+    C4_CONSTEXPR14 size_t pos(size_t i) const { return m_pos[i]; }
+    /** whether the format has at least one and at most max_subs substitutions */
+    C4_CONSTEXPR14 bool valid() const { return m_num_subs > 0 && m_num_subs <= max_subs; }
+
+private:
+
+    const char *m_fmt;
+    size_t m_len;
+    size_t m_num_subs;
+    size_t m_pos[max_subs];
+};
+
 /** create a temporary name from a format. The format is scanned for
  * appearances of "XX"; each appearance of "XX" will be substituted by
  * an hexadecimal byte (ie 00...ff).
@@ -183,12 +672,39 @@ const char * tmpnam(RandomEngine &random_engine, char *buf_, size_t bufsz, const
     return buf_;
 }
 
-/** create a temporary name from a format.
+/** create a temporary name from a format, with the generator of the
+ * calling thread.
  * output to a string, never writing beyond @p bufsz
  * @param buf the buffer - must be larger than @p fmt
  * @param bufsz the size of the buffer - must be larger than strlen(fmt) */
 const char * tmpnam(char *buf, size_t bufsz, const char *fmt=default_tmppat, char subchar=default_tmpchar);
 
+/** create a temporary name from a precompiled pattern, with the
+ * generator of the calling thread.
+ * @param bufsz the size of the buffer - must be larger than pat.len() */
+const char * tmpnam(TmpPattern const& pat, char *buf, size_t bufsz);
+
+/** create a temporary name from a precompiled pattern.
+ * a convenience wrapper for use with existing containers */
+template<class CharContainer>
+const char * tmpnam(TmpPattern const& pat, CharContainer *buf)
+{
+    buf->resize(pat.len() + 1);
+    tmpnam(pat, &(*buf)[0], buf->size());
+    buf->resize(pat.len());
+    return &(*buf)[0];
+}
+
+/** create a temporary name from a precompiled pattern.
+ * a convenience wrapper for use with containers */
+template<class CharContainer>
+CharContainer tmpnam(TmpPattern const& pat)
+{
+    CharContainer c;
+    tmpnam(pat, &c);
+    return c;
+}
+
 /** create a temporary name from a format.
  * a convenience wrapper for use with existing containers */
 template<class RandomEngine, class CharContainer>
@@ -247,40 +763,275 @@ CharContainer tmpnam(const char *fmt=default_tmppat, char subchar=default_tmpcha
 constexpr const char default_read_access[] = "rb";
 constexpr const char default_write_access[] = "wb";
 
+/** get the size of the file, without opening it. The access
+ * argument is ignored, and is kept for compatibility. */
 size_t file_size(const char *filename, const char* access=default_read_access);
 
-size_t file_get_contents(const char *filename, char *buf, size_t sz, const char* access=default_read_access);
+/** read the file into the given buffer. Nothing is read if the buffer
+ * is smaller than the file. Files of unknown size (eg pipes, or files
+ * in /proc) are the exception: they can only be measured by reading
+ * them, so the buffer receives their first @p sz bytes, and the rest
+ * is counted but dropped.
+ * @param hints a combination of AccessHint_e flags
+ * @return the size of the file. When a regular file was truncated
+ * while it was read, this is the number of bytes actually read.
+ * @note in POSIX the access mode is ignored: files are always read
+ * in binary mode */
+size_t file_get_contents(const char *filename, char *buf, size_t sz, const char* access=default_read_access, int hints=ACCESS_NORMAL);
+
+/** a type-erased handle to a resizeable container of chars */
+struct container_resizer
+{
+    void *container;
+    /** resize the container, returning a pointer to its data */
+    char* (*resize)(void *container, size_t sz);
+    char* operator() (size_t sz) const { return resize(container, sz); }
+};
 
 template<class CharContainer>
-size_t file_get_contents(const char *filename, CharContainer *v, const char* access=default_read_access)
+char* _resize_char_container(void *container, size_t sz)
 {
-    size_t needed = file_get_contents(filename, v->empty() ? nullptr : &(*v)[0], v->size(), access);
-    if(needed > v->size())
-    {
-        v->resize(needed);
-        needed = file_get_contents(filename, v->empty() ? nullptr : &(*v)[0], v->size(), access);
-        C4_CHECK(needed <= v->size());
-    }
-    v->resize(needed);
-    return needed;
+    CharContainer *v = static_cast<CharContainer*>(container);
+    v->resize(sz);
+    return v->empty() ? nullptr : &(*v)[0];
 }
 
+/** read the whole file into a container, opening it only once. The
+ * container is resized to the size of the file before reading.
+ * When the size of the file is not known in advance (eg pipes or
+ * files in /proc), the container is grown until the end of the file
+ * is reached.
+ * @return the size of the file */
+size_t file_get_contents(const char *filename, container_resizer resizer, const char* access=default_read_access, int hints=ACCESS_NORMAL);
+
 template<class CharContainer>
-CharContainer file_get_contents(const char *filename, const char* access=default_read_access)
+size_t file_get_contents(const char *filename, CharContainer *v, const char* access=default_read_access, int hints=ACCESS_NORMAL)
+{
+    return file_get_contents(filename, container_resizer{v, &_resize_char_container<CharContainer>}, access, hints);
+}
+
+template<class CharContainer>
+CharContainer file_get_contents(const char *filename, const char* access=default_read_access, int hints=ACCESS_NORMAL)
 {
     CharContainer cc;
-    file_get_contents<CharContainer>(filename, &cc, access);
+    file_get_contents<CharContainer>(filename, &cc, access, hints);
     return cc;
 }
 
 
-void file_put_contents(const char *filename, const char *buf, size_t sz, const char* access=default_write_access);
+/** write the buffer to the file.
+ * @param hints a combination of AccessHint_e flags. Only
+ * ACCESS_NOREUSE and ACCESS_DROP_BEHIND have an effect on writes. */
+void file_put_contents(const char *filename, const char *buf, size_t sz, const char* access=default_write_access, int hints=ACCESS_NORMAL);
+
+template<class CharContainer, class=typename std::enable_if<std::is_class<CharContainer>::value>::type> // not for arrays of slices
+void file_put_contents(const char *filename, CharContainer const& v, const char* access=default_write_access, int hints=ACCESS_NORMAL)
+{
+    const char *str = v.empty() ? "" : v.data();
+    file_put_contents(filename, str, v.size(), access, hints);
+}
+
+/** write the slices to the file, one after the other, without first
+ * joining them into a single buffer. In POSIX, the slices are given
+ * to writev() in batches of up to IOV_MAX.
+ * @note in POSIX the access mode is used only to choose between
+ * truncating ("w"), appending ("a") and creating exclusively ("x");
+ * files are always written in binary mode */
+void file_put_contents(const char *filename, csubstr const* slices, size_t num_slices, const char* access=default_write_access);
+
+/** a type-erased handle to an array of containers of chars */
+struct slice_array
+{
+    const void *slices;
+    /** get the contents of the i-th container */
+    csubstr (*get)(const void *slices, size_t i);
+    csubstr operator[] (size_t i) const { return get(slices, i); }
+};
+
+template<class CharContainer>
+csubstr _get_char_container_slice(const void *slices, size_t i)
+{
+    CharContainer const& v = static_cast<CharContainer const*>(slices)[i];
+    return csubstr(v.empty() ? "" : v.data(), v.size());
+}
+
+void _file_put_slices(const char *filename, slice_array slices, size_t num_slices, const char* access);
+
+/** write the containers to the file, one after the other, without
+ * first joining them into a single buffer */
+template<class CharContainer>
+void file_put_contents(const char *filename, CharContainer const* slices, size_t num_slices, const char* access=default_write_access)
+{
+    _file_put_slices(filename, slice_array{slices, &_get_char_container_slice<CharContainer>}, num_slices, access);
+}
+
+
+/** how much of an atomic write survives a crash */
+typedef enum {
+    /** the file is replaced atomically, but nothing is synced: after
+     * a crash, the file may have its previous contents */
+    DURABILITY_NONE,
+    /** each file is synced (with fdatasync()) before it is renamed
+     * over the target, and its directory is synced after */
+    DURABILITY_FILE,
+    /** the pending writes of an AtomicWriteBatch are synced together
+     * on commit(), with a single syncfs() per filesystem (linux), and
+     * a single fsync() per directory. For a single file, this is the
+     * same as DURABILITY_FILE. */
+    DURABILITY_GROUP,
+} Durability_e;
+
+/** write the file atomically: the contents are written to a
+ * temporary file in the same directory, which is then renamed over
+ * the target. Readers see either the previous or the new contents,
+ * never a partial write.
+ * @note the new file has the default permissions, not those of the
+ * file it replaces */
+void file_put_contents_atomic(const char *filename, const char *buf, size_t sz, Durability_e durability=DURABILITY_NONE);
 
 template<class CharContainer>
-void file_put_contents(const char *filename, CharContainer const& v, const char* access=default_write_access)
+void file_put_contents_atomic(const char *filename, CharContainer const& v, Durability_e durability=DURABILITY_NONE)
 {
     const char *str = v.empty() ? "" : v.data();
-    file_put_contents(filename, str, v.size(), access);
+    file_put_contents_atomic(filename, str, v.size(), durability);
+}
+
+/** a batch of atomic writes, which are committed together, so that
+ * they can share the cost of syncing. put() writes the contents to a
+ * temporary file next to the target; commit() syncs the pending
+ * files (as set by the durability level) and renames them over their
+ * targets. put() and commit() can be called concurrently from many
+ * threads. The batch must be committed explicitly: writes which are
+ * pending on destruction are discarded, so that a batch abandoned
+ * (eg, by an exception thrown while it was being built) publishes
+ * nothing. */
+class AtomicWriteBatch
+{
+public:
+
+    explicit AtomicWriteBatch(Durability_e durability=DURABILITY_GROUP);
+    /** discards the pending writes */
+    ~AtomicWriteBatch();
+
+    AtomicWriteBatch(AtomicWriteBatch const&) = delete;
+    AtomicWriteBatch& operator=(AtomicWriteBatch const&) = delete;
+
+    /** write the contents to a temporary file, which replaces
+     * @p filename on commit(). Writing the same file twice in a
+     * batch is not supported. */
+    void put(const char *filename, const char *buf, size_t sz);
+    template<class CharContainer>
+    void put(const char *filename, CharContainer const& v)
+    {
+        put(filename, v.empty() ? "" : v.data(), v.size());
+    }
+
+    /** make the pending writes visible, and as durable as set by the
+     * durability level. If the files cannot be synced, nothing is
+     * replaced and the pending writes are dropped. Otherwise, the
+     * batch is atomic only file by file: when some of the targets
+     * cannot be replaced, the others still are, and the error names
+     * those which were not. */
+    void commit();
+    /** drop the pending writes, removing their temporary files */
+    void discard();
+    /** the number of writes waiting for commit() */
+    size_t pending() const;
+
+public:
+
+    struct _Impl;
+
+private:
+
+    _Impl *m_impl;
+
+};
+
+/** read many files into a single container. The files are first
+ * opened and sized in parallel, then the container is resized once to
+ * their total size, and then the files are read in parallel with
+ * pread(), each into its own slot of the container. Up to a few
+ * hundred files are kept open between the two passes; the others are
+ * opened again to be read.
+ * @param spans an array of @p num elements, receiving the contents of
+ * each file, pointing into the container. A file which cannot be read
+ * (or which is not a regular file) gets a span with a null str.
+ * A file is read up to its size at the time it was stat-ed, so files
+ * of unknown size (eg in /proc) are read as empty.
+ * @param num_threads the number of workers. 0 means the hardware
+ * concurrency; more threads than that help when the files are on
+ * slow (eg, network) filesystems.
+ * @return the size of the container */
+size_t read_many(const char *const* paths, size_t num, container_resizer arena, csubstr *spans, size_t num_threads=0);
+
+template<class CharContainer>
+size_t read_many(const char *const* paths, size_t num, CharContainer *arena, csubstr *spans, size_t num_threads=0)
+{
+    return read_many(paths, num, container_resizer{arena, &_resize_char_container<CharContainer>}, spans, num_threads);
+}
+
+/** @} */
+
+
+//-----------------------------------------------------------------------------
+
+/** @name direct I/O
+ *
+ * Reading and writing whole files bypassing the page cache (O_DIRECT
+ * in linux, F_NOCACHE in macos), so that large sequential transfers
+ * neither pay for the extra copy nor evict the cached pages of
+ * everything else. Direct I/O requires the memory, the file offsets
+ * and the sizes to be aligned to the logical block size of the
+ * device; the functions below deal with unaligned buffers and sizes
+ * by going through an aligned bounce buffer. When the filesystem does
+ * not support direct I/O, the file is transferred normally, and its
+ * pages are then dropped from the page cache. In windows, these are
+ * the same as file_get_contents() and file_put_contents(). */
+
+/** @{ */
+
+/** the alignment of the memory, offsets and sizes for direct I/O.
+ * This is the largest logical block size in common use, and the
+ * page size in most platforms. */
+constexpr const size_t direct_io_alignment = 4096;
+
+/** round up the size to a multiple of direct_io_alignment */
+constexpr size_t direct_io_size(size_t sz)
+{
+    return (sz + direct_io_alignment - 1) & ~(direct_io_alignment - 1);
+}
+
+/** allocate memory aligned to direct_io_alignment, which can be read
+ * into (or written from) without a bounce buffer. Release it with
+ * free_direct_buffer(). */
+void* alloc_direct_buffer(size_t sz);
+void free_direct_buffer(void *buf);
+
+/** read the whole file bypassing the page cache. The container is
+ * resized to the size of the file; when its data is aligned to
+ * direct_io_alignment, the file is read straight into it. Files of
+ * unknown size (eg pipes) are read as in file_get_contents().
+ * @return the size of the file */
+size_t file_get_contents_direct(const char *filename, container_resizer resizer);
+
+template<class CharContainer>
+size_t file_get_contents_direct(const char *filename, CharContainer *v)
+{
+    return file_get_contents_direct(filename, container_resizer{v, &_resize_char_container<CharContainer>});
+}
+
+/** write the file bypassing the page cache, creating or truncating
+ * it. When @p buf is aligned to direct_io_alignment, it is written
+ * without a bounce buffer. An unaligned tail is written as a full
+ * block, and the file is then truncated to @p sz. */
+void file_put_contents_direct(const char *filename, const char *buf, size_t sz);
+
+template<class CharContainer>
+void file_put_contents_direct(const char *filename, CharContainer const& v)
+{
+    const char *str = v.empty() ? "" : v.data();
+    file_put_contents_direct(filename, str, v.size());
 }
 
 /** @} */
@@ -292,8 +1043,12 @@ void file_put_contents(const char *filename, CharContainer const& v, const char*
 
 struct VisitedFile
 {
-    const char  *name;
+    const char  *name;       ///< the full path: the directory, a slash and the entry name
     void        *user_data;
+    size_t       name_len;   ///< the length of name
+    csubstr      entry_name; ///< the entry name, ie the part of name after the last slash
+    uint64_t     inode;      ///< the inode number of the entry, or 0 if not available
+    PathType_e   type;       ///< obtained from the directory entry, without stat-ing. INVALID when not provided by the filesystem.
 #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
     struct dirent *dirent_data;
 #elif defined(C4_WIN)
@@ -306,9 +1061,10 @@ struct VisitedPath
 {
     const char  *name;
     void        *user_data;
-    struct stat const* stat_data;
-    int                ftw_info;
+    struct stat const* stat_data; ///< null unless walk_options::stat was set
+    int                ftw_info;  ///< one of FTW_D, FTW_DNR, FTW_F, FTW_SL or FTW_NS
     struct FTW  const* ftw_data;
+    PathType_e         type;      ///< obtained from the directory entry, without stat-ing
 };
 #elif defined(C4_WIN)
 using VisitedPath = VisitedFile;
@@ -332,33 +1088,225 @@ struct maybe_buf
 };
 
 
-/** order is NOT guaranteed. Not recursive - does NOT descend into subdirectories. */
+/** order is NOT guaranteed. Not recursive - does NOT descend into subdirectories.
+ * @return false if the name buffer is too small (see its
+ * required_size), or if the directory could not be read to the end
+ * (eg, EIO, or it was removed meanwhile), in which case errno is set
+ * and the name buffer is valid. */
 bool walk_entries(const char *pathname, FileVisitor fn, maybe_buf<char> *namebuf, void *user_data=nullptr);
-/** order is NOT guaranteed. FIXME use maybe_buf */
+/** like walk_entries() above, but on linux the directory entries are
+ * read with getdents64() in batches into the given @p dirbuf, so that
+ * a larger buffer needs fewer syscalls for large directories (eg, 1MiB
+ * for directories with millions of entries). Buffers smaller than 1KiB
+ * are not used: the default buffer is used instead, and the minimum
+ * size is reported in the dirbuf's required_size. The buffer is
+ * ignored on other platforms. */
+bool walk_entries(const char *pathname, FileVisitor fn, maybe_buf<char> *namebuf, void *user_data, maybe_buf<char> *dirbuf);
+/** values returned by a PathVisitor to control the walk. Any other
+ * non-zero value also stops the walk, and is returned by the walk
+ * function. */
+typedef enum {
+    WALK_CONTINUE = 0,      ///< continue the walk
+    WALK_STOP = 1,          ///< stop the walk
+    WALK_SKIP_SUBTREE = -2, ///< when returned for a directory, do not walk into it (POSIX only)
+} WalkAction_e;
+
+/** options for walk_tree() and walk_tree_parallel() */
+struct walk_options
+{
+    /** when true, every entry is stat-ed, and VisitedPath::stat_data
+     * is filled. Otherwise, the type of the entries is obtained from
+     * the directory listing, and stat is called only for filesystems
+     * which do not provide it. */
+    bool stat;
+    /** walk_tree() only: the maximum number of directory file
+     * descriptors kept open at the same time. When the tree is
+     * deeper than this, the remaining entries of a directory are
+     * read into memory and the directory is closed before
+     * descending. */
+    size_t max_fds;
+    /** walk_tree_parallel() only: the number of threads used to walk
+     * the tree, including the calling thread. Use 0 for
+     * std::thread::hardware_concurrency(). */
+    size_t num_threads;
+    /** walk_tree_parallel() only: when true, the visitor is called
+     * only from the calling thread, after the whole tree was scanned,
+     * and the entries are delivered in depth-first order with the
+     * entries of each directory sorted by name. This requires keeping
+     * the whole tree in memory. When false, the visitor is called
+     * concurrently from the worker threads, as soon as the entries
+     * are found. */
+    bool ordered;
+
+    walk_options() : stat(false), max_fds(64), num_threads(0), ordered(false) {}
+};
+
+/** walk a directory tree, depth-first. Every directory is visited
+ * before its contents (except in windows, where it is visited after
+ * its contents). Order is NOT guaranteed within a directory. The
+ * visitor controls the walk by returning a WalkAction_e value.
+ *
+ * In POSIX, the walk uses file descriptors relative to the parent
+ * directory, and keeps no global state, so several walks can run
+ * concurrently.
+ *
+ * @return 0 if the whole tree was visited, or the non-zero value
+ * which stopped the walk. If a directory cannot be read to the end
+ * (eg, EIO, or ESTALE), the walk stops and returns -1 with errno
+ * set. */
+int walk_tree(const char *pathname, PathVisitor fn, walk_options const& opts, void *user_data=nullptr);
+/** walk a directory tree with the default options
+ * @see walk_tree(const char*, PathVisitor, walk_options const&, void*) */
 int walk_tree(const char *pathname, PathVisitor fn, void *user_data=nullptr);
 
+/** walk a directory tree, spreading the subdirectories across a pool
+ * of work-stealing threads. Like walk_tree(), every directory is
+ * visited before its contents, and the visitor controls the walk by
+ * returning a WalkAction_e value. Each thread keeps at most one
+ * directory open at a time.
+ *
+ * @warning unless opts.ordered is set, the visitor is called
+ * concurrently from several threads, so it (and its user_data) must
+ * be thread-safe.
+ *
+ * @return 0 if the whole tree was visited, or the first non-zero
+ * value returned by the visitor. */
+int walk_tree_parallel(const char *pathname, PathVisitor fn, walk_options const& opts, void *user_data=nullptr);
+
+/** options for EntryList::sort() */
+struct sort_options
+{
+    /** compare digit sequences by their numeric value, so that eg
+     * file2 comes before file10. Otherwise, the names are compared
+     * bytewise, as with strcmp(). */
+    bool natural;
+    /** the number of threads used to sort large lists. 0 means the
+     * hardware concurrency. */
+    size_t num_threads;
+    /** lists with fewer entries than this are sorted in the calling
+     * thread */
+    size_t parallel_threshold;
+    sort_options() : natural(false), num_threads(0), parallel_threshold(size_t(1) << 16) {}
+};
+
+/** flags to choose the metadata captured by a growable EntryList */
+typedef enum {
+    ENTRY_LENGTHS = 1, ///< capture EntryList::lengths
+    ENTRY_INODES = 2,  ///< capture EntryList::inodes
+    ENTRY_TYPES = 4,   ///< capture EntryList::types
+} EntryMetadata_e;
+
+/** a list of directory entries. The names are written to the arena,
+ * and the names list points at them.
+ *
+ * Optionally, the entry metadata obtained from the directory listing
+ * can also be captured, in arrays parallel to the names list: the name
+ * lengths, the inode numbers and the entry types. Each of these is
+ * captured only when its buffer is set (ie, non-null), and then it
+ * requires names.required_size elements. For example:
+ *
+ * @code
+ * char arena[4096];
+ * char *names[64];
+ * uint8_t types[64];
+ * EntryList el(arena, names);
+ * el.types = types;
+ * if(list_entries("dir", &el, &scratch))
+ *     for(size_t i = 0; i < el.size(); ++i)
+ *         if(el.type(i) == DIR)
+ *             ...
+ * @endcode
+ *
+ * The buffers are either given by the caller (and then a listing that
+ * does not fit fails and reports the required sizes), or are owned by
+ * the list and grown on demand from a memory resource; see
+ * EntryList(MemoryResource*, int).
+ */
 struct EntryList
 {
-    maybe_buf<char>  arena;   //!< arena where we write the file names
-    maybe_buf<char*> names;   //!< the names of the entries
+    maybe_buf<char>     arena;   //!< arena where we write the file names
+    maybe_buf<char*>    names;   //!< the names of the entries
+    maybe_buf<size_t>   lengths; //!< optional: the length of each name
+    maybe_buf<uint64_t> inodes;  //!< optional: the inode number of each entry (0 on windows)
+    maybe_buf<uint8_t>  types;   //!< optional: the PathType_e of each entry
+    MemoryResource     *resource; //!< when set, the list owns its buffers, and grows them from this resource
 
 public:
 
-    EntryList() : arena(), names() {}
+    EntryList() : arena(), names(), lengths(), inodes(), types(), resource() {}
     template<size_t name_arena_size, size_t name_list_size>
     EntryList(char (&name_arena)[name_arena_size], char *(&name_list)[name_list_size])
         : arena(name_arena, name_arena_size)
         , names(name_list, name_list_size)
+        , lengths()
+        , inodes()
+        , types()
+        , resource()
     {
     }
     EntryList(char *name_arena, size_t name_arena_size, char **name_list, size_t name_list_size)
         : arena(name_arena, name_arena_size)
         , names(name_list, name_list_size)
+        , lengths()
+        , inodes()
+        , types()
+        , resource()
     {
     }
+    /** create a growable list: its buffers are allocated from the
+     * given memory resource, and list_entries() grows them as needed,
+     * so that the listing always completes in a single pass.
+     * @param mr the memory resource. Use c4::get_memory_resource() for the default.
+     * @param metadata a combination of EntryMetadata_e flags, choosing
+     * which of the metadata arrays are captured */
+    explicit EntryList(MemoryResource *mr, int metadata=0);
+
+    ~EntryList();
+
+    /** copy a list built on caller buffers: the copy refers to the
+     * same buffers. Growable lists own their buffers, and cannot be
+     * copied (only moved). */
+    EntryList(EntryList const& that);
+    EntryList& operator=(EntryList const& that);
+
+    EntryList(EntryList && that) noexcept;
+    EntryList& operator=(EntryList && that) noexcept;
+
+    void reset()
+    {
+        arena.required_size = 0;
+        names.required_size = 0;
+        lengths.required_size = 0;
+        inodes.required_size = 0;
+        types.required_size = 0;
+    }
+    bool valid() const
+    {
+        return arena.valid() && names.valid()
+            && (lengths.buf == nullptr || lengths.valid())
+            && (inodes.buf == nullptr || inodes.valid())
+            && (types.buf == nullptr || types.valid());
+    }
+
+    /** the number of entries */
+    size_t size() const { C4_CHECK(valid()); return names.required_size; }
+    bool empty() const { return size() == 0; }
 
-    void reset() { arena.required_size = 0; names.required_size = 0; }
-    bool valid() const { return arena.valid() && names.valid(); }
+    csubstr name(size_t i) const
+    {
+        C4_CHECK(valid() && i < names.required_size);
+        return lengths.buf ? csubstr(names.buf[i], lengths.buf[i]) : to_csubstr(names.buf[i]);
+    }
+    uint64_t inode(size_t i) const
+    {
+        C4_CHECK(valid() && inodes.buf && i < names.required_size);
+        return inodes.buf[i];
+    }
+    PathType_e type(size_t i) const
+    {
+        C4_CHECK(valid() && types.buf && i < names.required_size);
+        return (PathType_e)types.buf[i];
+    }
 
 private:
 
@@ -407,18 +1355,198 @@ public:
     const_iterator begin() const { C4_CHECK(valid()); return {this, 0}; }
     const_iterator end() const { C4_CHECK(valid()); return {this, names.required_size}; }
 
-    void sort()
-    {
-        std::sort(begin(), end(),
-                  [](const char *lhs, const char *rhs){
-                      return strcmp(lhs, rhs) < 0;
-                  });
-    }
+    /** sort the entries by name. The metadata arrays are kept in
+     * sync with the names. */
+    void sort() { sort(sort_options()); }
+    void sort(sort_options const& opts);
 };
-/** order is NOT guaranteed. Not recursive - does NOT descend into subdirectories. */
+/** order is NOT guaranteed. Not recursive - does NOT descend into
+ * subdirectories. The entry metadata is taken from the directory
+ * listing; only when the filesystem does not provide the entry type
+ * (and the types are requested) is the entry stat-ed.
+ *
+ * When the list is growable, its buffers are grown during the listing,
+ * and if @p scratch is too small, a scratch buffer is allocated from
+ * the list's resource, so the directory is read only once; @p scratch
+ * may then be null. */
 bool list_entries(const char *pathname, EntryList *C4_RESTRICT entries, maybe_buf<char> *scratch);
 
 
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+/** @name chunked file reading */
+
+/** @{ */
+
+/** the chunk size suggested by file_read_chunks() when it is given
+ * an empty buffer */
+constexpr const size_t default_chunk_size = size_t(1) << 20;
+
+struct VisitedChunk
+{
+    csubstr      data;      ///< the chunk contents. Points into the scratch buffer, and is overwritten by the next chunk.
+    size_t       offset;    ///< the offset of the chunk from the start of the file
+    void        *user_data;
+};
+
+using ChunkVisitor = int (*)(VisitedChunk const& chunk);
+
+/** read a file sequentially in chunks, calling the visitor for each
+ * chunk. The chunks are read into the given buffer, which is reused
+ * for every chunk; every chunk is as large as the buffer, except
+ * possibly the last one. Nothing is allocated. The visitor can stop
+ * the reading by returning non-zero.
+ *
+ * If the buffer is empty, nothing is read, and its required_size is
+ * set to a suggested chunk size.
+ *
+ * @return true if the buffer was valid */
+bool file_read_chunks(const char *filename, maybe_buf<char> *scratch, ChunkVisitor fn, void *user_data=nullptr);
+
+/** @} */
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+/** @name asynchronous file operations */
+
+/** @{ */
+
+/** the operations of an AsyncEngine */
+typedef enum {
+    ASYNC_OPEN,   ///< open a file. The result is the file descriptor.
+    ASYNC_READ,   ///< read from a file at an offset. The result is the number of bytes read.
+    ASYNC_WRITE,  ///< write to a file at an offset. The result is the number of bytes written.
+    ASYNC_STAT,   ///< get the info of a path. The result is 0.
+    ASYNC_UNLINK, ///< remove a file. The result is 0.
+    ASYNC_CLOSE,  ///< close a file descriptor. The result is 0.
+} AsyncOp_e;
+
+/** the completion of an asynchronous operation */
+struct AsyncResult
+{
+    AsyncOp_e  op;
+    int64_t    result;    ///< on success, as described in AsyncOp_e. On failure, minus the errno.
+    void      *user_data;
+    bool ok() const { return result >= 0; }
+};
+
+using AsyncCallback = void (*)(AsyncResult const& r);
+
+/** options for AsyncEngine */
+struct async_options
+{
+    /** the maximum number of operations in flight */
+    size_t queue_depth;
+    /** use io_uring when the kernel provides it (linux only) */
+    bool use_io_uring;
+    /** the number of threads running the operations when io_uring is
+     * not used. 0 means the hardware concurrency. */
+    size_t num_threads;
+    async_options() : queue_depth(256), use_io_uring(true), num_threads(0) {}
+};
+
+/** runs file operations asynchronously. On linux, the operations are
+ * submitted in batches to an io_uring, so that a single thread can
+ * keep many operations in flight. Where io_uring is not available,
+ * the operations run in a pool of threads.
+ *
+ * The operations are queued by the functions below, and sent as a
+ * batch by submit(). Their callbacks are called from poll() or
+ * wait(), in the calling thread; a callback can queue more
+ * operations, but must not call submit(), poll(), wait() or drain().
+ * The paths and buffers given to an operation must stay
+ * valid until its callback is called.
+ *
+ * An engine is not thread-safe: use one engine per thread. */
+class AsyncEngine
+{
+public:
+
+    explicit AsyncEngine(async_options const& opts=async_options());
+    /** completes the pending operations, calling their callbacks */
+    ~AsyncEngine();
+
+    AsyncEngine(AsyncEngine const&) = delete;
+    AsyncEngine& operator=(AsyncEngine const&) = delete;
+
+    /** true if the operations are run by io_uring */
+    bool uses_io_uring() const;
+
+public:
+
+    /** @param flags the flags to ::open() */
+    void open(const char *pathname, int flags, unsigned mode, AsyncCallback cb, void *user_data=nullptr);
+    /** like pread(), this may read fewer bytes than requested */
+    void read(int fd, void *buf, size_t sz, uint64_t offset, AsyncCallback cb, void *user_data=nullptr);
+    /** like pwrite(), this may write fewer bytes than requested */
+    void write(int fd, const void *buf, size_t sz, uint64_t offset, AsyncCallback cb, void *user_data=nullptr);
+    /** @param info receives the info of the path
+     * @param mask a combination of PathInfo_e */
+    void stat(const char *pathname, path_info *info, int mask, AsyncCallback cb, void *user_data=nullptr);
+    void unlink(const char *pathname, AsyncCallback cb, void *user_data=nullptr);
+    void close(int fd, AsyncCallback cb, void *user_data=nullptr);
+
+public:
+
+    /** send the queued operations
+     * @return the number of operations sent */
+    size_t submit();
+    /** call the callbacks of the completed operations, without
+     * blocking
+     * @return the number of callbacks called */
+    size_t poll();
+    /** submit the queued operations, and call the callbacks of at
+     * least @p min_completions operations, blocking as needed. Returns
+     * earlier if no operations are left.
+     * @return the number of callbacks called */
+    size_t wait(size_t min_completions=1);
+    /** submit and wait until no operations are left */
+    void drain();
+    /** the number of operations queued or in flight */
+    size_t pending() const;
+
+public:
+
+    struct _Impl;
+
+private:
+
+    _Impl *m_impl;
+
+};
+
+/** read the whole file asynchronously into a container, resized
+ * as in file_get_contents(). The file is opened and stat-ed in the same
+ * batch, and then read and closed. The filename and the container
+ * must stay valid until the callback is called.
+ * The callback receives ASYNC_READ, with the size of the file as the
+ * result. */
+void file_get_contents_async(AsyncEngine *engine, const char *filename, container_resizer resizer, AsyncCallback cb, void *user_data=nullptr);
+
+template<class CharContainer>
+void file_get_contents_async(AsyncEngine *engine, const char *filename, CharContainer *v, AsyncCallback cb, void *user_data=nullptr)
+{
+    file_get_contents_async(engine, filename, container_resizer{v, &_resize_char_container<CharContainer>}, cb, user_data);
+}
+
+/** write the buffer asynchronously to the file, which is created or
+ * truncated. The buffer must stay valid until the callback is called.
+ * The callback receives ASYNC_WRITE, with the number of bytes written
+ * as the result. */
+void file_put_contents_async(AsyncEngine *engine, const char *filename, const char *buf, size_t sz, AsyncCallback cb, void *user_data=nullptr);
+
+/** remove the file asynchronously. The callback receives
+ * ASYNC_UNLINK. */
+void rmfile_async(AsyncEngine *engine, const char *filename, AsyncCallback cb, void *user_data=nullptr);
+
+/** @} */
+
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -499,6 +1627,72 @@ public:
 
 };
 
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+/** a read-only memory-mapped view of a file. The file is unmapped in
+ * the dtor.
+ *
+ * Mappings are shared with the page cache, so several processes
+ * mapping the same file will share the same physical pages. The file
+ * must be a regular file; files of zero length result in an empty
+ * (but non-null) view. */
+struct MappedFile
+{
+    const char *m_data;
+    size_t m_size;
+#if defined(C4_WIN)
+    void *m_file;
+    void *m_mapping;
+#endif
+
+public:
+
+    csubstr view() const { return csubstr(m_data, m_size); }
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    bool valid() const { return m_data != nullptr; }
+
+    /** advise the OS on how the contents will be accessed.
+     * @param hints a combination of AccessHint_e flags
+     * @return true if all the hints were accepted */
+    bool advise(int hints) const;
+
+    /** unmap the file */
+    void unmap();
+
+public:
+
+    ~MappedFile() { unmap(); }
+
+    MappedFile(MappedFile const&) noexcept = delete;
+    MappedFile& operator=(MappedFile const&) noexcept = delete;
+
+    MappedFile(MappedFile && that) noexcept { _move(&that); }
+    MappedFile& operator=(MappedFile && that) noexcept
+    {
+        if(this != &that)
+        {
+            unmap();
+            _move(&that);
+        }
+        return *this;
+    }
+
+    void _move(MappedFile *that);
+
+public:
+
+    MappedFile() noexcept;
+    /** map the whole file
+     * @param hints a combination of AccessHint_e flags */
+    explicit MappedFile(const char *filename, int hints=ACCESS_NORMAL);
+
+};
+
 C4_SUPPRESS_WARNING_GCC_CLANG_POP
 
 } // namespace fs
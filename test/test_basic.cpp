@@ -1,11 +1,24 @@
 #include <c4/fs/fs.hpp>
 #include <c4/std/std.hpp>
 #include <c4/substr.hpp>
+#include <c4/memory_resource.hpp>
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+#include <ftw.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef _MSC_VER
 #   pragma warning(push)
@@ -128,6 +141,203 @@ TEST_CASE("path_times")
     // CHECK_GT(t1.access, t0.access); // not required by the system
 }
 
+TEST_CASE("path_info")
+{
+    auto dir = ScopedTestDir();
+    std::string file = std::string(dir) + "/file";
+    SUBCASE("missing")
+    {
+        path_info pi = info(file.c_str());
+        CHECK(!pi.exists());
+        CHECK_EQ(pi.mask, 0);
+        CHECK_EQ(pi.type, INVALID);
+    }
+    SUBCASE("file")
+    {
+        file_put_contents(file.c_str(), csubstr("THE CONTENTS"));
+        path_info pi = info(file.c_str());
+        CHECK(pi.exists());
+        const int basic = INFO_TYPE|INFO_SIZE|INFO_INODE|INFO_MTIME|INFO_ATIME|INFO_CTIME;
+        CHECK_EQ(pi.mask & basic, basic);
+        CHECK_EQ(pi.type, REGFILE);
+        CHECK_EQ(pi.size, 12u);
+        CHECK_EQ(file_size(file.c_str()), 12u);
+        CHECK_EQ(pi.mtime_ns / UINT64_C(1000000000), mtime(file.c_str()));
+        CHECK_EQ(pi.ctime_ns / UINT64_C(1000000000), ctime(file.c_str()));
+        #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+        struct stat st;
+        REQUIRE_EQ(stat(file.c_str(), &st), 0);
+        CHECK_EQ(pi.inode, static_cast<uint64_t>(st.st_ino));
+        #endif
+        // the cached info is the same
+        StatCache cache;
+        path_info cached = info(file.c_str(), &cache);
+        CHECK_EQ(cached.type, pi.type);
+        CHECK_EQ(cached.size, pi.size);
+        CHECK_EQ(cached.inode, pi.inode);
+        CHECK_EQ(cached.mtime_ns, pi.mtime_ns);
+        #ifdef C4_LINUX
+        // sub-second precision
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        file_put_contents(file.c_str(), csubstr("OTHER CONTENTS"));
+        path_info pi2 = info(file.c_str(), INFO_MTIME|INFO_SIZE);
+        CHECK(pi2.mask & INFO_MTIME);
+        CHECK_GT(pi2.mtime_ns, pi.mtime_ns);
+        CHECK_EQ(pi2.size, 14u);
+        #endif
+        rmfile(file.c_str());
+    }
+    SUBCASE("dir")
+    {
+        path_info pi = info(dir, INFO_TYPE);
+        CHECK(pi.exists());
+        CHECK(pi.mask & INFO_TYPE);
+        CHECK_EQ(pi.type, DIR);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+TEST_CASE("StatCache.basic")
+{
+    StatCache cache;
+    auto dir = ScopedTestDir();
+    std::string file = std::string(dir) + "/file";
+    // the missing path is memoized
+    CHECK_FALSE(path_exists(file.c_str(), &cache));
+    CHECK_EQ(cache.size(), 1u);
+    file_put_contents(file.c_str(), csubstr("asd"));
+    CHECK(path_exists(file.c_str()));
+    CHECK_FALSE(path_exists(file.c_str(), &cache));
+    CHECK_FALSE(file_exists(file.c_str(), &cache));
+    cache.invalidate(file.c_str());
+    CHECK_EQ(cache.size(), 0u);
+    CHECK(path_exists(file.c_str(), &cache));
+    CHECK(file_exists(file.c_str(), &cache));
+    CHECK(is_file(file.c_str(), &cache));
+    CHECK_FALSE(dir_exists(file.c_str(), &cache));
+    CHECK_EQ(path_type(file.c_str(), &cache), REGFILE);
+    CHECK_EQ(mtime(file.c_str(), &cache), mtime(file.c_str()));
+    CHECK_EQ(times(file.c_str(), &cache).modification, mtime(file.c_str()));
+    CHECK(dir_exists(dir, &cache));
+    CHECK(is_dir(dir, &cache));
+    CHECK_EQ(cache.size(), 2u);
+    // a null cache stats directly
+    CHECK(file_exists(file.c_str(), nullptr));
+    rmfile(file.c_str());
+    CHECK(file_exists(file.c_str(), &cache));
+    cache.clear();
+    CHECK_EQ(cache.size(), 0u);
+    CHECK_FALSE(file_exists(file.c_str(), &cache));
+}
+
+TEST_CASE("StatCache.invalidate_tree")
+{
+    StatCache cache;
+    const char *paths[] = {"c4fdx", "c4fdx/a", "c4fdx/a/b", "c4fdx/ab", "c4fdxy"};
+    for(const char *p : paths)
+        CHECK_FALSE(path_exists(p, &cache));
+    CHECK_EQ(cache.size(), 5u);
+    cache.invalidate_tree("c4fdx/a/");
+    CHECK_EQ(cache.size(), 3u); // c4fdx, c4fdx/ab, c4fdxy
+    cache.invalidate_tree("c4fdx");
+    CHECK_EQ(cache.size(), 1u); // c4fdxy
+    cache.invalidate_tree("/");
+    CHECK_EQ(cache.size(), 1u); // relative paths are not below /
+}
+
+TEST_CASE("StatCache.ttl")
+{
+    StatCache cache(/*ttl_ns*/UINT64_C(1000000));
+    auto dir = ScopedTestDir();
+    std::string file = std::string(dir) + "/file";
+    CHECK_FALSE(file_exists(file.c_str(), &cache));
+    file_put_contents(file.c_str(), csubstr("asd"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(file_exists(file.c_str(), &cache));
+    rmfile(file.c_str());
+}
+
+TEST_CASE("StatCache.ttl_expired_entries_are_replaced")
+{
+    StatCache cache(/*ttl_ns*/UINT64_C(1000));
+    auto dir = ScopedTestDir();
+    std::string file = std::string(dir) + "/file";
+    for(size_t i = 0; i < 10; ++i)
+    {
+        CHECK_FALSE(file_exists(file.c_str(), &cache));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK_EQ(cache.size(), 1u);
+}
+
+TEST_CASE("StatCache.invalidate_races_stat")
+{
+    StatCache cache;
+    auto dir = ScopedTestDir();
+    std::string file = std::string(dir) + "/file";
+    for(size_t rep = 0; rep < 200; ++rep)
+    {
+        file_put_contents(file.c_str(), csubstr("asd"));
+        CHECK(file_exists(file.c_str(), &cache));
+        std::atomic<bool> done(false);
+        std::thread reader([&]{
+            while(!done.load())
+            {
+                file_exists(file.c_str(), &cache);
+                cache.invalidate(file.c_str()); // force a fresh stat
+            }
+        });
+        std::thread stater([&]{
+            while(!done.load())
+                file_exists(file.c_str(), &cache);
+        });
+        rmfile(file.c_str());
+        cache.invalidate(file.c_str());
+        done = true;
+        reader.join();
+        stater.join();
+        // no stat which started before the removal may have been stored
+        CHECK_FALSE(file_exists(file.c_str(), &cache));
+        cache.clear();
+    }
+}
+
+TEST_CASE("StatCache.concurrent")
+{
+    StatCache cache(0, 4);
+    auto dir = ScopedTestDir();
+    std::vector<std::string> files;
+    for(size_t i = 0; i < 50; ++i)
+    {
+        files.push_back(std::string(dir) + "/file" + std::to_string(i));
+        if(i % 2)
+            file_put_contents(files.back().c_str(), csubstr("asd"));
+    }
+    std::vector<std::thread> threads;
+    std::vector<size_t> counts(8);
+    for(size_t t = 0; t < counts.size(); ++t)
+    {
+        threads.emplace_back([&files, &cache, &counts, t]{
+            for(size_t rep = 0; rep < 100; ++rep)
+                for(size_t i = 0; i < files.size(); ++i)
+                    if(file_exists(files[i].c_str(), &cache))
+                        ++counts[t];
+            cache.invalidate(files[t].c_str());
+        });
+    }
+    for(std::thread &t : threads)
+        t.join();
+    for(size_t count : counts)
+        CHECK_EQ(count, 100u * 25u);
+    for(std::string const& f : files)
+        if(file_exists(f.c_str()))
+            rmfile(f.c_str());
+}
+
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -198,6 +408,81 @@ TEST_CASE("mkdirs.basic")
     CHECK_FALSE(dir_exists("c4fdx"));
 }
 
+TEST_CASE("mkdirs.existing_prefix")
+{
+    if(dir_exists("c4fdx"))
+        CHECK_EQ(rmtree("c4fdx"), 0);
+    CHECK_EQ(mkdir("c4fdx"), 0);
+    CHECK_EQ(mkdir("c4fdx/a"), 0);
+    char buf[32] = "c4fdx/a/b//c/\0";
+    mkdirs(buf);
+    CHECK_EQ(csubstr(buf), "c4fdx/a/b//c/"); // the buffer is restored
+    CHECK(dir_exists("c4fdx/a/b"));
+    CHECK(dir_exists("c4fdx/a/b/c"));
+    char again[32] = "c4fdx/a/b/c\0";
+    mkdirs(again);
+    CHECK(dir_exists("c4fdx/a/b/c"));
+    CHECK_EQ(rmtree("c4fdx"), 0);
+}
+
+TEST_CASE("mkdirs_many")
+{
+    if(dir_exists("c4fdx"))
+        CHECK_EQ(rmtree("c4fdx"), 0);
+    SUBCASE("shared_prefixes")
+    {
+        const char *paths[] = {
+            "c4fdx/a/b/c",
+            "c4fdx/a/b",
+            "c4fdx/a-b/c",
+            "./c4fdx/a/b/d/",
+            "c4fdx//a/e",
+            "c4fdx/a/b/c",
+            "c4fdx/f",
+        };
+        mkdirs_stats stats;
+        CHECK_EQ(mkdirs_many(paths, C4_COUNTOF(paths), &stats), 0);
+        CHECK_EQ(stats.created, 9u);
+        CHECK_EQ(stats.errors, 0u);
+        for(const char *dir : {"c4fdx/a/b/c", "c4fdx/a/b/d", "c4fdx/a-b/c", "c4fdx/a/e", "c4fdx/f"})
+            CHECK(dir_exists(dir));
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+        {
+            INFO("same mode as mkdirs()");
+            char buf[] = "c4fdx/g/h";
+            mkdirs(buf);
+            struct stat st, st_mkdirs;
+            CHECK_EQ(::stat("c4fdx/a/b/c", &st), 0);
+            CHECK_EQ(::stat("c4fdx/g/h", &st_mkdirs), 0);
+            CHECK_EQ(st.st_mode & 07777, st_mkdirs.st_mode & 07777);
+            CHECK_EQ(rmtree("c4fdx/g"), 0);
+        }
+#endif
+        // everything exists now
+        CHECK_EQ(mkdirs_many(paths, C4_COUNTOF(paths), &stats), 0);
+        CHECK_EQ(stats.created, 0u);
+        CHECK_EQ(stats.errors, 0u);
+    }
+    SUBCASE("file_in_the_way")
+    {
+        CHECK_EQ(mkdir("c4fdx"), 0);
+        file_put_contents("c4fdx/file", csubstr("THE CONTENTS"));
+        const char *paths[] = {"c4fdx/file/a", "c4fdx/file", "c4fdx/dir/a"};
+        mkdirs_stats stats;
+        CHECK_NE(mkdirs_many(paths, C4_COUNTOF(paths), &stats), 0);
+        CHECK_EQ(stats.errors, 2u);
+        CHECK_EQ(stats.created, 2u);
+        CHECK(file_exists("c4fdx/file"));
+        CHECK(dir_exists("c4fdx/dir/a"));
+    }
+    SUBCASE("empty")
+    {
+        CHECK_EQ(mkdirs_many(nullptr, 0), 0);
+    }
+    if(dir_exists("c4fdx"))
+        CHECK_EQ(rmtree("c4fdx"), 0);
+}
+
 TEST_CASE("rmfile")
 {
     SUBCASE("existing")
@@ -282,6 +567,413 @@ TEST_CASE("rmtree")
     }
 }
 
+namespace {
+struct RmtreeProgressLog
+{
+    std::mutex mtx;
+    std::vector<rmtree_stats> reports;
+    static void report(rmtree_stats const& stats, void *user_data)
+    {
+        RmtreeProgressLog *log = static_cast<RmtreeProgressLog*>(user_data);
+        std::lock_guard<std::mutex> lock(log->mtx);
+        log->reports.push_back(stats);
+    }
+};
+/** count the files and directories of a tree, including its root */
+void count_tree(const char *pathname, size_t *num_files, size_t *num_dirs)
+{
+    std::pair<size_t, size_t> counts = {};
+    walk_tree(pathname, [](VisitedPath const& p){
+        auto *c = static_cast<std::pair<size_t, size_t>*>(p.user_data);
+        if(is_dir(p.name))
+            ++c->second;
+        else
+            ++c->first;
+        return 0;
+    }, &counts);
+    *num_files = counts.first;
+    *num_dirs = counts.second;
+}
+} // namespace
+
+TEST_CASE("rmtree_parallel")
+{
+    for(size_t num_threads : {size_t(1), size_t(4)})
+    {
+        INFO("num_threads=" << num_threads);
+        rmtree_options opts;
+        opts.num_threads = num_threads;
+        {
+            auto treename = _make_tree();
+            size_t num_files, num_dirs;
+            count_tree(treename, &num_files, &num_dirs);
+            REQUIRE_GT(num_files, 0u);
+            REQUIRE_GT(num_dirs, 1u);
+            rmtree_stats stats = {};
+            CHECK_EQ(rmtree_parallel(treename, opts, &stats), 0);
+            CHECK(!path_exists(treename));
+            #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+            CHECK_EQ(stats.files, num_files);
+            CHECK_EQ(stats.dirs, num_dirs);
+            CHECK_EQ(stats.errors, 0u);
+            #endif
+        }
+        { // a wide tree, with progress reports
+            mkdir("c4fs_rmtree");
+            for(size_t i = 0; i < 20; ++i)
+            {
+                std::string dir = "c4fs_rmtree/d" + std::to_string(i);
+                mkdir(dir.c_str());
+                for(size_t j = 0; j < 50; ++j)
+                    file_put_contents((dir + "/f" + std::to_string(j)).c_str(), dir);
+            }
+            RmtreeProgressLog log;
+            opts.progress = &RmtreeProgressLog::report;
+            opts.user_data = &log;
+            opts.progress_interval = 100;
+            rmtree_stats stats = {};
+            CHECK_EQ(rmtree_parallel("c4fs_rmtree", opts, &stats), 0);
+            CHECK(!path_exists("c4fs_rmtree"));
+            #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+            CHECK_EQ(stats.files, 1000u);
+            CHECK_EQ(stats.dirs, 21u);
+            CHECK_GE(log.reports.size(), 1u);
+            for(rmtree_stats const& r : log.reports)
+                CHECK_LE(r.files + r.dirs, stats.files + stats.dirs);
+            #endif
+            opts.progress = nullptr;
+        }
+    }
+    SUBCASE("file")
+    {
+        file_put_contents("c4fs_rmtree_file", csubstr("contents"));
+        rmtree_stats stats = {};
+        CHECK_EQ(rmtree_parallel("c4fs_rmtree_file", rmtree_options{}, &stats), 0);
+        CHECK(!path_exists("c4fs_rmtree_file"));
+        #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+        CHECK_EQ(stats.files, 1u);
+        #endif
+    }
+    SUBCASE("nonexisting")
+    {
+        CHECK(!path_exists("nonexisting"));
+        CHECK_NE(rmtree_parallel("nonexisting"), 0);
+    }
+    #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    SUBCASE("symlink")
+    {
+        // the link is removed, not the tree it points at
+        auto treename = _make_tree();
+        mkdir("c4fs_rmtree_links");
+        REQUIRE_EQ(::symlink("../c4fdx", "c4fs_rmtree_links/tree"), 0);
+        CHECK_EQ(rmtree_parallel("c4fs_rmtree_links"), 0);
+        CHECK(!path_exists("c4fs_rmtree_links"));
+        CHECK(file_exists("c4fdx/a/file1"));
+        CHECK_EQ(rmtree(treename), 0);
+    }
+    SUBCASE("permission_denied")
+    {
+        if(::geteuid() == 0)
+            return; // root can remove anything
+        mkdir("c4fs_rmtree_ro");
+        mkdir("c4fs_rmtree_ro/sub");
+        file_put_contents("c4fs_rmtree_ro/sub/file", csubstr("contents"));
+        file_put_contents("c4fs_rmtree_ro/file", csubstr("contents"));
+        REQUIRE_EQ(::chmod("c4fs_rmtree_ro/sub", 0555), 0);
+        rmtree_stats stats = {};
+        CHECK_NE(rmtree_parallel("c4fs_rmtree_ro", rmtree_options{}, &stats), 0);
+        CHECK_EQ(errno, EACCES);
+        CHECK_GE(stats.errors, 1u);
+        CHECK_EQ(stats.files, 1u);
+        CHECK(file_exists("c4fs_rmtree_ro/sub/file"));
+        REQUIRE_EQ(::chmod("c4fs_rmtree_ro/sub", 0755), 0);
+        CHECK_EQ(rmtree_parallel("c4fs_rmtree_ro"), 0);
+    }
+    #endif
+}
+
+size_t count_dir_entries(const char *dirname)
+{
+    char buf_[256];
+    maybe_buf<char> buf(buf_);
+    size_t count = 0;
+    CHECK(walk_entries(dirname, [](VisitedFile const& p){
+        ++*static_cast<size_t*>(p.user_data);
+        return 0;
+    }, &buf, &count));
+    return count;
+}
+
+TEST_CASE("TrashCan")
+{
+    mkdir("c4fs_trash_ws");
+    SUBCASE("remove")
+    {
+        TrashCan trash;
+        auto treename = _make_tree();
+        size_t num_files, num_dirs;
+        count_tree(treename, &num_files, &num_dirs);
+        CHECK_EQ(trash.remove(treename), 0);
+        CHECK(!path_exists(treename));
+        file_put_contents("c4fs_trash_file", csubstr("contents"));
+        CHECK_EQ(trash.remove("c4fs_trash_file"), 0);
+        CHECK(!path_exists("c4fs_trash_file"));
+        trash.wait();
+        CHECK_EQ(trash.pending(), 0u);
+        CHECK_FALSE(path_exists(default_trash_dirname)); // removed once empty
+        rmtree_stats stats = trash.stats();
+        #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+        CHECK_EQ(stats.files, num_files + 1);
+        CHECK_EQ(stats.dirs, num_dirs);
+        #endif
+        CHECK_EQ(stats.errors, 0u);
+    }
+    SUBCASE("nonexisting")
+    {
+        TrashCan trash("c4fs_trash_dir");
+        CHECK_NE(trash.remove("c4fs_trash_ws/nonexisting"), 0);
+        CHECK_EQ(trash.pending(), 0u);
+    }
+    SUBCASE("many")
+    {
+        TrashCan trash("c4fs_trash_dir", 2);
+        for(size_t i = 0; i < 10; ++i)
+        {
+            std::string ws = "c4fs_trash_ws/ws" + std::to_string(i);
+            mkdir(ws.c_str());
+            mkdir((ws + "/sub").c_str());
+            for(size_t j = 0; j < 20; ++j)
+                file_put_contents((ws + "/sub/f" + std::to_string(j)).c_str(), ws);
+            CHECK_EQ(trash.remove((ws + "/").c_str()), 0); // with a trailing slash
+            CHECK(!path_exists(ws.c_str()));
+        }
+        CHECK_LE(count_dir_entries("c4fs_trash_ws"), 1u); // the trash, unless it was already reclaimed
+        trash.wait();
+        CHECK_FALSE(path_exists("c4fs_trash_ws/c4fs_trash_dir"));
+        #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+        CHECK_EQ(trash.stats().files, 200u);
+        CHECK_EQ(trash.stats().dirs, 20u);
+        #endif
+    }
+    SUBCASE("recover")
+    {
+        // trash left by a previous process
+        mkdir("c4fs_trash_ws/c4fs_trash_dir");
+        for(size_t i = 0; i < 3; ++i)
+        {
+            std::string t = "c4fs_trash_ws/c4fs_trash_dir/left" + std::to_string(i);
+            mkdir(t.c_str());
+            file_put_contents((t + "/file").c_str(), t);
+        }
+        file_put_contents("c4fs_trash_ws/c4fs_trash_dir/leftfile", csubstr("contents"));
+        {
+            TrashCan trash("c4fs_trash_dir");
+            CHECK_EQ(trash.recover("c4fs_trash_ws"), 4u);
+            CHECK_EQ(trash.recover("c4fs_trash_ws/nonexisting"), 0u);
+        } // the destructor finishes the removals
+        CHECK_FALSE(path_exists("c4fs_trash_ws/c4fs_trash_dir"));
+    }
+    SUBCASE("recover_skips_own_trash")
+    {
+        TrashCan trash("c4fs_trash_dir");
+        for(size_t i = 0; i < 4; ++i)
+        {
+            std::string t = "c4fs_trash_ws/tree" + std::to_string(i);
+            mkdir(t.c_str());
+            for(size_t j = 0; j < 50; ++j)
+                file_put_contents((t + "/f" + std::to_string(j)).c_str(), t);
+            CHECK_EQ(trash.remove(t.c_str()), 0);
+        }
+        // whatever is still in the trash was queued by this TrashCan
+        CHECK_EQ(trash.recover("c4fs_trash_ws"), 0u);
+        trash.wait();
+        CHECK_EQ(trash.stats().errors, 0u);
+        CHECK_FALSE(path_exists("c4fs_trash_ws/c4fs_trash_dir"));
+    }
+    SUBCASE("rmtree_async")
+    {
+        mkdir("c4fs_trash_ws/tree");
+        file_put_contents("c4fs_trash_ws/tree/file", csubstr("contents"));
+        CHECK_EQ(rmtree_async("c4fs_trash_ws/tree"), 0);
+        CHECK(!path_exists("c4fs_trash_ws/tree"));
+        rmtree_async_wait();
+        CHECK_FALSE(path_exists(("c4fs_trash_ws/" + std::string(default_trash_dirname)).c_str()));
+        CHECK_EQ(rmtree_async_recover("c4fs_trash_ws"), 0u);
+    }
+    CHECK_EQ(rmtree("c4fs_trash_ws"), 0);
+}
+
+TEST_CASE("stat_many")
+{
+    auto treename = _make_tree();
+    std::vector<std::string> strings;
+    walk_tree(treename, [](VisitedPath const& p){
+        static_cast<std::vector<std::string>*>(p.user_data)->emplace_back(p.name);
+        return 0;
+    }, &strings);
+    const size_t num_existing = strings.size();
+    std::vector<bool> exists(num_existing, true);
+    strings.emplace_back("c4fdx/nonexisting");          exists.push_back(false);
+    strings.emplace_back("c4fdx/nonexisting_dir/file"); exists.push_back(false);
+    strings.emplace_back("c4fdx/");                     exists.push_back(true);
+    strings.emplace_back("c4fdx");                      exists.push_back(true);
+    strings.emplace_back("nonexisting");                exists.push_back(false);
+    strings.emplace_back(cwd<std::string>() + "/c4fdx/a"); exists.push_back(true);
+    std::vector<const char*> paths;
+    for(std::string const& str : strings)
+        paths.push_back(str.c_str());
+    for(size_t num_threads : {size_t(1), size_t(4)})
+    {
+        INFO("num_threads=" << num_threads);
+        std::vector<path_info> results(paths.size());
+        stat_many(paths.data(), paths.size(), results.data(), INFO_ALL, num_threads);
+        for(size_t i = 0; i < paths.size(); ++i)
+        {
+            INFO("path=" << paths[i]);
+            path_info expected = info(paths[i]);
+            CHECK_EQ(results[i].exists(), exists[i]);
+            CHECK_EQ(results[i].mask, expected.mask);
+            CHECK_EQ(results[i].type, expected.type);
+            CHECK_EQ(results[i].inode, expected.inode);
+            CHECK_EQ(results[i].size, expected.size);
+            CHECK_EQ(results[i].mtime_ns, expected.mtime_ns);
+        }
+    }
+    stat_many(nullptr, 0, nullptr);
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+TEST_CASE("read_many")
+{
+    auto treename = _make_tree();
+    std::vector<std::string> strings;
+    walk_tree(treename, [](VisitedPath const& p){
+        static_cast<std::vector<std::string>*>(p.user_data)->emplace_back(p.name);
+        return 0;
+    }, &strings);
+    file_put_contents("c4fdx/a/empty", csubstr{});
+    strings.emplace_back("c4fdx/a/empty");
+    strings.emplace_back("c4fdx/nonexisting");
+    std::vector<const char*> paths;
+    for(std::string const& str : strings)
+        paths.push_back(str.c_str());
+    for(size_t num_threads : {size_t(1), size_t(4)})
+    {
+        INFO("num_threads=" << num_threads);
+        std::string arena = "previous contents";
+        std::vector<csubstr> spans(paths.size());
+        size_t total = read_many(paths.data(), paths.size(), &arena, spans.data(), num_threads);
+        CHECK_EQ(total, arena.size());
+        size_t expected_total = 0;
+        for(size_t i = 0; i < paths.size(); ++i)
+        {
+            INFO("path=" << paths[i]);
+            if(file_exists(paths[i]))
+            {
+                std::string expected = file_get_contents<std::string>(paths[i]);
+                expected_total += expected.size();
+                REQUIRE_NE(spans[i].str, nullptr);
+                CHECK_EQ(spans[i], to_csubstr(expected));
+                if(!expected.empty())
+                {
+                    CHECK_GE(spans[i].str, arena.data());
+                    CHECK_LE(spans[i].str + spans[i].len, arena.data() + arena.size());
+                }
+            }
+            else // directories and missing files
+            {
+                CHECK_EQ(spans[i].str, nullptr);
+            }
+        }
+        CHECK_EQ(total, expected_total);
+    }
+    SUBCASE("empty_files")
+    {
+        const char *empty[] = {"c4fdx/a/empty", "c4fdx/a/empty"};
+        std::vector<char> arena(10);
+        csubstr spans[2];
+        CHECK_EQ(read_many(empty, 2, &arena, spans), 0u);
+        CHECK(arena.empty());
+        for(csubstr span : spans)
+        {
+            CHECK_NE(span.str, nullptr);
+            CHECK_EQ(span.len, 0u);
+        }
+    }
+    std::string arena;
+    CHECK_EQ(read_many(nullptr, 0, &arena, nullptr), 0u);
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+namespace {
+/** a container with aligned storage, to exercise the direct reads
+ * which skip the bounce buffer */
+struct aligned_chars
+{
+    char *buf = nullptr;
+    size_t size = 0;
+    ~aligned_chars() { free_direct_buffer(buf); }
+    static char* resize(void *container, size_t sz)
+    {
+        aligned_chars *ac = static_cast<aligned_chars*>(container);
+        if(sz > direct_io_size(ac->size))
+        {
+            free_direct_buffer(ac->buf);
+            ac->buf = static_cast<char*>(alloc_direct_buffer(direct_io_size(sz)));
+        }
+        ac->size = sz;
+        return ac->buf;
+    }
+};
+} // namespace
+
+TEST_CASE("file_contents_direct")
+{
+    const char filename[] = "c4fs_direct.bin";
+    CHECK_EQ(direct_io_size(0), 0u);
+    CHECK_EQ(direct_io_size(1), direct_io_alignment);
+    CHECK_EQ(direct_io_size(direct_io_alignment), direct_io_alignment);
+    CHECK_EQ(direct_io_size(direct_io_alignment + 1), 2 * direct_io_alignment);
+    void *mem = alloc_direct_buffer(3 * direct_io_alignment);
+    CHECK_EQ(reinterpret_cast<uintptr_t>(mem) % direct_io_alignment, 0u);
+    free_direct_buffer(mem);
+    free_direct_buffer(nullptr);
+    const size_t a = direct_io_alignment;
+    for(size_t sz : {size_t(0), size_t(1), a - 1, a, a + 1, 3 * a + 5, (size_t(3) << 20) + 123})
+    {
+        INFO("sz=" << sz);
+        std::string contents(sz + 1, '\0');
+        for(size_t i = 0; i < contents.size(); ++i)
+            contents[i] = static_cast<char>('a' + i % 23);
+        { // from an unaligned address
+            file_put_contents_direct(filename, contents.data() + 1, sz);
+            CHECK_EQ(file_size(filename), sz);
+            CHECK_EQ(file_get_contents<std::string>(filename), contents.substr(1));
+            std::string out = "previous contents";
+            CHECK_EQ(file_get_contents_direct(filename, &out), sz);
+            CHECK_EQ(out, contents.substr(1));
+        }
+        { // without the bounce buffer
+            aligned_chars in;
+            char *inbuf = aligned_chars::resize(&in, sz);
+            if(sz)
+                memcpy(inbuf, contents.data(), sz);
+            file_put_contents_direct(filename, in.buf, sz);
+            CHECK_EQ(file_size(filename), sz);
+            aligned_chars out;
+            CHECK_EQ(file_get_contents_direct(filename, container_resizer{&out, &aligned_chars::resize}), sz);
+            REQUIRE_EQ(out.size, sz);
+            CHECK_EQ(csubstr(out.buf, sz), csubstr(contents.data(), sz));
+        }
+        { // a longer file is truncated
+            file_put_contents(filename, std::string(sz + 2 * a, 'x'));
+            file_put_contents_direct(filename, contents.substr(0, sz));
+            CHECK_EQ(file_get_contents<std::string>(filename), contents.substr(0, sz));
+        }
+    }
+    rmfile(filename);
+}
+
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -300,6 +992,24 @@ int entry_visitor(VisitedFile const& p)
     return 0;
 }
 
+int entry_metadata_visitor(VisitedFile const& p)
+{
+    CHECK_EQ(p.name_len, strlen(p.name));
+    CHECK_EQ(p.entry_name.str + p.entry_name.len, p.name + p.name_len);
+    CHECK_EQ(p.entry_name.str[-1], '/');
+    CHECK_EQ(p.entry_name.first_of('/'), csubstr::npos);
+    if(p.type != INVALID) // not every filesystem provides it
+        CHECK_EQ(p.type, path_type(p.name));
+    #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    struct stat st;
+    REQUIRE_EQ(lstat(p.name, &st), 0);
+    CHECK_EQ(p.inode, static_cast<uint64_t>(st.st_ino));
+    CHECK_EQ(strcmp(p.dirent_data->d_name, p.entry_name.str), 0);
+    #endif
+    ++*static_cast<size_t*>(p.user_data);
+    return 0;
+}
+
 TEST_CASE("walk_entries")
 {
     const std::string cwd_orig = cwd<std::string>();
@@ -356,10 +1066,69 @@ TEST_CASE("walk_entries")
         CHECK_EQ(file_count, 2); // must not have changed
         CHECK_EQ(dir_count, 2); // but must see the new subdirs
     }
+    SUBCASE("metadata")
+    {
+        mkdir("c4fdx/dir");
+        char buf_[100];
+        maybe_buf<char> buf(buf_);
+        size_t count = 0;
+        bool ok = walk_entries(dirname, entry_metadata_visitor, &buf, &count);
+        CHECK(ok);
+        CHECK_EQ(count, 3);
+    }
+    SUBCASE("dir_buffer")
+    {
+        // names of all lengths, to exercise the record padding
+        std::string name = "c4fdx/";
+        for(size_t i = 0; i < 200; ++i)
+        {
+            name += char('a' + (i % 26));
+            file_put_contents(name.c_str(), csubstr("x"));
+        }
+        for(size_t dirbuf_size : {size_t(0), size_t(100), size_t(1024), size_t(1024 + 3), size_t(1) << 20})
+        {
+            INFO("dirbuf_size=" << dirbuf_size);
+            std::vector<char> dirbuf_(dirbuf_size);
+            maybe_buf<char> dirbuf(dirbuf_.data(), dirbuf_.size());
+            char buf_[300];
+            maybe_buf<char> buf(buf_);
+            size_t count = 0;
+            bool ok = walk_entries(dirname, entry_metadata_visitor, &buf, &count, &dirbuf);
+            CHECK(ok);
+            CHECK_EQ(count, 202);
+            CHECK_EQ(dirbuf.valid(), dirbuf_size == 0 || dirbuf_size >= 1024);
+            if(!dirbuf.valid())
+                CHECK_EQ(dirbuf.required_size, 1024u);
+        }
+    }
     CHECK_EQ(rmtree(dirname), 0);
     CHECK_EQ(cwd<std::string>(), cwd_orig);
 }
 
+struct CountingMemoryResource : public MemoryResource
+{
+    size_t num_allocs = 0;
+    size_t num_deallocs = 0;
+    size_t num_bytes = 0;
+    void* do_allocate(size_t sz, size_t alignment, void *hint) override
+    {
+        ++num_allocs;
+        num_bytes += sz;
+        return get_memory_resource()->allocate(sz, alignment, hint);
+    }
+    void* do_reallocate(void* ptr, size_t oldsz, size_t newsz, size_t alignment) override
+    {
+        num_bytes += newsz - oldsz;
+        return get_memory_resource()->reallocate(ptr, oldsz, newsz, alignment);
+    }
+    void do_deallocate(void* ptr, size_t sz, size_t alignment) override
+    {
+        ++num_deallocs;
+        num_bytes -= sz;
+        get_memory_resource()->deallocate(ptr, sz, alignment);
+    }
+};
+
 TEST_CASE("list_entries")
 {
     char dirname[] = "c4fdx/dir\0";
@@ -405,6 +1174,11 @@ TEST_CASE("list_entries")
         CHECK(scratch.valid());
         CHECK_LE(el.arena.required_size, arena_size);
         REQUIRE_EQ(el.names.required_size, num_files);
+        // a list on caller buffers can be copied, sharing the buffers
+        EntryList copy = el;
+        CHECK_EQ(copy.size(), num_files);
+        CHECK_EQ(copy.names.buf, el.names.buf);
+        CHECK_EQ(copy.arena.buf, el.arena.buf);
         std::sort(namesbuf, namesbuf+num_files,
                   [](const char *lhs, const char *rhs){
                       return strcmp(lhs, rhs) < 0;
@@ -447,9 +1221,219 @@ TEST_CASE("list_entries")
         CHECK_EQ(to_csubstr(namesbuf[8]), csubstr("c4fdx/dir/file08"));
         CHECK_EQ(to_csubstr(namesbuf[9]), csubstr("c4fdx/dir/file09"));
     }
+    SUBCASE("metadata")
+    {
+        mkdir("c4fdx/dir/subdir");
+        char namebuf[1000] = {};
+        char *namesbuf[20] = {};
+        size_t lengthsbuf[20] = {};
+        uint64_t inodesbuf[20] = {};
+        uint8_t typesbuf[20] = {};
+        char scratchbuf[256] = {};
+        maybe_buf<char> scratch(scratchbuf);
+        EntryList el(namebuf, namesbuf);
+        el.lengths = lengthsbuf;
+        el.inodes = inodesbuf;
+        el.types = typesbuf;
+        bool ok = list_entries("c4fdx/dir", &el, &scratch);
+        CHECK(ok);
+        CHECK(el.valid());
+        REQUIRE_EQ(el.size(), num_files + 1u);
+        CHECK_EQ(el.lengths.required_size, num_files + 1u);
+        CHECK_EQ(el.inodes.required_size, num_files + 1u);
+        CHECK_EQ(el.types.required_size, num_files + 1u);
+        el.sort();
+        for(size_t i = 0; i < num_files; ++i)
+        {
+            CHECK_EQ(el.name(i).len, strlen("c4fdx/dir/file00"));
+            CHECK_EQ(el.name(i), to_csubstr(namesbuf[i]));
+            CHECK_EQ(el.type(i), REGFILE);
+            #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+            struct stat st;
+            REQUIRE_EQ(stat(namesbuf[i], &st), 0);
+            CHECK_EQ(el.inode(i), static_cast<uint64_t>(st.st_ino));
+            #endif
+        }
+        CHECK_EQ(el.name(num_files), csubstr("c4fdx/dir/subdir"));
+        CHECK_EQ(el.type(num_files), DIR);
+    }
+    SUBCASE("growable")
+    {
+        // enough to grow the names, the metadata and the arena
+        std::string name;
+        for(size_t i = num_files; i < 500; ++i)
+        {
+            name = "c4fdx/dir/file";
+            name += std::to_string(i);
+            file_put_contents(name.c_str(), csubstr("x"));
+        }
+        CountingMemoryResource mr;
+        {
+            EntryList el(&mr, ENTRY_LENGTHS|ENTRY_TYPES);
+            CHECK(el.valid());
+            CHECK(el.lengths.buf != nullptr);
+            CHECK(el.inodes.buf == nullptr);
+            CHECK(el.types.buf != nullptr);
+            bool ok = list_entries("c4fdx/dir", &el, nullptr);
+            CHECK(ok);
+            CHECK(el.valid());
+            REQUIRE_EQ(el.size(), 500u);
+            CHECK_EQ(el.inodes.required_size, 0u);
+            el.sort();
+            for(size_t i = 0; i < el.size(); ++i)
+            {
+                CHECK_EQ(el.name(i).len, strlen(el.names.buf[i]));
+                CHECK(el.name(i).begins_with("c4fdx/dir/file"));
+                CHECK(file_exists(el.names.buf[i]));
+                CHECK_EQ(el.type(i), REGFILE);
+                if(i)
+                    CHECK_LT(strcmp(el.names.buf[i-1], el.names.buf[i]), 0);
+            }
+            // list again, reusing the buffers
+            size_t num_allocs = mr.num_allocs;
+            char scratchbuf[512];
+            maybe_buf<char> scratch(scratchbuf);
+            ok = list_entries("c4fdx/dir", &el, &scratch);
+            CHECK(ok);
+            CHECK_EQ(el.size(), 500u);
+            CHECK_EQ(mr.num_allocs, num_allocs);
+            // move
+            EntryList moved(std::move(el));
+            CHECK(el.resource == nullptr);
+            CHECK(el.names.buf == nullptr);
+            CHECK_EQ(moved.size(), 500u);
+            el = std::move(moved);
+            CHECK(moved.resource == nullptr);
+            CHECK_EQ(el.size(), 500u);
+        }
+        CHECK_GT(mr.num_allocs, 0u);
+        CHECK_EQ(mr.num_allocs, mr.num_deallocs);
+        CHECK_EQ(mr.num_bytes, 0u);
+    }
+    SUBCASE("metadata_buffer_too_small")
+    {
+        char namebuf[1000] = {};
+        char *namesbuf[20] = {};
+        uint8_t typesbuf[5] = {};
+        char scratchbuf[256] = {};
+        maybe_buf<char> scratch(scratchbuf);
+        EntryList el(namebuf, namesbuf);
+        el.types = typesbuf;
+        bool ok = list_entries("c4fdx/dir", &el, &scratch);
+        CHECK(!ok);
+        CHECK(!el.valid());
+        CHECK(el.names.valid());
+        CHECK_EQ(el.types.required_size, num_files);
+    }
     rmtree("c4fdx");
 }
 
+/** an EntryList over the given names, capturing their lengths */
+struct SortFixture
+{
+    std::vector<std::string> strings;
+    std::vector<char*> names;
+    std::vector<size_t> lengths;
+    EntryList el;
+    SortFixture(std::vector<std::string> const& s) : strings(s), names(), lengths(), el()
+    {
+        for(std::string &str : strings)
+        {
+            names.push_back(&str[0]);
+            lengths.push_back(str.size());
+        }
+        el.names = maybe_buf<char*>(names.data(), names.size());
+        el.names.required_size = names.size();
+        el.lengths = maybe_buf<size_t>(lengths.data(), lengths.size());
+        el.lengths.required_size = lengths.size();
+    }
+    std::vector<std::string> sorted() const
+    {
+        std::vector<std::string> result;
+        for(size_t i = 0; i < el.size(); ++i)
+        {
+            CHECK_EQ(el.name(i).len, strlen(el.names.buf[i]));
+            result.emplace_back(el.names.buf[i]);
+        }
+        return result;
+    }
+};
+
+std::vector<std::string> random_names(size_t num, const char *prefix)
+{
+    std::mt19937 rng(12345);
+    std::vector<std::string> names;
+    const char chars[] = "0123456789abcdef_";
+    for(size_t i = 0; i < num; ++i)
+    {
+        std::string n = prefix;
+        size_t len = rng() % 20u;
+        for(size_t j = 0; j < len; ++j)
+            n += chars[rng() % (sizeof(chars) - 1u)];
+        names.push_back(n);
+    }
+    return names;
+}
+
+TEST_CASE("EntryList.sort")
+{
+    SUBCASE("empty")
+    {
+        SortFixture f({});
+        f.el.sort();
+        CHECK(f.el.empty());
+    }
+    SUBCASE("lexicographic")
+    {
+        // shared prefixes longer than 8 bytes, names ending at
+        // the key boundaries, and duplicates
+        SortFixture f({"dir/aaaaaaaab", "dir/aaaaaaaa", "dir/aaaaaaaaaaaaaaaa", "dir/b",
+                       "dir/aaaaaaaaaaaaaaab", "dir/", "dir/aaaaaaa", "dir/b", "dir/\xff", "dir/a"});
+        std::vector<std::string> expected = f.strings;
+        std::sort(expected.begin(), expected.end(), [](std::string const& a, std::string const& b){
+            return strcmp(a.c_str(), b.c_str()) < 0;
+        });
+        f.el.sort();
+        CHECK(f.sorted() == expected);
+    }
+    SUBCASE("natural")
+    {
+        SortFixture f({"dir/file10", "dir/file2", "dir/file1", "dir/file010", "dir/file100", "dir/file19", "dir/file", "dir/file2b", "dir/file2a"});
+        sort_options opts;
+        opts.natural = true;
+        f.el.sort(opts);
+        std::vector<std::string> expected = {"dir/file", "dir/file1", "dir/file2", "dir/file2a", "dir/file2b", "dir/file010", "dir/file10", "dir/file19", "dir/file100"};
+        CHECK(f.sorted() == expected);
+    }
+    SUBCASE("random")
+    {
+        for(size_t num_threads : {size_t(1), size_t(4)})
+        {
+            for(bool natural : {false, true})
+            {
+                INFO("num_threads=" << num_threads << " natural=" << natural);
+                SortFixture f(random_names(10000, "c4fdx/dir/"));
+                SortFixture ref(f.strings);
+                sort_options opts;
+                opts.natural = natural;
+                opts.num_threads = num_threads;
+                opts.parallel_threshold = 100;
+                f.el.sort(opts);
+                opts.num_threads = 1;
+                opts.parallel_threshold = size_t(-1);
+                ref.el.sort(opts);
+                CHECK(f.sorted() == ref.sorted());
+                if(!natural)
+                {
+                    std::vector<std::string> expected = f.strings;
+                    std::sort(expected.begin(), expected.end());
+                    CHECK(f.sorted() == expected);
+                }
+            }
+        }
+    }
+}
+
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -479,6 +1463,201 @@ TEST_CASE("walk_tree")
     }
 }
 
+struct WalkResults
+{
+    std::vector<std::string> names;
+    std::vector<PathType_e> types;
+    const char *skip = nullptr;
+    bool expect_stat = false;
+};
+
+int walk_results_visitor(VisitedPath const& p)
+{
+    WalkResults *results = static_cast<WalkResults*>(p.user_data);
+    results->names.emplace_back(p.name);
+    #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    results->types.push_back(p.type);
+    CHECK_EQ(p.type, path_type(p.name));
+    CHECK_EQ(p.stat_data != nullptr, results->expect_stat);
+    CHECK_EQ(p.ftw_data->level, (int)std::count(p.name, p.name + strlen(p.name), '/'));
+    CHECK_EQ(p.ftw_data->base, (int)(to_csubstr(p.name).last_of('/') + 1));
+    if(results->skip && strcmp(p.name, results->skip) == 0)
+        return WALK_SKIP_SUBTREE;
+    #endif
+    return WALK_CONTINUE;
+}
+
+TEST_CASE("walk_tree.user_data")
+{
+    auto treename = _make_tree();
+    WalkResults results;
+    CHECK_EQ(walk_tree(treename, walk_results_visitor, &results), 0);
+    CHECK_EQ(results.names.size(), 24u + 12u);
+    CHECK_EQ(results.names[0], "c4fdx");
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+TEST_CASE("walk_tree.stat")
+{
+    auto treename = _make_tree();
+    walk_options opts;
+    opts.stat = true;
+    WalkResults results;
+    results.expect_stat = true;
+    CHECK_EQ(walk_tree(treename, walk_results_visitor, opts, &results), 0);
+    CHECK_EQ(results.names.size(), 24u + 12u);
+    CHECK_EQ(std::count(results.types.begin(), results.types.end(), DIR), 12);
+    CHECK_EQ(std::count(results.types.begin(), results.types.end(), REGFILE), 24);
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+TEST_CASE("walk_tree.skip_subtree")
+{
+    auto treename = _make_tree();
+    WalkResults results;
+    results.skip = "c4fdx/a";
+    CHECK_EQ(walk_tree(treename, walk_results_visitor, &results), 0);
+    CHECK_EQ(results.names.size(), 36u - 26u); // c4fdx/a has 18 files and 8 dirs under it
+    for(std::string const& name : results.names)
+        CHECK_UNARY(to_csubstr(name).find("c4fdx/a/") == csubstr::npos);
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+TEST_CASE("walk_tree.fd_budget")
+{
+    auto treename = _make_tree();
+    WalkResults expected;
+    CHECK_EQ(walk_tree(treename, walk_results_visitor, &expected), 0);
+    std::sort(expected.names.begin(), expected.names.end());
+    for(size_t max_fds : {size_t(1), size_t(2), size_t(3)})
+    {
+        walk_options opts;
+        opts.max_fds = max_fds;
+        WalkResults results;
+        CHECK_EQ(walk_tree(treename, walk_results_visitor, opts, &results), 0);
+        std::sort(results.names.begin(), results.names.end());
+        CHECK(results.names == expected.names);
+    }
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+TEST_CASE("walk_tree.concurrent")
+{
+    auto treename = _make_tree();
+    WalkResults results[4];
+    std::vector<std::thread> threads;
+    for(WalkResults &r : results)
+        threads.emplace_back([&r, treename]{ walk_tree(treename, walk_results_visitor, &r); });
+    for(std::thread &t : threads)
+        t.join();
+    for(WalkResults &r : results)
+        CHECK_EQ(r.names.size(), 24u + 12u);
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+TEST_CASE("walk_tree_parallel.skip_subtree")
+{
+    auto treename = _make_tree();
+    for(bool ordered : {false, true})
+    {
+        walk_options opts;
+        opts.num_threads = 1; // the results are not thread-safe
+        opts.ordered = ordered;
+        WalkResults results;
+        results.skip = "c4fdx/a";
+        CHECK_EQ(walk_tree_parallel(treename, walk_results_visitor, opts, &results), 0);
+        CHECK_EQ(results.names.size(), 36u - 26u);
+    }
+    CHECK_EQ(rmtree(treename), 0);
+}
+#endif
+
+struct ParallelWalkResults
+{
+    std::mutex mtx;
+    std::vector<std::string> names;
+    size_t stop_after = 0;
+};
+
+int parallel_path_visitor(VisitedPath const& p)
+{
+    ParallelWalkResults *results = static_cast<ParallelWalkResults*>(p.user_data);
+    std::lock_guard<std::mutex> lock(results->mtx);
+    results->names.emplace_back(p.name);
+    if(results->stop_after && results->names.size() >= results->stop_after)
+        return 42;
+    return 0;
+}
+
+TEST_CASE("walk_tree_parallel.unordered")
+{
+    auto treename = _make_tree();
+    for(size_t num_threads : {size_t(1), size_t(2), size_t(8), size_t(0)})
+    {
+        walk_options opts;
+        opts.num_threads = num_threads;
+        ParallelWalkResults results;
+        CHECK_EQ(walk_tree_parallel(treename, parallel_path_visitor, opts, &results), 0);
+        CHECK_EQ(results.names.size(), 24u + 12u);
+        size_t num_files = 0, num_dirs = 0;
+        for(std::string const& name : results.names)
+        {
+            num_files += is_file(name.c_str());
+            num_dirs += is_dir(name.c_str());
+        }
+        CHECK_EQ(num_files, 24u);
+        CHECK_EQ(num_dirs, 12u);
+        std::sort(results.names.begin(), results.names.end());
+        CHECK(std::unique(results.names.begin(), results.names.end()) == results.names.end());
+    }
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+TEST_CASE("walk_tree_parallel.ordered")
+{
+    auto treename = _make_tree();
+    std::vector<std::string> first;
+    for(size_t num_threads : {size_t(1), size_t(2), size_t(8), size_t(0)})
+    {
+        walk_options opts;
+        opts.num_threads = num_threads;
+        opts.ordered = true;
+        ParallelWalkResults results;
+        CHECK_EQ(walk_tree_parallel(treename, parallel_path_visitor, opts, &results), 0);
+        REQUIRE_EQ(results.names.size(), 24u + 12u);
+        // directories are visited before their contents, in name order
+        CHECK_EQ(results.names[0], "c4fdx");
+        CHECK_EQ(results.names[1], "c4fdx/a");
+        CHECK_EQ(results.names[2], "c4fdx/a/1");
+        CHECK_EQ(results.names[3], "c4fdx/a/1/a");
+        CHECK_EQ(results.names[4], "c4fdx/a/1/a/file1");
+        CHECK_EQ(results.names.back(), "c4fdx/file2");
+        if(first.empty())
+            first = results.names;
+        else
+            CHECK(results.names == first);
+    }
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+TEST_CASE("walk_tree_parallel.stop")
+{
+    auto treename = _make_tree();
+    for(bool ordered : {false, true})
+    {
+        walk_options opts;
+        opts.num_threads = 4;
+        opts.ordered = ordered;
+        ParallelWalkResults results;
+        results.stop_after = 5;
+        CHECK_EQ(walk_tree_parallel(treename, parallel_path_visitor, opts, &results), 42);
+        CHECK_GE(results.names.size(), 5u);
+        CHECK_LT(results.names.size(), 24u + 12u);
+    }
+    CHECK_EQ(rmtree(treename), 0);
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -509,6 +1688,87 @@ TEST_CASE("ScopedTmpFile.c_str")
 }
 
 
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+bool is_hex_name(csubstr name, csubstr fmt)
+{
+    if(name.len != fmt.len)
+        return false;
+    for(size_t i = 0; i < fmt.len; ++i)
+    {
+        if(fmt[i] == 'X')
+        {
+            if(!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+                return false;
+        }
+        else if(name[i] != fmt[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE("tmpnam.format")
+{
+    char buf[64];
+    csubstr fmt = "name_XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX.tmp"; // more than one draw
+    std::string first = tmpnam(buf, sizeof(buf), fmt.str);
+    CHECK(is_hex_name(to_csubstr(first), fmt));
+    std::string second = tmpnam(buf, sizeof(buf), fmt.str);
+    CHECK(is_hex_name(to_csubstr(second), fmt));
+    CHECK_NE(first, second);
+    // an odd X is not substituted
+    tmpnam(buf, sizeof(buf), "aXXXb");
+    CHECK_EQ(buf[3], 'X');
+    // other substitution chars
+    tmpnam(buf, sizeof(buf), "a??b", '?');
+    CHECK_NE(buf[1], '?');
+    CHECK_NE(buf[2], '?');
+}
+
+TEST_CASE("tmpnam.pattern")
+{
+    TmpPattern pat("a_XX_XXX_YXXXX");
+    CHECK(pat.valid());
+    CHECK_EQ(pat.len(), 14u);
+    REQUIRE_EQ(pat.num_subs(), 4u);
+    CHECK_EQ(pat.pos(0), 2u);
+    CHECK_EQ(pat.pos(1), 5u);
+    CHECK_EQ(pat.pos(2), 10u);
+    CHECK_EQ(pat.pos(3), 12u);
+    char buf[16];
+    tmpnam(pat, buf, sizeof(buf));
+    CHECK_EQ(buf[14], '\0');
+    CHECK_EQ(csubstr(buf).sub(0, 2), "a_");
+    CHECK_EQ(csubstr(buf).sub(4, 1), "_");
+    CHECK_EQ(csubstr(buf).sub(7, 3), "X_Y");
+    std::string name = tmpnam<std::string>(TmpPattern());
+    CHECK(is_hex_name(to_csubstr(name), to_csubstr(default_tmppat)));
+    CHECK_NE(name, tmpnam<std::string>(TmpPattern()));
+    CHECK_FALSE(TmpPattern("no_substitutions").valid());
+#if C4_CPP >= 14
+    constexpr const TmpPattern cpat("log_XXXXXXXX.txt");
+    static_assert(cpat.num_subs() == 4u && cpat.pos(0) == 4u && cpat.len() == 16u, "the pattern must be built at compile time");
+#endif
+}
+
+TEST_CASE("tmpnam.threads")
+{
+    const TmpPattern pat("XXXXXXXXXXXXXXXX");
+    std::vector<std::string> names(8);
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < names.size(); ++i)
+        threads.emplace_back([&pat, &names, i]{ tmpnam(pat, &names[i]); });
+    for(std::thread &t : threads)
+        t.join();
+    std::sort(names.begin(), names.end());
+    CHECK(std::unique(names.begin(), names.end()) == names.end());
+}
+
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -524,6 +1784,165 @@ TEST_CASE("file_put_contents.basic")
     CHECK_EQ(to_csubstr(cmp), test_contents);
 }
 
+TEST_CASE("file_put_contents.slices")
+{
+    std::string filename_buf = tmpnam<std::string>();
+    const char *filename = filename_buf.c_str();
+    SUBCASE("csubstr")
+    {
+        csubstr slices[] = {csubstr("header;"), csubstr{}, csubstr("body;"), csubstr(""), test_contents};
+        file_put_contents(filename, slices, sizeof(slices) / sizeof(slices[0]));
+        std::string expected = "header;body;";
+        expected.append(test_contents.str, test_contents.len);
+        CHECK_EQ(file_get_contents<std::string>(filename), expected);
+        // append
+        file_put_contents(filename, slices, 1, "ab");
+        expected += "header;";
+        CHECK_EQ(file_get_contents<std::string>(filename), expected);
+        // truncate
+        file_put_contents(filename, slices + 2, 1);
+        CHECK_EQ(file_get_contents<std::string>(filename), "body;");
+        file_put_contents(filename, slices, 0);
+        CHECK_EQ(file_size(filename), 0u);
+    }
+    SUBCASE("more_than_iov_max")
+    {
+        std::vector<std::string> strings;
+        std::string expected;
+        for(size_t i = 0; i < 5000; ++i)
+        {
+            strings.emplace_back(std::to_string(i) + ",");
+            expected += strings.back();
+        }
+        std::vector<csubstr> slices;
+        for(std::string const& str : strings)
+            slices.emplace_back(str.data(), str.size());
+        file_put_contents(filename, slices.data(), slices.size());
+        CHECK_EQ(file_get_contents<std::string>(filename), expected);
+        file_put_contents(filename, strings.data(), strings.size());
+        CHECK_EQ(file_get_contents<std::string>(filename), expected);
+    }
+    SUBCASE("large_slices")
+    {
+        std::string big(size_t(3) << 20, 'b');
+        std::vector<char> vbig(size_t(1) << 20, 'v');
+        std::vector<char> empty;
+        std::vector<char> containers[] = {vbig, empty, vbig};
+        file_put_contents(filename, containers, 3);
+        CHECK_EQ(file_size(filename), 2 * vbig.size());
+        csubstr slices[] = {to_csubstr(big), csubstr("tail")};
+        file_put_contents(filename, slices, sizeof(slices) / sizeof(slices[0]));
+        std::string contents = file_get_contents<std::string>(filename);
+        CHECK_EQ(contents, big + "tail");
+    }
+    rmfile(filename);
+}
+
+TEST_CASE("file_put_contents_atomic")
+{
+    constexpr const char dirname[] = "c4fs_atomic";
+    if(dir_exists(dirname))
+        CHECK_EQ(rmtree(dirname), 0);
+    CHECK_EQ(mkdir(dirname), 0);
+    for(Durability_e durability : {DURABILITY_NONE, DURABILITY_FILE, DURABILITY_GROUP})
+    {
+        INFO("durability=" << durability);
+        const char filename[] = "c4fs_atomic/fileXX";
+        rmfile(filename);
+        file_put_contents_atomic(filename, test_contents, durability);
+        std::string contents = file_get_contents<std::string>(filename);
+        CHECK_EQ(to_csubstr(contents), test_contents);
+        file_put_contents_atomic(filename, csubstr("replaced"), durability);
+        CHECK_EQ(file_get_contents<std::string>(filename), "replaced");
+        file_put_contents_atomic(filename, csubstr{}, durability);
+        CHECK_EQ(file_size(filename), 0u);
+        CHECK_EQ(count_dir_entries(dirname), 1u); // no temporary files are left
+    }
+    CHECK_EQ(rmtree(dirname), 0);
+}
+
+void check_batch_files(std::vector<std::string> const& names, csubstr prefix)
+{
+    for(std::string const& name : names)
+    {
+        std::string expected(prefix.str, prefix.len);
+        expected += name;
+        CHECK_EQ(file_get_contents<std::string>(name.c_str()), expected);
+    }
+}
+
+TEST_CASE("AtomicWriteBatch")
+{
+    if(dir_exists("c4fs_batch"))
+        CHECK_EQ(rmtree("c4fs_batch"), 0);
+    CHECK_EQ(mkdir("c4fs_batch"), 0);
+    CHECK_EQ(mkdir("c4fs_batch/a"), 0);
+    CHECK_EQ(mkdir("c4fs_batch/b"), 0);
+    std::vector<std::string> names;
+    for(size_t i = 0; i < 10; ++i)
+    {
+        names.emplace_back("c4fs_batch/a/file" + std::to_string(i));
+        names.emplace_back("c4fs_batch/b/file" + std::to_string(i));
+    }
+    for(std::string const& name : names)
+        file_put_contents(name.c_str(), "old:" + name);
+    for(Durability_e durability : {DURABILITY_NONE, DURABILITY_FILE, DURABILITY_GROUP})
+    {
+        INFO("durability=" << durability);
+        SUBCASE("commit")
+        {
+            AtomicWriteBatch batch(durability);
+            for(std::string const& name : names)
+                batch.put(name.c_str(), "new:" + name);
+            CHECK_EQ(batch.pending(), names.size());
+            check_batch_files(names, "old:");
+            batch.commit();
+            CHECK_EQ(batch.pending(), 0u);
+            check_batch_files(names, "new:");
+            batch.commit(); // nothing to commit
+        }
+        SUBCASE("discard")
+        {
+            AtomicWriteBatch batch(durability);
+            for(std::string const& name : names)
+                batch.put(name.c_str(), "new:" + name);
+            batch.discard();
+            CHECK_EQ(batch.pending(), 0u);
+            check_batch_files(names, "old:");
+        }
+        SUBCASE("destructor_discards")
+        {
+            {
+                AtomicWriteBatch batch(durability);
+                for(std::string const& name : names)
+                    batch.put(name.c_str(), "new:" + name);
+            }
+            check_batch_files(names, "old:");
+            CHECK_EQ(count_dir_entries("c4fs_batch/a"), names.size() / 2); // no temporary files are left
+        }
+        SUBCASE("concurrent")
+        {
+            AtomicWriteBatch batch(durability);
+            std::vector<std::thread> threads;
+            for(size_t t = 0; t < 4; ++t)
+            {
+                threads.emplace_back([&batch, &names, t]{
+                    for(size_t i = t; i < names.size(); i += 4)
+                        batch.put(names[i].c_str(), "new:" + names[i]);
+                });
+            }
+            for(std::thread &th : threads)
+                th.join();
+            CHECK_EQ(batch.pending(), names.size());
+            batch.commit();
+            check_batch_files(names, "new:");
+        }
+        CHECK_EQ(count_dir_entries("c4fs_batch/a"), names.size() / 2);
+        CHECK_EQ(count_dir_entries("c4fs_batch/b"), names.size() / 2);
+    }
+    CHECK_EQ(rmtree("c4fs_batch"), 0);
+}
+
 TEST_CASE("file_get_contents.std_string")
 {
     auto wfile = ScopedTmpFile(test_contents.str, test_contents.len);
@@ -538,6 +1957,720 @@ TEST_CASE("file_get_contents.std_vector_char")
     CHECK_EQ(to_csubstr(s), test_contents);
 }
 
+TEST_CASE("file_get_contents.empty_file")
+{
+    auto wfile = ScopedTmpFile();
+    std::string s = "previous contents";
+    CHECK_EQ(file_get_contents(wfile.name(), &s), 0u);
+    CHECK(s.empty());
+    CHECK_EQ(file_get_contents(wfile.name(), nullptr, 0), 0u);
+    // the container is not grown for an empty file
+    struct Spy { std::string s; size_t max_size; } spy = {"previous contents", 0u};
+    container_resizer resizer = {&spy, [](void *container, size_t sz){
+        Spy *sp = static_cast<Spy*>(container);
+        sp->max_size = sz > sp->max_size ? sz : sp->max_size;
+        return _resize_char_container<std::string>(&sp->s, sz);
+    }};
+    CHECK_EQ(file_get_contents(wfile.name(), resizer), 0u);
+    CHECK(spy.s.empty());
+    CHECK_EQ(spy.max_size, 0u);
+}
+
+TEST_CASE("file_get_contents.nonempty_container")
+{
+    auto wfile = ScopedTmpFile(test_contents.str, test_contents.len);
+    std::string s(2 * test_contents.len, 'x');
+    CHECK_EQ(file_get_contents(wfile.name(), &s), test_contents.len);
+    CHECK_EQ(to_csubstr(s), test_contents);
+}
+
+TEST_CASE("file_get_contents.buffer")
+{
+    auto wfile = ScopedTmpFile(test_contents.str, test_contents.len);
+    char buf[256] = {};
+    REQUIRE_GT(sizeof(buf), test_contents.len);
+    CHECK_EQ(file_get_contents(wfile.name(), buf, 3), test_contents.len);
+    CHECK_EQ(buf[0], '\0'); // must not be written if the buffer is too small
+    CHECK_EQ(file_get_contents(wfile.name(), buf, sizeof(buf)), test_contents.len);
+    CHECK_EQ(csubstr(buf, test_contents.len), test_contents);
+}
+
+#if defined(C4_LINUX)
+TEST_CASE("file_get_contents.unknown_size")
+{
+    // files in /proc have an unknown size: stat() reports 0
+    const char filename[] = "/proc/self/mountinfo";
+    std::string s = file_get_contents<std::string>(filename);
+    REQUIRE_GT(s.size(), 0u);
+    CHECK_EQ(s.back(), '\n');
+    std::vector<char> buf(s.size() + 4096);
+    size_t sz = file_get_contents(filename, buf.data(), buf.size());
+    CHECK_GT(sz, 0u);
+    CHECK_EQ(buf[sz - 1], '\n');
+    CHECK_GE(file_get_contents(filename, nullptr, 0), sz / 2);
+}
+#endif
+
+#if defined(C4_LINUX)
+/** the number of pages of the file in the page cache */
+size_t cached_pages(const char *filename)
+{
+    size_t sz = file_size(filename);
+    if(sz == 0)
+        return 0;
+    int fd = ::open(filename, O_RDONLY);
+    REQUIRE_GE(fd, 0);
+    void *addr = ::mmap(nullptr, sz, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    REQUIRE_NE(addr, MAP_FAILED);
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> vec((sz + page - 1) / page);
+    REQUIRE_EQ(::mincore(addr, sz, vec.data()), 0);
+    ::munmap(addr, sz);
+    size_t num = 0;
+    for(unsigned char c : vec)
+        num += c & 1u;
+    return num;
+}
+#endif
+
+TEST_CASE("file_contents.hints")
+{
+    const char filename[] = "c4fs_hints.bin";
+    const char copyname[] = "c4fs_hints_copy.bin";
+    // larger than the drop-behind window
+    std::string contents((size_t(20) << 20) + 123, '\0');
+    for(size_t i = 0; i < contents.size(); ++i)
+        contents[i] = static_cast<char>('a' + (i % 26));
+    const int all_hints[] = {
+        ACCESS_NORMAL,
+        ACCESS_SEQUENTIAL,
+        ACCESS_RANDOM,
+        ACCESS_WILLNEED|ACCESS_SEQUENTIAL,
+        ACCESS_NOREUSE,
+        ACCESS_DROP_BEHIND,
+        ACCESS_SEQUENTIAL|ACCESS_NOREUSE|ACCESS_DROP_BEHIND,
+    };
+    for(int hints : all_hints)
+    {
+        INFO("hints=" << hints);
+        file_put_contents(filename, contents, default_write_access, hints);
+        CHECK_EQ(file_get_contents<std::string>(filename, default_read_access, hints), contents);
+        std::vector<char> buf(contents.size());
+        CHECK_EQ(file_get_contents(filename, buf.data(), buf.size(), default_read_access, hints), contents.size());
+        CHECK_EQ(to_csubstr(buf), to_csubstr(contents));
+        copy_options opts;
+        opts.hints = hints;
+        copy_file(filename, copyname, opts);
+        CHECK_EQ(file_get_contents<std::string>(copyname), contents);
+        rmfile(copyname);
+        opts.try_reflink = opts.try_copy_file_range = opts.try_sendfile = false;
+        copy_file(filename, copyname, opts);
+        CHECK_EQ(file_get_contents<std::string>(copyname), contents);
+        rmfile(copyname);
+    }
+    // appending with drop-behind
+    file_put_contents(filename, contents, default_write_access, ACCESS_DROP_BEHIND);
+    file_put_contents(filename, contents, "ab", ACCESS_DROP_BEHIND);
+    CHECK_EQ(file_get_contents<std::string>(filename), contents + contents);
+    #if defined(C4_LINUX)
+    SUBCASE("drop_behind")
+    {
+        const size_t max_cached = 4; // allow for a few stray pages
+        file_put_contents(filename, contents, default_write_access, ACCESS_DROP_BEHIND);
+        CHECK_LE(cached_pages(filename), max_cached);
+        std::string s;
+        file_get_contents(filename, &s, default_read_access, ACCESS_DROP_BEHIND);
+        CHECK_LE(cached_pages(filename), max_cached);
+        CHECK_EQ(s, contents);
+        copy_options opts;
+        opts.hints = ACCESS_DROP_BEHIND;
+        copy_file(filename, copyname, opts);
+        CHECK_LE(cached_pages(filename), max_cached);
+        CHECK_LE(cached_pages(copyname), max_cached);
+        rmfile(copyname);
+        // without the hint, the pages stay cached
+        file_get_contents(filename, &s);
+        CHECK_GT(cached_pages(filename), max_cached);
+    }
+    #endif
+    rmfile(filename);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+struct ChunkAccumulator
+{
+    std::string contents;
+    size_t num_chunks = 0;
+    size_t max_chunks = 0;
+};
+
+int chunk_visitor(VisitedChunk const& chunk)
+{
+    ChunkAccumulator *acc = static_cast<ChunkAccumulator*>(chunk.user_data);
+    CHECK_EQ(chunk.offset, acc->contents.size());
+    acc->contents.append(chunk.data.str, chunk.data.len);
+    ++acc->num_chunks;
+    return acc->max_chunks && acc->num_chunks >= acc->max_chunks;
+}
+
+TEST_CASE("file_read_chunks.basic")
+{
+    std::string contents(10000, '\0');
+    for(size_t i = 0; i < contents.size(); ++i)
+        contents[i] = static_cast<char>('a' + (i % 26));
+    auto wfile = ScopedTmpFile(contents);
+    for(size_t bufsz : {size_t(1), size_t(1000), size_t(4096), size_t(10000), size_t(20000)})
+    {
+        std::vector<char> buf(bufsz);
+        maybe_buf<char> scratch(buf.data(), buf.size());
+        ChunkAccumulator acc;
+        CHECK(file_read_chunks(wfile.name(), &scratch, chunk_visitor, &acc));
+        CHECK(scratch.valid());
+        CHECK_EQ(acc.num_chunks, (contents.size() + bufsz - 1) / bufsz);
+        CHECK_EQ(acc.contents, contents);
+    }
+}
+
+TEST_CASE("file_read_chunks.stop")
+{
+    std::string contents(10000, 's');
+    auto wfile = ScopedTmpFile(contents);
+    char buf[1000];
+    maybe_buf<char> scratch(buf);
+    ChunkAccumulator acc;
+    acc.max_chunks = 3;
+    CHECK(file_read_chunks(wfile.name(), &scratch, chunk_visitor, &acc));
+    CHECK_EQ(acc.num_chunks, 3u);
+    CHECK_EQ(acc.contents.size(), 3000u);
+}
+
+TEST_CASE("file_read_chunks.empty")
+{
+    SUBCASE("empty_file")
+    {
+        auto wfile = ScopedTmpFile();
+        char buf[100];
+        maybe_buf<char> scratch(buf);
+        ChunkAccumulator acc;
+        CHECK(file_read_chunks(wfile.name(), &scratch, chunk_visitor, &acc));
+        CHECK_EQ(acc.num_chunks, 0u);
+    }
+    SUBCASE("empty_buffer")
+    {
+        auto wfile = ScopedTmpFile(test_contents.str, test_contents.len);
+        maybe_buf<char> scratch;
+        ChunkAccumulator acc;
+        CHECK(!file_read_chunks(wfile.name(), &scratch, chunk_visitor, &acc));
+        CHECK(!scratch.valid());
+        CHECK_GT(scratch.required_size, 0u);
+        CHECK_EQ(acc.num_chunks, 0u);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+void collect_async_result(AsyncResult const& r)
+{
+    static_cast<std::vector<AsyncResult>*>(r.user_data)->push_back(r);
+}
+
+async_options async_test_options(bool use_io_uring)
+{
+    async_options opts;
+    opts.use_io_uring = use_io_uring;
+    opts.queue_depth = 8;
+    opts.num_threads = 3;
+    return opts;
+}
+
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+void test_async_ops(bool use_io_uring)
+{
+    AsyncEngine engine(async_test_options(use_io_uring));
+    if(!use_io_uring)
+        CHECK(!engine.uses_io_uring());
+    const char filename[] = "c4fs_async_ops.test";
+    std::vector<AsyncResult> results;
+    // open
+    engine.open(filename, O_RDWR|O_CREAT|O_TRUNC, 0644, collect_async_result, &results);
+    CHECK_EQ(engine.pending(), 1u);
+    CHECK_EQ(engine.wait(), 1u);
+    CHECK_EQ(engine.pending(), 0u);
+    REQUIRE_EQ(results.size(), 1u);
+    CHECK_EQ(results[0].op, ASYNC_OPEN);
+    CHECK_EQ(results[0].user_data, &results);
+    REQUIRE(results[0].ok());
+    const int fd = static_cast<int>(results[0].result);
+    // two writes in the same batch
+    results.clear();
+    engine.write(fd, test_contents.str, test_contents.len, 0, collect_async_result, &results);
+    engine.write(fd, test_contents.str, test_contents.len, test_contents.len, collect_async_result, &results);
+    CHECK_EQ(engine.submit(), 2u);
+    CHECK_EQ(engine.wait(2), 2u);
+    REQUIRE_EQ(results.size(), 2u);
+    for(AsyncResult const& r : results)
+    {
+        CHECK_EQ(r.op, ASYNC_WRITE);
+        CHECK_EQ(r.result, static_cast<int64_t>(test_contents.len));
+    }
+    // stat and read
+    results.clear();
+    path_info pi;
+    std::vector<char> buf(2 * test_contents.len + 10);
+    engine.stat(filename, &pi, INFO_ALL, collect_async_result, &results);
+    engine.read(fd, buf.data(), buf.size(), 0, collect_async_result, &results);
+    engine.drain();
+    REQUIRE_EQ(results.size(), 2u);
+    for(AsyncResult const& r : results)
+    {
+        if(r.op == ASYNC_STAT)
+        {
+            CHECK_EQ(r.result, 0);
+        }
+        else
+        {
+            CHECK_EQ(r.op, ASYNC_READ);
+            CHECK_EQ(r.result, static_cast<int64_t>(2 * test_contents.len));
+        }
+    }
+    CHECK(pi.exists());
+    CHECK_EQ(pi.type, REGFILE);
+    CHECK_EQ(pi.size, 2 * test_contents.len);
+    CHECK_EQ(pi.inode, info(filename).inode);
+    CHECK_EQ(csubstr(buf.data(), test_contents.len), test_contents);
+    CHECK_EQ(csubstr(buf.data() + test_contents.len, test_contents.len), test_contents);
+    // close and unlink
+    results.clear();
+    engine.close(fd, collect_async_result, &results);
+    engine.unlink(filename, collect_async_result, &results);
+    engine.drain();
+    REQUIRE_EQ(results.size(), 2u);
+    for(AsyncResult const& r : results)
+        CHECK(r.ok());
+    CHECK(!path_exists(filename));
+    // failures
+    results.clear();
+    engine.stat(filename, &pi, INFO_ALL, collect_async_result, &results);
+    engine.unlink(filename, collect_async_result, &results);
+    engine.open(filename, O_RDONLY, 0, collect_async_result, &results);
+    engine.drain();
+    REQUIRE_EQ(results.size(), 3u);
+    for(AsyncResult const& r : results)
+        CHECK_EQ(r.result, -ENOENT);
+    CHECK(!pi.exists());
+}
+
+TEST_CASE("AsyncEngine.ops")
+{
+    SUBCASE("io_uring")
+    {
+        test_async_ops(true);
+    }
+    SUBCASE("threads")
+    {
+        test_async_ops(false);
+    }
+}
+#endif
+
+struct AsyncFile
+{
+    std::string name;
+    std::string contents;
+    std::string read;
+    int64_t put_result = -1;
+    int64_t get_result = -1;
+    int64_t rm_result = -1;
+};
+
+void async_put_done(AsyncResult const& r)
+{
+    CHECK_EQ(r.op, ASYNC_WRITE);
+    static_cast<AsyncFile*>(r.user_data)->put_result = r.result;
+}
+
+void async_get_done(AsyncResult const& r)
+{
+    CHECK_EQ(r.op, ASYNC_READ);
+    static_cast<AsyncFile*>(r.user_data)->get_result = r.result;
+}
+
+void async_rm_done(AsyncResult const& r)
+{
+    CHECK_EQ(r.op, ASYNC_UNLINK);
+    static_cast<AsyncFile*>(r.user_data)->rm_result = r.result;
+}
+
+void test_async_files(bool use_io_uring)
+{
+    AsyncEngine engine(async_test_options(use_io_uring));
+    // more files than the queue depth
+    std::vector<AsyncFile> files(50);
+    for(size_t i = 0; i < files.size(); ++i)
+    {
+        files[i].name = "c4fs_async_file_" + std::to_string(i) + ".test";
+        files[i].contents.assign(i * i * 97, '\0');
+        for(size_t j = 0; j < files[i].contents.size(); ++j)
+            files[i].contents[j] = static_cast<char>('a' + (i + j) % 26);
+    }
+    for(AsyncFile &f : files)
+        file_put_contents_async(&engine, f.name.c_str(), f.contents.data(), f.contents.size(), async_put_done, &f);
+    engine.drain();
+    for(AsyncFile &f : files)
+    {
+        CHECK_EQ(f.put_result, static_cast<int64_t>(f.contents.size()));
+        CHECK_EQ(file_get_contents<std::string>(f.name.c_str()), f.contents);
+    }
+    for(AsyncFile &f : files)
+    {
+        f.read = "previous contents";
+        file_get_contents_async(&engine, f.name.c_str(), &f.read, async_get_done, &f);
+    }
+    engine.drain();
+    for(AsyncFile &f : files)
+    {
+        CHECK_EQ(f.get_result, static_cast<int64_t>(f.contents.size()));
+        CHECK_EQ(f.read, f.contents);
+    }
+    for(AsyncFile &f : files)
+        rmfile_async(&engine, f.name.c_str(), async_rm_done, &f);
+    engine.drain();
+    for(AsyncFile &f : files)
+    {
+        CHECK_EQ(f.rm_result, 0);
+        CHECK(!path_exists(f.name.c_str()));
+    }
+    // missing files
+    AsyncFile &f = files[1];
+    file_get_contents_async(&engine, f.name.c_str(), &f.read, async_get_done, &f);
+    rmfile_async(&engine, f.name.c_str(), async_rm_done, &f);
+    engine.drain();
+    CHECK_LT(f.get_result, 0);
+    CHECK_LT(f.rm_result, 0);
+    #if defined(C4_LINUX)
+    // files in /proc have an unknown size
+    AsyncFile proc;
+    file_get_contents_async(&engine, "/proc/self/mountinfo", &proc.read, async_get_done, &proc);
+    engine.drain();
+    REQUIRE_GT(proc.get_result, 0);
+    CHECK_EQ(static_cast<size_t>(proc.get_result), proc.read.size());
+    CHECK_EQ(proc.read.back(), '\n');
+    #endif
+}
+
+TEST_CASE("file_get_contents_async")
+{
+    SUBCASE("io_uring")
+    {
+        test_async_files(true);
+    }
+    SUBCASE("threads")
+    {
+        test_async_files(false);
+    }
+}
+
+struct AsyncChain
+{
+    AsyncEngine *engine;
+    std::string name;
+    int64_t result = -1;
+    static void on_put(AsyncResult const& r)
+    {
+        AsyncChain *c = static_cast<AsyncChain*>(r.user_data);
+        REQUIRE(r.ok());
+        rmfile_async(c->engine, c->name.c_str(), on_rm, c);
+    }
+    static void on_rm(AsyncResult const& r)
+    {
+        static_cast<AsyncChain*>(r.user_data)->result = r.result;
+    }
+};
+
+TEST_CASE("AsyncEngine.destructor_drains")
+{
+    std::vector<AsyncChain> chains(20);
+    {
+        AsyncEngine engine(async_test_options(true));
+        for(size_t i = 0; i < chains.size(); ++i)
+        {
+            chains[i].engine = &engine;
+            chains[i].name = "c4fs_async_chain_" + std::to_string(i) + ".test";
+            file_put_contents_async(&engine, chains[i].name.c_str(), test_contents.str, test_contents.len, AsyncChain::on_put, &chains[i]);
+        }
+    }
+    for(AsyncChain const& c : chains)
+    {
+        CHECK_EQ(c.result, 0);
+        CHECK(!path_exists(c.name.c_str()));
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+void test_copy_file(copy_options const& opts, size_t sz, CopyStrategy_e expected_strategy=COPY_NONE)
+{
+    std::string contents(sz, '\0');
+    for(size_t i = 0; i < sz; ++i)
+        contents[i] = static_cast<char>('a' + (i % 26));
+    auto src = ScopedTmpFile(contents);
+    std::string dst = tmpnam<std::string>();
+    REQUIRE(!file_exists(dst.c_str()));
+    copy_result result = copy_file(src.name(), dst.c_str(), opts);
+    CHECK_EQ(result.size, sz);
+    CHECK_NE(result.strategy, COPY_NONE);
+    if(expected_strategy != COPY_NONE)
+        CHECK_EQ(result.strategy, expected_strategy);
+    CHECK_EQ(file_get_contents<std::string>(dst.c_str()), contents);
+    CHECK_EQ(rmfile(dst.c_str()), 0);
+}
+
+TEST_CASE("copy_file.basic")
+{
+    for(size_t sz : {size_t(0), size_t(1), size_t(4096), size_t(100000)})
+        test_copy_file(copy_options{}, sz);
+}
+
+TEST_CASE("copy_file.userspace")
+{
+    copy_options opts;
+    opts.try_reflink = false;
+    opts.try_copy_file_range = false;
+    opts.try_sendfile = false;
+    #if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    const CopyStrategy_e expected = COPY_USERSPACE;
+    #else
+    const CopyStrategy_e expected = COPY_NATIVE;
+    #endif
+    for(size_t bufsz : {size_t(1), size_t(8192), default_copy_buffer_size})
+    {
+        opts.buffer_size = bufsz;
+        for(size_t sz : {size_t(0), size_t(1), size_t(4096), size_t(100000)})
+            test_copy_file(opts, sz, expected);
+    }
+}
+
+#if defined(C4_LINUX)
+TEST_CASE("copy_file.kernel")
+{
+    copy_options opts;
+    opts.try_reflink = false;
+    SUBCASE("copy_file_range")
+    {
+        test_copy_file(opts, 100000);
+    }
+    SUBCASE("sendfile")
+    {
+        opts.try_copy_file_range = false;
+        test_copy_file(opts, 100000, COPY_SENDFILE);
+    }
+}
+#endif
+
+namespace {
+/** check that the files of two trees have the same contents */
+void check_same_tree(const char *src, const char *dst)
+{
+    size_t src_files, src_dirs, dst_files, dst_dirs;
+    count_tree(src, &src_files, &src_dirs);
+    count_tree(dst, &dst_files, &dst_dirs);
+    CHECK_EQ(src_files, dst_files);
+    CHECK_EQ(src_dirs, dst_dirs);
+    std::vector<std::string> files;
+    walk_tree(src, [](VisitedPath const& p){
+        if(!is_dir(p.name))
+            static_cast<std::vector<std::string>*>(p.user_data)->emplace_back(p.name);
+        return 0;
+    }, &files);
+    const size_t srclen = strlen(src);
+    for(std::string const& f : files)
+    {
+        std::string copy = dst + f.substr(srclen);
+        CHECK_EQ(file_get_contents<std::string>(copy.c_str()), file_get_contents<std::string>(f.c_str()));
+    }
+}
+} // namespace
+
+TEST_CASE("copy_tree")
+{
+    auto treename = _make_tree();
+    const char dst[] = "c4fdx_copy";
+    if(dir_exists(dst))
+        CHECK_EQ(rmtree(dst), 0);
+    size_t num_files, num_dirs;
+    count_tree(treename, &num_files, &num_dirs);
+    for(size_t num_threads : {size_t(1), size_t(4)})
+    {
+        copy_tree_options opts;
+        opts.num_threads = num_threads;
+        copy_tree_stats stats;
+        CHECK_EQ(copy_tree(treename, dst, opts, &stats), 0);
+        CHECK_EQ(stats.files, num_files);
+        CHECK_EQ(stats.dirs, num_dirs);
+        CHECK_EQ(stats.hardlinks, 0u);
+        CHECK_EQ(stats.errors, 0u);
+        CHECK_GT(stats.bytes, 0u);
+        check_same_tree(treename, dst);
+        CHECK_EQ(rmtree(dst), 0);
+    }
+    {
+        INFO("destination exists");
+        CHECK_EQ(mkdir(dst), 0);
+        CHECK_NE(copy_tree(treename, dst), 0);
+        CHECK_EQ(rmdir(dst), 0);
+    }
+    {
+        INFO("source is not a directory");
+        CHECK_NE(copy_tree("c4fdx/file1", dst), 0);
+        CHECK(!path_exists(dst));
+    }
+    {
+        INFO("nonexisting source");
+        CHECK_NE(copy_tree("nonexisting", dst), 0);
+        CHECK(!path_exists(dst));
+    }
+    {
+        INFO("destination inside the source");
+        std::string inside = std::string(treename) + "/copy";
+        CHECK_NE(copy_tree(treename, inside.c_str()), 0);
+        CHECK_EQ(errno, EINVAL);
+        CHECK(!path_exists(inside.c_str()));
+        inside = "./" + std::string(treename) + "/a/../copy/";
+        CHECK_NE(copy_tree(treename, inside.c_str()), 0);
+        CHECK_EQ(errno, EINVAL);
+        CHECK(!path_exists(inside.c_str()));
+    }
+#if defined(C4_POSIX) || defined(C4_MACOS) || defined(C4_IOS)
+    {
+        INFO("hardlink");
+        copy_tree_options opts;
+        opts.hardlink = true;
+        copy_tree_stats stats;
+        CHECK_EQ(copy_tree(treename, dst, opts, &stats), 0);
+        CHECK_EQ(stats.files, num_files);
+        CHECK_EQ(stats.hardlinks, num_files);
+        CHECK_EQ(stats.bytes, 0u);
+        CHECK_EQ(info("c4fdx_copy/a/1/b/file2").inode, info("c4fdx/a/1/b/file2").inode);
+        CHECK_NE(info("c4fdx_copy/a/1/b").inode, info("c4fdx/a/1/b").inode);
+        check_same_tree(treename, dst);
+        CHECK_EQ(rmtree(dst), 0);
+    }
+    {
+        INFO("symlinks");
+        CHECK_EQ(::symlink("file1", "c4fdx/a/link"), 0);
+        CHECK_EQ(::symlink("nonexisting", "c4fdx/a/dangling"), 0);
+        copy_tree_stats stats;
+        CHECK_EQ(copy_tree(treename, dst, copy_tree_options{}, &stats), 0);
+        CHECK_EQ(stats.symlinks, 2u);
+        CHECK_EQ(stats.files, num_files);
+        char target[64] = {};
+        CHECK_EQ(::readlink("c4fdx_copy/a/link", target, sizeof(target)), 5);
+        CHECK_EQ(std::string(target), "file1");
+        CHECK_EQ(::readlink("c4fdx_copy/a/dangling", target, sizeof(target)), 11);
+        CHECK_EQ(rmtree(dst), 0);
+        CHECK_EQ(::unlink("c4fdx/a/link"), 0);
+        CHECK_EQ(::unlink("c4fdx/a/dangling"), 0);
+    }
+    {
+        INFO("preserve mode and times");
+        CHECK_EQ(::chmod("c4fdx/a/1/file1", 0604), 0);
+        CHECK_EQ(::chmod("c4fdx/a/2", 0555), 0); // read-only: the copy sets it after the contents
+        struct timespec ts[2] = {{1000000000, 0}, {1200000000, 500}};
+        CHECK_EQ(::utimensat(AT_FDCWD, "c4fdx/a/1/file1", ts, 0), 0);
+        CHECK_EQ(::utimensat(AT_FDCWD, "c4fdx/a/1", ts, 0), 0);
+        copy_tree_options opts;
+        opts.preserve_mode = true;
+        opts.preserve_times = true;
+        opts.num_threads = 4;
+        copy_tree_stats stats;
+        CHECK_EQ(copy_tree(treename, dst, opts, &stats), 0);
+        CHECK_EQ(stats.errors, 0u);
+        struct stat st;
+        CHECK_EQ(::stat("c4fdx_copy/a/1/file1", &st), 0);
+        CHECK_EQ(st.st_mode & 07777, 0604);
+        CHECK_EQ(::stat("c4fdx_copy/a/2", &st), 0);
+        CHECK_EQ(st.st_mode & 07777, 0555);
+        CHECK_EQ(info("c4fdx_copy/a/1/file1").mtime_ns, info("c4fdx/a/1/file1").mtime_ns);
+        CHECK_EQ(info("c4fdx_copy/a/1").mtime_ns, info("c4fdx/a/1").mtime_ns);
+        check_same_tree(treename, dst);
+        CHECK_EQ(::chmod("c4fdx/a/2", 0755), 0);
+        CHECK_EQ(::chmod("c4fdx_copy/a/2", 0755), 0);
+        CHECK_EQ(rmtree(dst), 0);
+    }
+#endif
+    CHECK_EQ(rmtree(treename), 0);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+TEST_CASE("MappedFile.basic")
+{
+    auto wfile = ScopedTmpFile(test_contents.str, test_contents.len);
+    MappedFile mf(wfile.name());
+    CHECK(mf.valid());
+    CHECK_EQ(mf.size(), test_contents.len);
+    CHECK_EQ(mf.view(), test_contents);
+    mf.unmap();
+    CHECK(!mf.valid());
+    CHECK(mf.empty());
+}
+
+TEST_CASE("MappedFile.empty_file")
+{
+    auto wfile = ScopedTmpFile();
+    MappedFile mf(wfile.name());
+    CHECK(mf.valid());
+    CHECK(mf.empty());
+    CHECK_NE(mf.data(), nullptr);
+    CHECK_EQ(mf.view().len, 0u);
+    CHECK(mf.advise(ACCESS_SEQUENTIAL|ACCESS_WILLNEED));
+}
+
+TEST_CASE("MappedFile.hints")
+{
+    std::string contents(100000, 'm');
+    auto wfile = ScopedTmpFile(contents);
+    for(int hints : {(int)ACCESS_NORMAL, (int)ACCESS_SEQUENTIAL, (int)ACCESS_RANDOM, (int)ACCESS_WILLNEED, (int)(ACCESS_SEQUENTIAL|ACCESS_WILLNEED|ACCESS_HUGEPAGE)})
+    {
+        MappedFile mf(wfile.name(), hints);
+        CHECK_EQ(mf.view(), to_csubstr(contents));
+    }
+    #if defined(C4_POSIX)
+    MappedFile mf(wfile.name());
+    CHECK(mf.advise(ACCESS_SEQUENTIAL));
+    CHECK(mf.advise(ACCESS_RANDOM|ACCESS_WILLNEED));
+    #endif
+}
+
+TEST_CASE("MappedFile.move")
+{
+    auto wfile = ScopedTmpFile(test_contents.str, test_contents.len);
+    MappedFile mf(wfile.name());
+    MappedFile mf2(std::move(mf));
+    CHECK(!mf.valid());
+    CHECK_EQ(mf2.view(), test_contents);
+    MappedFile mf3;
+    CHECK(!mf3.valid());
+    mf3 = std::move(mf2);
+    CHECK(!mf2.valid());
+    CHECK_EQ(mf3.view(), test_contents);
+    MappedFile &alias = mf3; // self-move, without -Wself-move
+    mf3 = std::move(alias);
+    CHECK(mf3.valid());
+    CHECK_EQ(mf3.view(), test_contents);
+}
 
 } // namespace fs
 } // namespace c4